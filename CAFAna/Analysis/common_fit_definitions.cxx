@@ -9,6 +9,7 @@
 #include "CAFAna/Analysis/Plots.h"
 
 #include "CAFAna/Core/Binning.h"
+#include "CAFAna/Core/ColumnarSpectrumLoader.h"
 #include "CAFAna/Core/LoadFromFile.h"
 #include "CAFAna/Core/Loaders.h"
 #include "CAFAna/Core/Progress.h"
@@ -54,6 +55,7 @@
 #endif
 
 #include <chrono>
+#include <thread>
 #include <tuple>
 
 using namespace ana;
@@ -248,7 +250,7 @@ void MakePredictionInterp(TDirectory *saveDir, SampleType sample,
                           std::vector<std::string> const &non_swap_file_list,
                           std::vector<std::string> const &nue_swap_file_list,
                           std::vector<std::string> const &tau_swap_file_list,
-                          int max) {
+                          int max, std::string const &event_cache_prefix) {
 
   bool use_cv_weights = true;
   if (getenv("CAFANA_IGNORE_CV_WEIGHT")) {
@@ -267,19 +269,38 @@ void MakePredictionInterp(TDirectory *saveDir, SampleType sample,
   bool isfhc =
       ((sample == kNDFHC) || (sample == kNDFHC_OA) || (sample == kFDFHC));
 
+  // With an event cache, the evaluated cuts/vars/syst weights are kept in
+  // <prefix>_<sample>_<swap>.cols so that later jobs with other syst subsets
+  // don't have to re-read the CAFs
+  auto MakeLoader = [&](std::vector<std::string> const &file_list,
+                        std::string const &swap) {
+    if (event_cache_prefix.empty()) {
+      return std::unique_ptr<SpectrumLoader>(
+          new SpectrumLoader(file_list, max));
+    }
+    ColumnarSpectrumLoader *loader =
+        new ColumnarSpectrumLoader(file_list, max);
+    loader->SetCacheFile(event_cache_prefix + "_" + GetSampleName(sample) +
+                         "_" + swap + ".cols");
+    return std::unique_ptr<SpectrumLoader>(loader);
+  };
+
   // FD samples
   if ((sample == kFDFHC) || (sample == kFDRHC)) {
 
     Loaders these_loaders;
-    SpectrumLoader loaderNumu(non_swap_file_list, max);
-    SpectrumLoader loaderNue(nue_swap_file_list, max);
-    SpectrumLoader loaderNutau(tau_swap_file_list, max);
-
-    these_loaders.AddLoader(&loaderNumu, caf::kFARDET, Loaders::kMC,
+    std::unique_ptr<SpectrumLoader> loaderNumu =
+        MakeLoader(non_swap_file_list, "nonswap");
+    std::unique_ptr<SpectrumLoader> loaderNue =
+        MakeLoader(nue_swap_file_list, "nueswap");
+    std::unique_ptr<SpectrumLoader> loaderNutau =
+        MakeLoader(tau_swap_file_list, "tauswap");
+
+    these_loaders.AddLoader(loaderNumu.get(), caf::kFARDET, Loaders::kMC,
                             Loaders::kNonSwap);
-    these_loaders.AddLoader(&loaderNue, caf::kFARDET, Loaders::kMC,
+    these_loaders.AddLoader(loaderNue.get(), caf::kFARDET, Loaders::kMC,
                             Loaders::kNueSwap);
-    these_loaders.AddLoader(&loaderNutau, caf::kFARDET, Loaders::kMC,
+    these_loaders.AddLoader(loaderNutau.get(), caf::kFARDET, Loaders::kMC,
                             Loaders::kNuTauSwap);
 
     NoExtrapPredictionGenerator genFDNumu(
@@ -308,8 +329,9 @@ void MakePredictionInterp(TDirectory *saveDir, SampleType sample,
 
     // Now ND
     Loaders these_loaders;
-    SpectrumLoader loaderNumu(non_swap_file_list, max);
-    these_loaders.AddLoader(&loaderNumu, caf::kNEARDET, Loaders::kMC);
+    std::unique_ptr<SpectrumLoader> loaderNumu =
+        MakeLoader(non_swap_file_list, "nonswap");
+    these_loaders.AddLoader(loaderNumu.get(), caf::kNEARDET, Loaders::kMC);
 
     NoOscPredictionGenerator genNDNumu(
         *axes.NDAx,
@@ -957,13 +979,11 @@ double RunFitPoint(std::string stateFileName, std::string sampleString,
 
 #ifdef USE_PREDINTERP_OMP
   size_t maxthreads = omp_get_max_threads();
-  if (maxthreads > 4) {
-    std::cerr << "[INFO]: Cannot run with OMP_NUM_THREADS > 4" << std::endl;
-    abort();
-  }
   if (PostFitTreeBlob) {
     PostFitTreeBlob->fNMaxThreads = maxthreads;
   }
+#else
+  size_t maxthreads = std::thread::hardware_concurrency();
 #endif
 
   // Start by getting the PredictionInterps... better that this is done here
@@ -981,7 +1001,9 @@ double RunFitPoint(std::string stateFileName, std::string sampleString,
           "CAFANA_USE_NDCOVMAT", "CAFANA_IGNORE_CV_WEIGHT",
           "CAFANA_IGNORE_SELECTION", "CAFANA_DISABLE_DERIVATIVES",
           "CAFANA_DONT_CLAMP_SYSTS", "CAFANA_FIT_TURBOSE",
-          "CAFANA_FIT_FORCE_HESSE", "CAFANA_PRED_MINMCSTATS", "FIT_PRECISION",
+          "CAFANA_FIT_FORCE_HESSE", "CAFANA_FIT_SERIAL_EXPTS",
+          "CAFANA_FIT_SERIAL_SEEDS",
+          "CAFANA_PRED_MINMCSTATS", "FIT_PRECISION",
           "FIT_TOLERANCE", "SLURM_JOB_ID", "SLURM_PROCID", "SLURM_NODEID",
           "SLURM_LOCALID"}) {
       if (getenv(env_str)) {
@@ -1288,6 +1310,13 @@ double RunFitPoint(std::string stateFileName, std::string sampleString,
   if (pot_fd_rhc_nue > 0)
     this_expt.Add(&app_expt_rhc);
 
+  // Evaluate the samples concurrently, unless asked not to. They share the
+  // OpenMP threads, if any, between them
+  if (maxthreads > 1 && !(getenv("CAFANA_FIT_SERIAL_EXPTS") &&
+                          bool(atoi(getenv("CAFANA_FIT_SERIAL_EXPTS"))))) {
+    this_expt.SetParallel();
+  }
+
   if (turbose) {
     std::cout << "[INFO]: Built multi-experiment " << BuildLogInfoString()
               << std::endl;
@@ -1302,6 +1331,13 @@ double RunFitPoint(std::string stateFileName, std::string sampleString,
   // Now set up the fit itself
   std::cerr << "[INFO]: Beginning fit. " << BuildLogInfoString();
   MinuitFitter this_fit(&this_expt, oscVars, systlist, fitStrategy);
+  // The octant/hierarchy seeds are independent, so fit them concurrently,
+  // unless asked not to. They share the OpenMP threads, if any, between them.
+  if (maxthreads > 1 && oscSeeds.size() > 1 &&
+      !(getenv("CAFANA_FIT_SERIAL_SEEDS") &&
+        bool(atoi(getenv("CAFANA_FIT_SERIAL_SEEDS"))))) {
+    this_fit.SetParallelSeeds();
+  }
   double thischisq =
       this_fit.Fit(fitOsc, fitSyst, oscSeeds, {}, MinuitFitter::kVerbose)->EvalMetricVal();
   auto end_fit = std::chrono::system_clock::now();
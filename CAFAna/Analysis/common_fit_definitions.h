@@ -62,7 +62,8 @@ void MakePredictionInterp(
     std::vector<const ana::ISyst *> systlist, AxisBlob const &axes,
     std::vector<std::string> const &non_swap_file_list,
     std::vector<std::string> const &nue_swap_file_list = {},
-    std::vector<std::string> const &tau_swap_file_list = {}, int max = 0);
+    std::vector<std::string> const &tau_swap_file_list = {}, int max = 0,
+    std::string const &event_cache_prefix = "");
 
 std::vector<std::unique_ptr<ana::PredictionInterp>>
 GetPredictionInterps(std::string fileName,
@@ -0,0 +1,1203 @@
+#include "CAFAna/Core/ColumnarSpectrumLoader.h"
+
+#include "CAFAna/Core/FixupRecord.h"
+#include "CAFAna/Core/ISyst.h"
+#include "CAFAna/Core/Progress.h"
+#include "CAFAna/Core/ReweightableSpectrum.h"
+#include "CAFAna/Core/SignalHandlers.h"
+#include "CAFAna/Core/Spectrum.h"
+#include "CAFAna/Core/ThreadPool.h"
+#include "CAFAna/Core/Utilities.h"
+
+#include "duneanaobj/StandardRecord/Proxy/SRProxy.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "TFile.h"
+#include "TROOT.h"
+#include "TString.h"
+#include "TTree.h"
+
+namespace ana
+{
+  static_assert(sizeof(size_t) == sizeof(uint64_t),
+                "Column cache stores offsets as 64-bit");
+
+  // Defined in SpectrumLoader.cxx. Our workers follow the same rules
+  extern std::shared_mutex gSRProxyTransactionMutex;
+
+  //----------------------------------------------------------------------
+  /// Read-only mapping of a whole cache file
+  struct ColumnarSpectrumLoader::CacheMap
+  {
+    CacheMap(const std::string& fname)
+    {
+      const int fd = open(fname.c_str(), O_RDONLY);
+      if(fd < 0) return;
+
+      struct stat st;
+      if(fstat(fd, &st) == 0 && st.st_size > 0){
+        void* p = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(p != MAP_FAILED){
+          data = (const char*)p;
+          size = st.st_size;
+        }
+      }
+      close(fd);
+    }
+
+    ~CacheMap(){if(data) munmap((void*)data, size);}
+
+    const char* data = 0;
+    size_t size = 0;
+  };
+
+  //----------------------------------------------------------------------
+  ColumnarSpectrumLoader::ColumnarSpectrumLoader(const std::string& wildcard,
+                                                 int max)
+    : SpectrumLoader(wildcard, max), fNEvents(0), fFilesRead(false)
+  {
+  }
+
+  //----------------------------------------------------------------------
+  ColumnarSpectrumLoader::ColumnarSpectrumLoader(const std::vector<std::string>& fnames,
+                                                 int max)
+    : SpectrumLoader(fnames, max), fNEvents(0), fFilesRead(false)
+  {
+  }
+
+  //----------------------------------------------------------------------
+  ColumnarSpectrumLoader::~ColumnarSpectrumLoader()
+  {
+  }
+
+  //----------------------------------------------------------------------
+  void ColumnarSpectrumLoader::ClearColumns()
+  {
+    fShiftTables.clear();
+    fCacheMap.reset();
+    fNomCols.cuts.clear();
+    fNomCols.weis.clear();
+    fNomCols.vars.clear();
+    fNomCols.multiVars.clear();
+    fNomCols.nRecords = 0;
+    fNEvents = 0;
+  }
+
+  //----------------------------------------------------------------------
+  std::string ColumnarSpectrumLoader::ShiftKey(const SystShifts& s)
+  {
+    if(s.IsNominal()) return "nominal";
+
+    std::vector<std::string> parts;
+    for(const ISyst* syst: s.ActiveSysts())
+      parts.push_back(syst->ShortName() + "=" + TString::Format("%.17g", s.GetShift(syst)).Data());
+    std::sort(parts.begin(), parts.end());
+
+    std::string ret;
+    for(const std::string& part: parts) ret += part + ",";
+    return ret;
+  }
+
+  //----------------------------------------------------------------------
+  /// Helper for \ref ColumnarSpectrumLoader::Columns::AddColumns. Returns
+  /// true if \a cols changed
+  template<class T, class C> bool AddColumn(std::map<int, ColumnarSpectrumLoader::Column<T, C>>& cols,
+                                            const T& func, int guardID)
+  {
+    bool ret = false;
+    auto it = cols.find(func.ID());
+    if(it == cols.end()){
+      it = cols.emplace(func.ID(), ColumnarSpectrumLoader::Column<T, C>(func)).first;
+      ret = true;
+    }
+
+    std::vector<int>& guardIDs = it->second.guardIDs;
+    if(guardID >= 0 && std::find(guardIDs.begin(), guardIDs.end(), guardID) == guardIDs.end()){
+      guardIDs.push_back(guardID);
+      ret = true;
+    }
+
+    return ret;
+  }
+
+  //----------------------------------------------------------------------
+  bool ColumnarSpectrumLoader::Columns::AddColumns(CutDefs& cutdefs)
+  {
+    bool ret = false;
+
+    for(auto& cutdef: cutdefs){
+      const int cutID = cutdef.first.ID();
+      ret |= AddColumn(cuts, cutdef.first, -1);
+
+      for(auto& weidef: cutdef.second){
+        ret |= AddColumn(weis, weidef.first, cutID);
+
+        for(auto& vardef: weidef.second){
+          if(vardef.first.IsMulti())
+            ret |= AddColumn(multiVars, vardef.first.GetMultiVar(), cutID);
+          else
+            ret |= AddColumn(vars, vardef.first.GetVar(), cutID);
+
+          for(auto& rv: vardef.second.rwSpects)
+            ret |= AddColumn(vars, rv.second, cutID);
+        } // end for vardef
+      } // end for weidef
+    } // end for cutdef
+
+    return ret;
+  }
+
+  //----------------------------------------------------------------------
+  /// Helper for \ref ColumnarSpectrumLoader::Columns::AddColumns
+  template<class T, class C> void AddColumns(std::map<int, ColumnarSpectrumLoader::Column<T, C>>& to,
+                                             const std::map<int, ColumnarSpectrumLoader::Column<T, C>>& from)
+  {
+    for(auto& it: from){
+      if(it.second.guardIDs.empty()) AddColumn(to, it.second.func, -1);
+      for(int guardID: it.second.guardIDs) AddColumn(to, it.second.func, guardID);
+    }
+  }
+
+  //----------------------------------------------------------------------
+  void ColumnarSpectrumLoader::Columns::AddColumns(const Columns& other)
+  {
+    ana::AddColumns(cuts, other.cuts);
+    ana::AddColumns(weis, other.weis);
+    ana::AddColumns(vars, other.vars);
+    ana::AddColumns(multiVars, other.multiVars);
+  }
+
+  //----------------------------------------------------------------------
+  /// Helper for \ref ColumnarSpectrumLoader::Columns::BindGuards
+  template<class T, class C> void BindGuards(std::map<int, ColumnarSpectrumLoader::Column<T, C>>& cols,
+                                             const std::map<int, ColumnarSpectrumLoader::Column<Cut, char>>& cuts)
+  {
+    for(auto& it: cols){
+      it.second.guards.clear();
+      for(int guardID: it.second.guardIDs)
+        it.second.guards.push_back(&cuts.at(guardID).vals);
+    }
+  }
+
+  //----------------------------------------------------------------------
+  void ColumnarSpectrumLoader::Columns::BindGuards()
+  {
+    ana::BindGuards(weis, cuts);
+    ana::BindGuards(vars, cuts);
+    ana::BindGuards(multiVars, cuts);
+  }
+
+  //----------------------------------------------------------------------
+  /// Helper for \ref ColumnarSpectrumLoader::Columns::Append. Does the
+  /// record just appended to the cut columns pass any of \a guards?
+  inline bool AnyGuardPasses(const std::vector<const std::vector<char>*>& guards)
+  {
+    for(const std::vector<char>* g: guards) if(g->back()) return true;
+    return false;
+  }
+
+  //----------------------------------------------------------------------
+  void ColumnarSpectrumLoader::Columns::Append(const caf::SRProxy* sr)
+  {
+    // Cuts first, everything else is guarded on them
+    for(auto& it: cuts) it.second.vals.push_back(it.second.func(sr));
+
+    for(auto& it: weis)
+      it.second.vals.push_back(AnyGuardPasses(it.second.guards) ? it.second.func(sr) : 0);
+
+    for(auto& it: vars)
+      it.second.vals.push_back(AnyGuardPasses(it.second.guards) ? it.second.func(sr) : 0);
+
+    for(auto& it: multiVars){
+      if(AnyGuardPasses(it.second.guards)){
+        const std::vector<double> vals = it.second.func(sr);
+        it.second.vals.insert(it.second.vals.end(), vals.begin(), vals.end());
+      }
+      it.second.offsets.push_back(it.second.vals.size());
+    }
+
+    ++nRecords;
+  }
+
+  //----------------------------------------------------------------------
+  /// Helper for \ref ColumnarSpectrumLoader::Columns::AppendFrom
+  template<class T, class C> void AppendFrom(std::map<int, ColumnarSpectrumLoader::Column<T, C>>& to,
+                                             const std::map<int, ColumnarSpectrumLoader::Column<T, C>>& from,
+                                             size_t first, size_t last)
+  {
+    for(auto& it: to){
+      const std::vector<C>& vals = from.at(it.first).vals;
+      it.second.vals.insert(it.second.vals.end(), vals.begin()+first, vals.begin()+last);
+    }
+  }
+
+  //----------------------------------------------------------------------
+  void ColumnarSpectrumLoader::Columns::AppendFrom(const Columns& nom,
+                                                   size_t first, size_t last)
+  {
+    if(first >= last) return;
+
+    ana::AppendFrom(cuts, nom.cuts, first, last);
+    ana::AppendFrom(weis, nom.weis, first, last);
+    ana::AppendFrom(vars, nom.vars, first, last);
+
+    for(auto& it: multiVars){
+      const Column<MultiVar, double>& src = nom.multiVars.at(it.first);
+      const size_t begin = first ? src.offsets[first-1] : 0;
+      const size_t end = src.offsets[last-1];
+
+      const size_t base = it.second.vals.size();
+      it.second.vals.insert(it.second.vals.end(), src.vals.begin()+begin, src.vals.begin()+end);
+      for(size_t i = first; i < last; ++i)
+        it.second.offsets.push_back(src.offsets[i] - begin + base);
+    }
+
+    nRecords += last-first;
+  }
+
+  //----------------------------------------------------------------------
+  /// Helper for \ref ColumnarSpectrumLoader::Columns::ClearValues
+  template<class T, class C> void ClearValues(std::map<int, ColumnarSpectrumLoader::Column<T, C>>& cols)
+  {
+    for(auto& it: cols){
+      it.second.vals.clear();
+      it.second.offsets.clear();
+      it.second.mapped = 0;
+      it.second.mappedOffsets = 0;
+    }
+  }
+
+  //----------------------------------------------------------------------
+  void ColumnarSpectrumLoader::Columns::ClearValues()
+  {
+    ana::ClearValues(cuts);
+    ana::ClearValues(weis);
+    ana::ClearValues(vars);
+    ana::ClearValues(multiVars);
+    nRecords = 0;
+  }
+
+  //----------------------------------------------------------------------
+  void ColumnarSpectrumLoader::Go()
+  {
+    if(fGone){
+      std::cerr << "Error: ColumnarSpectrumLoader::Go() called recursively" << std::endl;
+      abort();
+    }
+    fGone = true;
+
+    // Work out whether the registered spectra need anything we don't have
+    bool missing = !fFilesRead;
+    for(auto& shiftdef: fHistDefs){
+      const std::string key = ShiftKey(shiftdef.first);
+
+      auto it = fShiftTables.find(key);
+      if(it == fShiftTables.end()){
+        ShiftTable table;
+        table.shift = shiftdef.first.Copy();
+        table.cols = std::make_unique<Columns>();
+        it = fShiftTables.emplace(key, std::move(table)).first;
+        missing = true;
+      }
+
+      if(it->second.cols->AddColumns(shiftdef.second)) missing = true;
+    }
+
+    // Only the first pass can come from (or go to) the cache
+    const bool useCache = missing && !fFilesRead && !fCacheFile.empty();
+    ECacheStatus cache = kCacheAbsent;
+    if(useCache){
+      cache = LoadCache();
+      if(cache == kCacheLoaded) missing = false;
+    }
+
+    // Everything has to be re-extracted, for the new spectra and the old
+    // columns alike, since they all need to line up record-by-record
+    if(missing){
+      ExtractColumns();
+
+      // Don't clobber a good cache that some other job might want all of
+      if(useCache && (cache == kCacheAbsent || cache == kCacheBad))
+        WriteCache(fCacheFile);
+    }
+
+    FillFromColumns();
+
+    StoreExposures();
+
+    ReportExposures();
+
+    fHistDefs.RemoveLoader(this);
+    fHistDefs.Clear();
+
+    // Unlike the base class, more spectra may be registered now
+    fGone = false;
+  }
+
+  //----------------------------------------------------------------------
+  ColumnarSpectrumLoader::FileStamp ColumnarSpectrumLoader::Stamp(TFile* f)
+  {
+    FileStamp ret;
+    ret.name = f->GetName();
+    ret.size = f->GetSize();
+    ret.modified = f->GetModificationDate().Get();
+    ret.entries = GetCAFTree(f)->GetEntries();
+    return ret;
+  }
+
+  //----------------------------------------------------------------------
+  void ColumnarSpectrumLoader::ExtractColumns()
+  {
+    fNomCols.ClearValues();
+    for(auto& it: fShiftTables){
+      ShiftTable& table = it.second;
+      table.cols->ClearValues();
+      table.systWeight.clear();
+      table.mappedSystWeight = 0;
+      table.altered = false;
+
+      fNomCols.AddColumns(*table.cols);
+    }
+    fNEvents = 0;
+    // Nothing points into it anymore
+    fCacheMap.reset();
+
+    caf::SRBranchRegistry::clear();
+
+    const int Nfiles = fFilesRead ? fFiles.size() : NFiles();
+
+    std::string sum = TString::Format("Extracting %lu columns", fNomCols.cuts.size() + fNomCols.weis.size() + fNomCols.vars.size() + fNomCols.multiVars.size()).Data();
+    sum += TString::Format(" from %d files matching '%s'", Nfiles, fWildcard.c_str()).Data();
+
+    const unsigned int nThreads = NThreads() ? NThreads() : std::max(1u, std::thread::hardware_concurrency());
+
+    Progress* prog = 0;
+    std::unique_ptr<ThreadPool> pool;
+    if(nThreads > 1){
+      // We're going to be reading several files at once
+      ROOT::EnableThreadSafety();
+
+      pool = std::make_unique<ThreadPool>(nThreads);
+      sum += TString::Format(" on %u threads", nThreads).Data();
+      pool->ShowProgress(sum);
+    }
+    else if(Nfiles >= 0){
+      prog = new Progress(sum);
+    }
+
+    // The workers' ranges, in file order. Each is merged into the totals as
+    // soon as it and all the ones before it are done. Guards the totals too.
+    std::mutex mergeMutex;
+    std::deque<std::unique_ptr<RangeColumns>> pending;
+
+    auto mergeDone = [&](){
+      while(!pending.empty() && pending.front()->done){
+        MergeRange(*pending.front());
+        pending.pop_front();
+      }
+    };
+
+    auto handleFile = [&](TFile* f){
+      TTree* tr = GetCAFTree(f);
+
+      long Nentries = tr->GetEntries();
+      if(max_entries != 0 && max_entries < Nentries)
+        Nentries = max_entries;
+
+      if(!pool){
+        std::unique_ptr<RangeColumns> range = NewRange();
+        ExtractRange(tr, 0, Nentries, *range, Nfiles == 1 ? prog : 0, false);
+        MergeRange(*range);
+        return;
+      }
+
+      // Same split as SpectrumLoader::GoParallel
+      long Nchunks = 1;
+      if(Nfiles >= 0 && Nfiles < int(nThreads))
+        Nchunks = (nThreads+Nfiles-1)/Nfiles;
+      Nchunks = std::max(1L, std::min(Nchunks, Nentries));
+
+      const std::string fname = f->GetName();
+
+      for(long chunk = 0; chunk < Nchunks; ++chunk){
+        const long first = (Nentries*chunk)/Nchunks;
+        const long last = (Nentries*(chunk+1))/Nchunks;
+
+        RangeColumns* range;
+        {
+          std::lock_guard<std::mutex> lock(mergeMutex);
+          pending.push_back(NewRange());
+          range = pending.back().get();
+        }
+
+        ThreadPool::func_t task = [=, &mergeMutex, &mergeDone](){
+          if(!CAFAnaQuitRequested()){
+            // The file source closes the previous file when asked for the
+            // next, so open our own handle
+            std::unique_ptr<TFile> wf(TFile::Open(fname.c_str()));
+            if(!wf || wf->IsZombie()){
+              std::cout << "Bad file (zombie): " << fname << std::endl;
+              abort();
+            }
+
+            ExtractRange(GetCAFTree(wf.get()), first, last, *range, 0, true);
+          }
+
+          std::lock_guard<std::mutex> lock(mergeMutex);
+          range->done = true;
+          mergeDone();
+        };
+        pool->AddTask(task);
+      }
+    };
+
+    if(!fFilesRead){
+      // First time through, GetNextFile() accumulates the POT as usual
+      int fileIdx = -1;
+      while(TFile* f = GetNextFile()){
+        ++fileIdx;
+        fFiles.push_back(Stamp(f));
+
+        handleFile(f);
+
+        if(Nfiles > 1 && prog) prog->SetProgress((fileIdx+1.)/Nfiles);
+
+        if(CAFAnaQuitRequested()) break;
+      }
+      fFilesRead = true;
+    }
+    else{
+      // The file source is used up, and we already have the POT
+      for(unsigned int fileIdx = 0; fileIdx < fFiles.size(); ++fileIdx){
+        std::unique_ptr<TFile> f(TFile::Open(fFiles[fileIdx].name.c_str()));
+        if(!f || f->IsZombie()){
+          std::cout << "Bad file (zombie): " << fFiles[fileIdx].name << std::endl;
+          abort();
+        }
+
+        handleFile(f.get());
+
+        if(Nfiles > 1 && prog) prog->SetProgress((fileIdx+1.)/Nfiles);
+
+        if(CAFAnaQuitRequested()) break;
+      }
+    }
+
+    if(pool) pool->Finish();
+    assert(pending.empty());
+
+    // Shifts that altered something need values for every record. The ones
+    // that didn't only need their weights
+    for(auto& it: fShiftTables){
+      ShiftTable& table = it.second;
+      if(table.altered)
+        table.cols->AppendFrom(fNomCols, table.cols->nRecords, fNEvents);
+    }
+
+    if(prog){
+      prog->Done();
+      delete prog;
+    }
+  }
+
+  //----------------------------------------------------------------------
+  std::unique_ptr<ColumnarSpectrumLoader::RangeColumns>
+  ColumnarSpectrumLoader::NewRange() const
+  {
+    std::unique_ptr<RangeColumns> ret = std::make_unique<RangeColumns>();
+
+    for(auto& it: fShiftTables){
+      ShiftTable table;
+      // Each worker needs its own, SystShifts aren't thread-safe
+      table.shift = it.second.shift->Copy();
+      table.cols = std::make_unique<Columns>();
+      table.cols->AddColumns(*it.second.cols);
+      table.cols->BindGuards();
+
+      ret->nom.AddColumns(*it.second.cols);
+      ret->shifts.emplace(it.first, std::move(table));
+    }
+    ret->nom.BindGuards();
+
+    return ret;
+  }
+
+  //----------------------------------------------------------------------
+  void ColumnarSpectrumLoader::ExtractRange(TTree* tr, long first, long last,
+                                            RangeColumns& out, Progress* prog,
+                                            bool threaded) const
+  {
+    // Constructing and destroying the proxy touches SRProxy's global
+    // bookkeeping
+    std::unique_lock<std::shared_mutex> setup(gSRProxyTransactionMutex, std::defer_lock);
+
+    {
+      if(threaded) setup.lock();
+      caf::SRProxy sr(tr, "");
+      if(threaded) setup.unlock();
+
+      FloatingExceptionOnNaN fpnan(false);
+
+      for(long n = first; n < last; ++n){
+        tr->LoadTree(n);
+
+        {
+          // See SpectrumLoader::HandleFileRange
+          std::shared_lock<std::shared_mutex> fixlock(gSRProxyTransactionMutex, std::defer_lock);
+          if(threaded) fixlock.lock();
+          FixupRecord(&sr, tr);
+        }
+
+        ExtractRecord(&sr, out, threaded);
+
+        if(prog && n%100 == 0) prog->SetProgress(double(n-first)/(last-first));
+      } // end for n
+
+      if(threaded) setup.lock();
+    }
+
+    // Complete the altered shifts, so that the range stands on its own
+    for(auto& it: out.shifts){
+      ShiftTable& table = it.second;
+      if(table.altered)
+        table.cols->AppendFrom(out.nom, table.cols->nRecords, out.nEvents);
+    }
+  }
+
+  //----------------------------------------------------------------------
+  void ColumnarSpectrumLoader::ExtractRecord(caf::SRProxy* sr,
+                                             RangeColumns& out,
+                                             bool threaded) const
+  {
+    out.nom.Append(sr);
+
+    for(auto& it: out.shifts){
+      ShiftTable& table = it.second;
+
+      if(table.shift->IsNominal()) continue;
+
+      // Same transaction dance (and locking) as SpectrumLoader::HandleRecord
+      std::unique_lock<std::shared_mutex> lock(gSRProxyTransactionMutex, std::defer_lock);
+      if(threaded) lock.lock();
+
+      caf::SRProxySystController::BeginTransaction();
+
+      double systWeight = 1;
+      table.shift->Shift(sr, systWeight);
+      table.systWeight.push_back(systWeight);
+
+      if(caf::SRProxySystController::AnyShifted()){
+        // Catch up with all the records this shift left alone so far
+        table.cols->AppendFrom(out.nom, table.cols->nRecords, out.nEvents);
+        table.cols->Append(sr);
+        table.altered = true;
+      }
+
+      caf::SRProxySystController::Rollback();
+    } // end for it
+
+    ++out.nEvents;
+  }
+
+  //----------------------------------------------------------------------
+  void ColumnarSpectrumLoader::MergeRange(RangeColumns& range)
+  {
+    const size_t base = fNEvents;
+
+    fNomCols.AppendFrom(range.nom, 0, range.nEvents);
+
+    for(auto& it: fShiftTables){
+      ShiftTable& table = it.second;
+      const ShiftTable& from = range.shifts.at(it.first);
+
+      table.systWeight.insert(table.systWeight.end(),
+                              from.systWeight.begin(), from.systWeight.end());
+
+      if(from.altered){
+        // Catch up with all the records this shift left alone so far
+        table.cols->AppendFrom(fNomCols, table.cols->nRecords, base);
+        table.cols->AppendFrom(*from.cols, 0, range.nEvents);
+        table.altered = true;
+      }
+    }
+
+    fNEvents += range.nEvents;
+  }
+
+  //----------------------------------------------------------------------
+  void ColumnarSpectrumLoader::FillFromColumns()
+  {
+    for(auto& shiftdef: fHistDefs){
+      const ShiftTable& table = fShiftTables.at(ShiftKey(shiftdef.first));
+      const Columns& cols = table.altered ? *table.cols : fNomCols;
+      const double* systWeight = table.SystWeights();
+
+      for(auto& cutdef: shiftdef.second){
+        const char* pass = cols.cuts.at(cutdef.first.ID()).Vals();
+
+        for(auto& weidef: cutdef.second){
+          const double* weis = cols.weis.at(weidef.first.ID()).Vals();
+
+          for(auto& vardef: weidef.second){
+            const SpectList& sl = vardef.second;
+
+            if(vardef.first.IsMulti()){
+              const Column<MultiVar, double>& col = cols.multiVars.at(vardef.first.ID());
+              const double* colVals = col.Vals();
+              const size_t* offsets = col.Offsets();
+
+              for(size_t i = 0; i < fNEvents; ++i){
+                if(!pass[i]) continue;
+
+                double wei = weis[i];
+                CheckWeight(wei);
+
+                if(systWeight) wei *= systWeight[i];
+                if(wei == 0) continue;
+
+                for(size_t k = i ? offsets[i-1] : 0; k < offsets[i]; ++k)
+                  for(Spectrum** s: sl.spects)
+                    if(*s) (*s)->Fill(colVals[k], wei);
+              } // end for i
+              continue;
+            }
+
+            const double* vals = cols.vars.at(vardef.first.ID()).Vals();
+
+            std::vector<const double*> yvalCols;
+            for(auto& rv: sl.rwSpects) yvalCols.push_back(cols.vars.at(rv.second.ID()).Vals());
+            std::vector<double> yvals(yvalCols.size());
+
+            for(size_t i = 0; i < fNEvents; ++i){
+              // Cut failed, skip all the histograms that depended on it
+              if(!pass[i]) continue;
+
+              double wei = weis[i];
+              CheckWeight(wei);
+
+              if(systWeight) wei *= systWeight[i];
+              if(wei == 0) continue;
+
+              for(unsigned int rvIdx = 0; rvIdx < yvalCols.size(); ++rvIdx)
+                yvals[rvIdx] = yvalCols[rvIdx][i];
+
+              FillSpectList(sl, vals[i], wei, yvals.data(), 0);
+            } // end for i
+          } // end for vardef
+        } // end for weidef
+      } // end for cutdef
+    } // end for shiftdef
+  }
+
+  // Cache file layout. Everything is padded to 8 bytes so that the arrays
+  // can be used in place once the file is mapped.
+  //
+  //   magic, version, nEvents, max_entries, POT
+  //   nFiles, {file name, size, modification date, entries}
+  //   nominal columns
+  //   nShifts, {shift key, altered, syst weights, columns if altered}
+  //
+  // where each set of columns is cuts, weights, vars, multivars, each of
+  // them a count followed by {ID, guard IDs, values, [offsets]}.
+
+  const char kCacheMagic[8] = {'C', 'A', 'F', 'C', 'O', 'L', 'S', '\0'};
+  const uint64_t kCacheVersion = 2;
+
+  /// How many records \ref ColumnarSpectrumLoader::ValidateCache compares
+  const long kCacheValidateRecords = 64;
+
+  //----------------------------------------------------------------------
+  /// Helper for \ref ColumnarSpectrumLoader::WriteCache
+  void WritePadded(std::ostream& os, const void* p, size_t n)
+  {
+    if(n) os.write((const char*)p, n);
+    const char zeros[8] = {};
+    if(n%8) os.write(zeros, 8-n%8);
+  }
+
+  //----------------------------------------------------------------------
+  /// Helper for \ref ColumnarSpectrumLoader::WriteCache
+  void WriteU64(std::ostream& os, uint64_t x)
+  {
+    os.write((const char*)&x, sizeof(x));
+  }
+
+  //----------------------------------------------------------------------
+  /// Helper for \ref ColumnarSpectrumLoader::WriteCache
+  void WriteString(std::ostream& os, const std::string& str)
+  {
+    WriteU64(os, str.size());
+    WritePadded(os, str.data(), str.size());
+  }
+
+  //----------------------------------------------------------------------
+  /// Helper for \ref ColumnarSpectrumLoader::WriteCache
+  template<class T, class C> void WriteColumns(std::ostream& os,
+                                               const std::map<int, ColumnarSpectrumLoader::Column<T, C>>& cols,
+                                               size_t nEvents, bool multi)
+  {
+    WriteU64(os, cols.size());
+    for(auto& it: cols){
+      WriteU64(os, it.first);
+
+      std::vector<int64_t> guards(it.second.guardIDs.begin(), it.second.guardIDs.end());
+      WriteU64(os, guards.size());
+      WritePadded(os, guards.data(), guards.size()*sizeof(int64_t));
+
+      size_t nVals = nEvents;
+      if(multi) nVals = nEvents ? it.second.Offsets()[nEvents-1] : 0;
+      WriteU64(os, nVals);
+      WritePadded(os, it.second.Vals(), nVals*sizeof(C));
+
+      if(multi){
+        WriteU64(os, nEvents);
+        WritePadded(os, it.second.Offsets(), nEvents*sizeof(size_t));
+      }
+    }
+  }
+
+  //----------------------------------------------------------------------
+  /// Helper for \ref ColumnarSpectrumLoader::WriteCache
+  void WriteColumns(std::ostream& os,
+                    const ColumnarSpectrumLoader::Columns& cols,
+                    size_t nEvents)
+  {
+    WriteColumns(os, cols.cuts, nEvents, false);
+    WriteColumns(os, cols.weis, nEvents, false);
+    WriteColumns(os, cols.vars, nEvents, false);
+    WriteColumns(os, cols.multiVars, nEvents, true);
+  }
+
+  //----------------------------------------------------------------------
+  void ColumnarSpectrumLoader::WriteCache(const std::string& fname) const
+  {
+    // Write under another name and move it into place, so that any other
+    // job looking for this cache never sees half a file
+    const std::string tmpName = fname + TString::Format(".tmp%d", getpid()).Data();
+
+    {
+      std::ofstream os(tmpName, std::ios::binary);
+      if(!os){
+        std::cerr << "Warning: ColumnarSpectrumLoader can't write cache "
+                  << tmpName << std::endl;
+        return;
+      }
+
+      WritePadded(os, kCacheMagic, sizeof(kCacheMagic));
+      WriteU64(os, kCacheVersion);
+      WriteU64(os, fNEvents);
+      WriteU64(os, int64_t(max_entries));
+      WritePadded(os, &fPOT, sizeof(fPOT));
+
+      WriteU64(os, fFiles.size());
+      for(const FileStamp& file: fFiles){
+        WriteString(os, file.name);
+        WriteU64(os, file.size);
+        WriteU64(os, file.modified);
+        WriteU64(os, file.entries);
+      }
+
+      WriteColumns(os, fNomCols, fNEvents);
+
+      WriteU64(os, fShiftTables.size());
+      for(auto& it: fShiftTables){
+        const ShiftTable& table = it.second;
+        WriteString(os, it.first);
+        WriteU64(os, table.altered);
+
+        const double* systWeight = table.SystWeights();
+        WriteU64(os, systWeight ? fNEvents : 0);
+        if(systWeight) WritePadded(os, systWeight, fNEvents*sizeof(double));
+
+        if(table.altered) WriteColumns(os, *table.cols, fNEvents);
+      }
+
+      if(!os){
+        std::cerr << "Warning: ColumnarSpectrumLoader failed writing cache "
+                  << tmpName << std::endl;
+        std::remove(tmpName.c_str());
+        return;
+      }
+    }
+
+    if(std::rename(tmpName.c_str(), fname.c_str()) != 0){
+      std::cerr << "Warning: ColumnarSpectrumLoader can't move cache into place at "
+                << fname << std::endl;
+      std::remove(tmpName.c_str());
+      return;
+    }
+
+    std::cout << "Wrote " << fNEvents << " records to column cache "
+              << fname << std::endl;
+  }
+
+  //----------------------------------------------------------------------
+  /// \brief Helper for \ref ColumnarSpectrumLoader::LoadCache
+  ///
+  /// Walks through the mapped file. Any read past the end sets \ref ok to
+  /// false rather than crashing
+  struct CacheReader
+  {
+    CacheReader(const char* d, size_t n) : pos(d), end(d+n), ok(true) {}
+
+    const void* Padded(size_t n)
+    {
+      const size_t padded = (n+7)/8*8;
+      if(!ok || size_t(end-pos) < padded){ok = false; return 0;}
+      const void* ret = pos;
+      pos += padded;
+      return ret;
+    }
+
+    uint64_t U64()
+    {
+      const void* p = Padded(sizeof(uint64_t));
+      return p ? *(const uint64_t*)p : 0;
+    }
+
+    std::string String()
+    {
+      const uint64_t n = U64();
+      const char* p = (const char*)Padded(n);
+      return p ? std::string(p, n) : std::string();
+    }
+
+    template<class C> const C* Array(uint64_t n)
+    {
+      if(n > size_t(end-pos)/sizeof(C)){ok = false; return 0;}
+      return (const C*)Padded(n*sizeof(C));
+    }
+
+    const char* pos;
+    const char* end;
+    bool ok;
+  };
+
+  /// One column as found in the cache
+  struct CachedColumn
+  {
+    std::vector<int> guardIDs;
+    const void* vals;
+    uint64_t nVals;
+    const size_t* offsets;
+    uint64_t nOffsets;
+  };
+
+  /// One set of columns as found in the cache. Indexed by cuts, weights,
+  /// vars, multivars, then ID
+  typedef std::array<std::map<int, CachedColumn>, 4> CachedColumns;
+
+  //----------------------------------------------------------------------
+  /// Helper for \ref ColumnarSpectrumLoader::LoadCache
+  void ReadColumns(CacheReader& rd, CachedColumns& ret, size_t elemSize[4])
+  {
+    for(int kind = 0; kind < 4; ++kind){
+      const uint64_t nCols = rd.U64();
+      for(uint64_t i = 0; i < nCols && rd.ok; ++i){
+        const int id = rd.U64();
+
+        CachedColumn col;
+        const uint64_t nGuards = rd.U64();
+        const int64_t* guards = rd.Array<int64_t>(nGuards);
+        if(guards) col.guardIDs.assign(guards, guards+nGuards);
+
+        col.nVals = rd.U64();
+        if(col.nVals > size_t(rd.end-rd.pos)/elemSize[kind]){rd.ok = false; break;}
+        col.vals = rd.Padded(col.nVals*elemSize[kind]);
+
+        col.offsets = 0;
+        col.nOffsets = 0;
+        if(kind == 3){
+          col.nOffsets = rd.U64();
+          col.offsets = rd.Array<size_t>(col.nOffsets);
+        }
+
+        ret[kind][id] = col;
+      }
+    }
+  }
+
+  //----------------------------------------------------------------------
+  /// \brief Helper for \ref ColumnarSpectrumLoader::LoadCache
+  ///
+  /// Point each of \a to at its counterpart in \a from. False if any is
+  /// missing, or was only evaluated under a subset of the cuts we need
+  template<class T, class C> bool BindColumns(std::map<int, ColumnarSpectrumLoader::Column<T, C>>& to,
+                                              const std::map<int, CachedColumn>& from,
+                                              size_t nEvents, bool multi)
+  {
+    for(auto& it: to){
+      auto cit = from.find(it.first);
+      if(cit == from.end()) return false;
+      const CachedColumn& col = cit->second;
+
+      for(int guardID: it.second.guardIDs)
+        if(std::find(col.guardIDs.begin(), col.guardIDs.end(), guardID) == col.guardIDs.end()) return false;
+
+      if(multi){
+        if(col.nOffsets != nEvents) return false;
+        if(nEvents && col.offsets[nEvents-1] != col.nVals) return false;
+      }
+      else if(col.nVals != nEvents) return false;
+
+      it.second.mapped = (const C*)col.vals;
+      it.second.mappedOffsets = col.offsets;
+    }
+    return true;
+  }
+
+  //----------------------------------------------------------------------
+  /// Helper for \ref ColumnarSpectrumLoader::LoadCache
+  bool BindColumns(ColumnarSpectrumLoader::Columns& to,
+                   const CachedColumns& from, size_t nEvents)
+  {
+    if(!BindColumns(to.cuts, from[0], nEvents, false)) return false;
+    if(!BindColumns(to.weis, from[1], nEvents, false)) return false;
+    if(!BindColumns(to.vars, from[2], nEvents, false)) return false;
+    if(!BindColumns(to.multiVars, from[3], nEvents, true)) return false;
+    to.nRecords = nEvents;
+    return true;
+  }
+
+  //----------------------------------------------------------------------
+  ColumnarSpectrumLoader::ECacheStatus ColumnarSpectrumLoader::LoadCache()
+  {
+    std::unique_ptr<CacheMap> map(new CacheMap(fCacheFile));
+    if(!map->data){
+      struct stat st;
+      if(stat(fCacheFile.c_str(), &st) != 0) return kCacheAbsent;
+      std::cerr << "Warning: can't map column cache " << fCacheFile << std::endl;
+      return kCacheBad;
+    }
+
+    size_t elemSize[4] = {sizeof(char), sizeof(double), sizeof(double), sizeof(double)};
+
+    CacheReader rd(map->data, map->size);
+
+    const char* magic = (const char*)rd.Padded(sizeof(kCacheMagic));
+    if(!magic || !std::equal(magic, magic+sizeof(kCacheMagic), kCacheMagic) ||
+       rd.U64() != kCacheVersion){
+      std::cerr << "Warning: " << fCacheFile << " is not a column cache" << std::endl;
+      return kCacheBad;
+    }
+
+    const uint64_t nEvents = rd.U64();
+    const int64_t maxEntries = rd.U64();
+    const double* pot = rd.Array<double>(1);
+
+    std::vector<FileStamp> files(rd.U64());
+    for(FileStamp& file: files){
+      file.name = rd.String();
+      file.size = rd.U64();
+      file.modified = rd.U64();
+      file.entries = rd.U64();
+    }
+
+    CachedColumns nomCols;
+    ReadColumns(rd, nomCols, elemSize);
+
+    struct CachedShift
+    {
+      bool altered;
+      const double* systWeight;
+      uint64_t nSystWeight;
+      CachedColumns cols;
+    };
+    std::map<std::string, CachedShift> shifts;
+
+    const uint64_t nShifts = rd.U64();
+    for(uint64_t i = 0; i < nShifts && rd.ok; ++i){
+      const std::string key = rd.String();
+      CachedShift& shift = shifts[key];
+      shift.altered = rd.U64();
+      shift.nSystWeight = rd.U64();
+      shift.systWeight = rd.Array<double>(shift.nSystWeight);
+      if(shift.altered) ReadColumns(rd, shift.cols, elemSize);
+    }
+
+    if(!rd.ok){
+      std::cerr << "Warning: column cache " << fCacheFile << " is truncated" << std::endl;
+      return kCacheBad;
+    }
+
+    if(maxEntries != max_entries){
+      std::cerr << "Warning: column cache " << fCacheFile << " was written with max = "
+                << maxEntries << ", not " << max_entries << std::endl;
+      return kCacheBad;
+    }
+
+    if(!InputsMatch(files)) return kCacheBad;
+
+    // Match up everything we need with what's in the file
+    bool complete = true;
+    ECacheStatus status = kCacheIncomplete;
+
+    fNomCols.ClearValues();
+    for(auto& it: fShiftTables) fNomCols.AddColumns(*it.second.cols);
+    if(!BindColumns(fNomCols, nomCols, nEvents)) complete = false;
+
+    for(auto& it: fShiftTables){
+      if(!complete) break;
+
+      ShiftTable& table = it.second;
+      table.cols->ClearValues();
+      table.systWeight.clear();
+      table.mappedSystWeight = 0;
+
+      auto sit = shifts.find(it.first);
+      if(sit == shifts.end()){complete = false; break;}
+      const CachedShift& shift = sit->second;
+
+      if(!table.shift->IsNominal() && shift.nSystWeight != nEvents){complete = false; break;}
+      table.mappedSystWeight = shift.nSystWeight ? shift.systWeight : 0;
+
+      table.altered = shift.altered;
+      if(table.altered && !BindColumns(*table.cols, shift.cols, nEvents)) complete = false;
+    }
+
+    fNEvents = nEvents;
+
+    if(complete && !files.empty() && !ValidateCache(files[0].name)){
+      std::cerr << "Warning: column cache " << fCacheFile << " disagrees with "
+                << files[0].name << ". Was it written by a different program?" << std::endl;
+      complete = false;
+      status = kCacheBad;
+    }
+
+    if(!complete){
+      if(status == kCacheIncomplete)
+        std::cout << "Column cache " << fCacheFile << " lacks some of the "
+                  << "columns needed, reading the CAFs" << std::endl;
+
+      fNomCols.ClearValues();
+      for(auto& it: fShiftTables){
+        it.second.cols->ClearValues();
+        it.second.mappedSystWeight = 0;
+        it.second.altered = false;
+      }
+      fNEvents = 0;
+      return status;
+    }
+
+    fCacheMap = std::move(map);
+
+    // As far as anything after this is concerned, the files have been read
+    fFiles = files;
+    fFilesRead = true;
+    fPOT = *pot;
+
+    std::cout << "Loaded " << fNEvents << " records from column cache "
+              << fCacheFile << std::endl;
+
+    return kCacheLoaded;
+  }
+
+  //----------------------------------------------------------------------
+  bool ColumnarSpectrumLoader::InputsMatch(const std::vector<FileStamp>& files) const
+  {
+    const int Nfiles = NFiles();
+    if(Nfiles >= 0 && size_t(Nfiles) != files.size()){
+      std::cerr << "Warning: column cache " << fCacheFile << " was written from "
+                << files.size() << " files, not " << Nfiles << std::endl;
+      return false;
+    }
+
+    for(const FileStamp& file: files){
+      std::unique_ptr<TFile> f(TFile::Open(file.name.c_str()));
+      if(!f || f->IsZombie()){
+        std::cout << "Can't open " << file.name << " to check column cache against, "
+                  << "trusting it" << std::endl;
+        continue;
+      }
+
+      const FileStamp now = Stamp(f.get());
+      if(now.size != file.size || now.modified != file.modified ||
+         now.entries != file.entries){
+        std::cerr << "Warning: " << file.name << " has changed since column cache "
+                  << fCacheFile << " was written" << std::endl;
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  //----------------------------------------------------------------------
+  /// \brief Helper for \ref ColumnarSpectrumLoader::ValidateCache
+  ///
+  /// Compare the first \a n records of \a a (freshly evaluated) and \a b
+  /// (from the cache)
+  template<class T, class C> bool SameColumns(const std::map<int, ColumnarSpectrumLoader::Column<T, C>>& a,
+                                              const std::map<int, ColumnarSpectrumLoader::Column<T, C>>& b,
+                                              size_t n, bool multi)
+  {
+    for(auto& it: a){
+      const ColumnarSpectrumLoader::Column<T, C>& col = b.at(it.first);
+
+      size_t nVals = n;
+      if(multi){
+        if(!std::equal(it.second.offsets.begin(), it.second.offsets.begin()+n, col.Offsets())) return false;
+        nVals = n ? it.second.offsets[n-1] : 0;
+      }
+
+      for(size_t i = 0; i < nVals; ++i){
+        const C x = it.second.vals[i];
+        const C y = col.Vals()[i];
+        // NaN != NaN
+        if(x != y && !(std::isnan(double(x)) && std::isnan(double(y)))) return false;
+      }
+    }
+    return true;
+  }
+
+  //----------------------------------------------------------------------
+  bool ColumnarSpectrumLoader::ValidateCache(const std::string& fname) const
+  {
+    std::unique_ptr<TFile> f(TFile::Open(fname.c_str()));
+    if(!f || f->IsZombie()){
+      std::cout << "Can't open " << fname << " to check column cache against, "
+                << "trusting it" << std::endl;
+      return true;
+    }
+
+    TTree* tr = GetCAFTree(f.get());
+
+    caf::SRProxy sr(tr, "");
+
+    FloatingExceptionOnNaN fpnan(false);
+
+    Columns cols;
+    cols.AddColumns(fNomCols);
+    cols.BindGuards();
+
+    const long N = std::min(std::min(long(fNEvents), kCacheValidateRecords),
+                            long(tr->GetEntries()));
+    for(long n = 0; n < N; ++n){
+      tr->LoadTree(n);
+      FixupRecord(&sr, tr);
+      cols.Append(&sr);
+    }
+
+    return (SameColumns(cols.cuts, fNomCols.cuts, N, false) &&
+            SameColumns(cols.weis, fNomCols.weis, N, false) &&
+            SameColumns(cols.vars, fNomCols.vars, N, false) &&
+            SameColumns(cols.multiVars, fNomCols.multiVars, N, true));
+  }
+}
@@ -0,0 +1,241 @@
+#pragma once
+
+#include "CAFAna/Core/SpectrumLoader.h"
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace ana
+{
+  /// \brief \ref SpectrumLoader that keeps everything it evaluates in memory
+  ///
+  /// Rather than filling the spectra as it goes, \ref Go records the value of
+  /// every registered cut, weight and var (after \ref FixupRecord, and under
+  /// every shift that alters the record) into one contiguous column per
+  /// quantity. The spectra are then filled by sweeping over those columns.
+  /// caf::SRProxy only reads the branches something actually accessed, so
+  /// nothing else in the CAFs is ever touched.
+  ///
+  /// Unlike the base class this loader may be used again after \ref Go:
+  /// register more spectra and call \ref Go once more. If every column they
+  /// need (matched by cut/weight/var ID and by shift) is already in memory
+  /// they are filled without going back to the files. New binnings of a var
+  /// that has been seen before fall in this category, as do new combinations
+  /// of cuts, weights and vars that have each been seen before. Otherwise
+  /// the files are read again, once, to extract the missing columns.
+  ///
+  /// Memory use is roughly 8 bytes per record per column per altering shift.
+  ///
+  /// The files are read on \ref NThreads threads, as in the base class. Each
+  /// worker extracts a range of records into columns of its own, which are
+  /// appended to the totals in file order, so the result doesn't depend on
+  /// the number of threads.
+  ///
+  /// The columns can also be kept on disk between jobs, see \ref
+  /// SetCacheFile.
+  class ColumnarSpectrumLoader: public SpectrumLoader
+  {
+  public:
+    ColumnarSpectrumLoader(const std::string& wildcard, int max = 0);
+    ColumnarSpectrumLoader(const std::vector<std::string>& fnames, int max = 0);
+    virtual ~ColumnarSpectrumLoader();
+
+    virtual void Go() override;
+
+    /// Number of records held in memory
+    size_t NEvents() const {return fNEvents;}
+
+    /// Free all the columns. The next \ref Go will read the files again
+    void ClearColumns();
+
+    /// \brief Keep the columns in \a fname between jobs
+    ///
+    /// If \a fname exists and holds every column the first \ref Go needs, it
+    /// is memory-mapped and the spectra are filled straight from it, along
+    /// with the POT it recorded. The CAFs are not read at all. Otherwise the
+    /// columns are extracted as usual, and written to \a fname if it didn't
+    /// already exist (or was unusable).
+    ///
+    /// The cache records the size, modification date and number of entries
+    /// of every input file, and is discarded if any of them changed, or if
+    /// the number of files did. Files that can't be opened are trusted.
+    ///
+    /// Cuts, weights and vars are identified by ID, which depends on the
+    /// order they were constructed in, so a cache is only meaningful to the
+    /// program that wrote it. As a check, the first few records of the first
+    /// CAF (if it can be opened) are evaluated and compared to the cache.
+    /// Shifts are matched by name and value. To serve jobs with different
+    /// subsets of systs, write the cache with all of them.
+    void SetCacheFile(const std::string& fname) {fCacheFile = fname;}
+
+    /// Write the columns currently in memory to \a fname
+    void WriteCache(const std::string& fname) const;
+
+    // The column storage is public only so that the helpers in the
+    // implementation can see it.
+
+    /// All the values of one cut, weight or var, one per record
+    template<class T, class C> struct Column
+    {
+      Column(const T& f) : func(f) {}
+
+      T func;
+      std::vector<C> vals;
+      /// Only used by MultiVars, entries for record i end at offsets[i]
+      std::vector<size_t> offsets;
+      /// If set, the values live in a memory-mapped cache instead of \ref vals
+      const C* mapped = 0;
+      const size_t* mappedOffsets = 0;
+
+      const C* Vals() const {return mapped ? mapped : vals.data();}
+      const size_t* Offsets() const {return mapped ? mappedOffsets : offsets.data();}
+      /// \brief Skip evaluating for records that pass none of these cuts
+      ///
+      /// Mirrors SpectrumLoader, which never evaluates a var on a record that
+      /// failed the cut it's filled under
+      std::vector<int> guardIDs;
+      /// The columns of \ref guardIDs, set by \ref Columns::BindGuards
+      std::vector<const std::vector<char>*> guards;
+    };
+
+    /// Every column needed for one version of the record
+    struct Columns
+    {
+      Columns() {}
+      // The guards point into our own cut columns
+      Columns(const Columns&) = delete;
+      Columns& operator=(const Columns&) = delete;
+
+      std::map<int, Column<Cut, char>> cuts;
+      std::map<int, Column<Weight, double>> weis;
+      std::map<int, Column<Var, double>> vars;
+      std::map<int, Column<MultiVar, double>> multiVars;
+
+      /// Add the columns needed to fill \a cutdefs. Returns true if there
+      /// was anything new
+      bool AddColumns(CutDefs& cutdefs);
+      /// Add \a other's columns (without values) to ours
+      void AddColumns(const Columns& other);
+
+      /// Must be called before \ref Append
+      void BindGuards();
+      /// Evaluate and append every column for this record
+      void Append(const caf::SRProxy* sr);
+      /// Append records [\a first, \a last) from \a nom, which must have a
+      /// superset of our columns
+      void AppendFrom(const Columns& nom, size_t first, size_t last);
+      /// Drop all the values (and mappings), keeping the column definitions
+      void ClearValues();
+
+      size_t nRecords = 0;
+    };
+
+  protected:
+    /// Everything known about one shift
+    struct ShiftTable
+    {
+      std::unique_ptr<SystShifts> shift;
+      /// Always empty for the nominal
+      std::vector<double> systWeight;
+      /// Replaces \ref systWeight when loaded from a cache
+      const double* mappedSystWeight = 0;
+      /// Null for the nominal
+      const double* SystWeights() const
+      {
+        if(mappedSystWeight) return mappedSystWeight;
+        return systWeight.empty() ? 0 : systWeight.data();
+      }
+      /// Columns this shift needs. Values only filled in if it altered at
+      /// least one record, otherwise the nominal values apply
+      std::unique_ptr<Columns> cols;
+      bool altered = false;
+    };
+
+    /// \ref SystShifts IDs are per-object, so match shifts by their content
+    static std::string ShiftKey(const SystShifts& s);
+
+    /// Values extracted from one range of records, before \ref MergeRange
+    /// appends them to the totals
+    struct RangeColumns
+    {
+      Columns nom;
+      /// Keyed like \ref fShiftTables
+      std::map<std::string, ShiftTable> shifts;
+      size_t nEvents = 0;
+      /// Extraction finished, ready to merge
+      bool done = false;
+    };
+
+    /// Identifies the contents of an input file
+    struct FileStamp
+    {
+      std::string name;
+      int64_t size;     ///< In bytes
+      int64_t modified; ///< TFile modification date, as TDatime::Get()
+      int64_t entries;
+    };
+
+    /// Describe the file as it is now
+    static FileStamp Stamp(TFile* f);
+
+    /// Read the files, evaluating all the columns in \ref fShiftTables
+    void ExtractColumns();
+
+    /// Empty columns with the same layout as \ref fShiftTables
+    std::unique_ptr<RangeColumns> NewRange() const;
+
+    /// \brief Part of \ref ExtractColumns, records [\a first, \a last)
+    ///
+    /// \param threaded Other workers are running, take the SRProxy locks
+    void ExtractRange(TTree* tr, long first, long last,
+                      RangeColumns& out, Progress* prog, bool threaded) const;
+
+    /// Add one record's worth of values to every column of \a out
+    void ExtractRecord(caf::SRProxy* sr, RangeColumns& out, bool threaded) const;
+
+    /// Append \a range, which follows all the records so far, to the totals
+    void MergeRange(RangeColumns& range);
+
+    /// Fill all the spectra in fHistDefs from the columns
+    void FillFromColumns();
+
+    enum ECacheStatus{
+      kCacheAbsent,     ///< No such file
+      kCacheBad,        ///< Unreadable, or written from different inputs
+      kCacheIncomplete, ///< Fine, but lacking some of the columns we need
+      kCacheLoaded
+    };
+
+    /// \brief Try to satisfy every column in \ref fShiftTables from \ref
+    /// fCacheFile
+    ///
+    /// Leaves no mapping behind unless it returns kCacheLoaded
+    ECacheStatus LoadCache();
+
+    /// Part of \ref LoadCache. Are the input files the ones the cache was
+    /// written from, unchanged?
+    bool InputsMatch(const std::vector<FileStamp>& files) const;
+
+    /// Part of \ref LoadCache. Do the mapped nominal columns agree with the
+    /// first few records of \a fname?
+    bool ValidateCache(const std::string& fname) const;
+
+    /// Keyed by \ref ShiftKey
+    std::map<std::string, ShiftTable> fShiftTables;
+    /// Union of the columns of all the shifts
+    Columns fNomCols;
+    size_t fNEvents;
+
+    /// Files read by the first pass, so they can be re-read later
+    std::vector<FileStamp> fFiles;
+    bool fFilesRead;
+
+    std::string fCacheFile;
+    /// The memory-mapped cache file, if the columns came from one
+    struct CacheMap;
+    std::unique_ptr<CacheMap> fCacheMap;
+  };
+}
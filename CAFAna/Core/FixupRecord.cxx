@@ -8,11 +8,24 @@
 
 #include "TTree.h"
 
+#include <atomic>
 #include <cmath>
 #include <iostream>
+#include <mutex>
 
 namespace ana
 {
+  // SpectrumLoader's workers call FixupRecord() concurrently, so the
+  // once-only bookkeeping below has to be thread-safe
+
+  //----------------------------------------------------------------------
+  /// True for the first caller only
+  static bool FirstTime(std::atomic<bool>& done)
+  {
+    return !done.load(std::memory_order_relaxed) && !done.exchange(true);
+  }
+
+  //----------------------------------------------------------------------
   void FixupRecord(caf::SRProxy* sr, TTree* tr)
   {
     // Set GENIE_ScatteringMode and eRec_FromDep
@@ -38,21 +51,19 @@ namespace ana
         if(sr->run == 20000001 || sr->run == 20000002 ||
            sr->run == 20000003) {
           sr->isFHC = true;
-          static bool once = true;
-          if(once) {
+          static std::atomic<bool> done(false);
+          if(FirstTime(done)) {
             std::cout << "\nPatching up FD file to be considered FHC"
                       << std::endl;
-            once = false;
           }
         }
         else if(sr->run == 20000004 || sr->run == 20000005 ||
                 sr->run == 20000006) {
           sr->isFHC = false;
-          static bool once = true;
-          if(once){
+          static std::atomic<bool> done(false);
+          if(FirstTime(done)){
             std::cout << "\nPatching up FD file to be considered RHC"
                       << std::endl;
-            once = false;
           }
         }
         else {
@@ -68,11 +79,10 @@ namespace ana
       if(sr->isFHC == -1){
         // nu-on-e files
         sr->isFHC = true;
-        static bool once = true;
-        if (once) {
+        static std::atomic<bool> done(false);
+        if (FirstTime(done)) {
           std::cout << "\nPatching up nu-on-e file to be considered FHC"
                     << std::endl;
-          once = false;
         }
       }
       else if (sr->isFHC != 0 && sr->isFHC != 1) {
@@ -83,9 +93,8 @@ namespace ana
     }
 
     if(tr->GetNbranches() == 302 || tr->GetNbranches() == 280 /*ndgas*/){
-      static bool once = true;
-      if(once){
-        once = false;
+      static std::atomic<bool> done(false);
+      if(FirstTime(done)){
         std::cout << "Detected TDR-era file. Skipping CV weights, which aren't going to work" << std::endl;
       }
       return;
@@ -95,19 +104,18 @@ namespace ana
     static const std::vector<std::string>& XSSyst_names = GetAllXSecSystNames();
 
     // HACK HACK HACK for knobs that aren't in file
-    static bool hackOnce = true;
-    static std::vector<bool> veto(XSSyst_names.size());
-    if(hackOnce){
-      hackOnce = false;
+    static const std::vector<bool> veto = [](){
+      std::vector<bool> ret(XSSyst_names.size());
       for(unsigned int syst_it = 0; syst_it < XSSyst_names.size(); ++syst_it){
         if(ana::GetXSecSystName(syst_it) == "Mnv2p2hGaussEnhancement_NN" ||
            ana::GetXSecSystName(syst_it) == "Mnv2p2hGaussEnhancement_2p2h" ||
            ana::GetXSecSystName(syst_it) == "Mnv2p2hGaussEnhancement_1p1h" ||
            ana::GetXSecSystName(syst_it) == "MissingProtonFakeData" ||
            ana::GetXSecSystName(syst_it) == "NuWroReweightFakeData"
-           ) veto[syst_it] = true;
+           ) ret[syst_it] = true;
       }
-    }
+      return ret;
+    }();
 
     // HACK to survive the absence of crazyFlux values in the file
     sr->wgt_CrazyFlux = std::vector<double>(7, 1);
@@ -138,6 +146,7 @@ namespace ana
     }
     else{
       static std::vector<bool> alreadyWarned(XSSyst_names.size(), false);
+      static std::mutex warnMutex;
 
       for(unsigned int syst_it = 0; syst_it < XSSyst_names.size(); ++syst_it){
         // Continuation of the hack from further up
@@ -148,6 +157,7 @@ namespace ana
           if(std::isnan(sr->cvwgt[syst_it]) ||
              std::isinf(sr->cvwgt[syst_it]) ||
              XSSyst_cv_tmp[syst_it] == 0) {
+            std::lock_guard<std::mutex> lock(warnMutex);
             if(!alreadyWarned[syst_it]){
               alreadyWarned[syst_it] = true;
               std::cout << "Warning: " << XSSyst_names[syst_it]
@@ -168,6 +178,7 @@ namespace ana
           if(std::isnan(sr->cvwgt[syst_it]) ||
              std::isinf(sr->cvwgt[syst_it]) ||
              sr->cvwgt[syst_it] == 0) {
+            std::lock_guard<std::mutex> lock(warnMutex);
             if(!alreadyWarned[syst_it]){
               alreadyWarned[syst_it] = true;
               std::cout << "Warning: " << XSSyst_names[syst_it]
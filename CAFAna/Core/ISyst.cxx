@@ -16,6 +16,12 @@ namespace ana
     : INamed(shortName, latexName), fApplyPenalty(applyPenalty), fMin(min), fMax(max), fCentral(cv)
   {
     Registry<ISyst>::Register(this);
+
+    // Indices are never reused, so a SystShifts that outlives a syst can't
+    // end up referring to a different one
+    std::vector<const ISyst*>& table = DenseIndexTable();
+    fDenseIndex = table.size();
+    table.push_back(this);
   }
 
   //----------------------------------------------------------------------
@@ -24,6 +30,28 @@ namespace ana
     // Normally ISysts should last for the life of the process, but in case one
     // is deleted it's best not to leave a dangling pointer in Registry.
     Registry<ISyst>::UnRegister(this);
+    DenseIndexTable()[fDenseIndex] = 0;
+  }
+
+  //----------------------------------------------------------------------
+  std::vector<const ISyst*>& ISyst::DenseIndexTable()
+  {
+    // Function-local so that it's constructed before any static ISyst
+    static std::vector<const ISyst*> table;
+    return table;
+  }
+
+  //----------------------------------------------------------------------
+  const ISyst* ISyst::FromDenseIndex(unsigned int idx)
+  {
+    const std::vector<const ISyst*>& table = DenseIndexTable();
+    return idx < table.size() ? table[idx] : 0;
+  }
+
+  //----------------------------------------------------------------------
+  unsigned int ISyst::NDenseIndices()
+  {
+    return DenseIndexTable().size();
   }
 
   //----------------------------------------------------------------------
@@ -5,6 +5,7 @@
 #include "CAFAna/Core/INamed.h"
 
 #include <list>
+#include <vector>
 
 #include "duneanaobj/StandardRecord/Proxy/FwdDeclare.h"
 
@@ -63,7 +64,22 @@ namespace ana
       return 3;
     }
 
+    /// \brief Small integer unique to this syst, assigned in order of
+    /// construction
+    ///
+    /// \ref SystShifts uses it to index flat arrays instead of hashing
+    unsigned int DenseIndex() const {return fDenseIndex;}
+
+    /// The syst with this \ref DenseIndex, or null if it has been deleted
+    static const ISyst* FromDenseIndex(unsigned int idx);
+
+    /// One more than the largest \ref DenseIndex handed out so far
+    static unsigned int NDenseIndices();
+
   private:
+    static std::vector<const ISyst*>& DenseIndexTable();
+
+    unsigned int fDenseIndex;
     bool fApplyPenalty;
     double fMin;
     double fMax;
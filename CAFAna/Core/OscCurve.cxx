@@ -4,18 +4,133 @@
 
 #include "OscLib/IOscCalc.h"
 
+#include <atomic>
 #include <cassert>
+#include <cmath>
+#include <iostream>
 #include <map>
+#include <memory>
+#include <mutex>
 
 #include "TH1.h"
+#include "TMD5.h"
 
 namespace ana
 {
+  namespace
+  {
+    // Energies to evaluate at, and the weight of each within its bin. With one
+    // point per bin these are just kTrueEnergyBinCenters
+    unsigned int gQuadPoints = 1;
+    std::vector<double> gQuadEnergies = kTrueEnergyBinCenters;
+    std::vector<double> gQuadWeights(kTrueEnergyBinCenters.size(), 1);
+
+    /// Held while the above are set
+    std::mutex gQuadMutex;
+    /// \brief Set once the first OscCurve has used the above
+    ///
+    /// After that they can't change, because what's cached downstream of the
+    /// OscCurves, in OscillatableSpectrum and PredictionInterp, doesn't know
+    /// about them
+    std::atomic<bool> gQuadFrozen{false};
+
+    /// Called before reading the quadrature points, to fix them from then on
+    void FreezeQuadrature()
+    {
+      if(gQuadFrozen.load(std::memory_order_acquire)) return;
+      std::lock_guard<std::mutex> lock(gQuadMutex);
+      gQuadFrozen.store(true, std::memory_order_release);
+    }
+
+    /// Nodes \a x and weights \a w of \a n-point Gauss-Legendre on [-1, +1]
+    void GaussLegendre(unsigned int n, std::vector<double>& x, std::vector<double>& w)
+    {
+      x.resize(n);
+      w.resize(n);
+
+      for(unsigned int i = 0; i < n; ++i){
+        // Good initial guess for the ith root, then Newton's method
+        double z = cos(M_PI*(i+.75)/(n+.5));
+        double dp = 0;
+        for(int it = 0; it < 100; ++it){
+          // Recurrence for the Legendre polynomials, ending with P_n in p0
+          double p0 = 1, p1 = 0;
+          for(unsigned int j = 1; j <= n; ++j){
+            const double p2 = p1;
+            p1 = p0;
+            p0 = ((2*j-1)*z*p1 - (j-1)*p2)/j;
+          }
+          dp = n*(z*p0-p1)/(z*z-1);
+
+          const double dz = p0/dp;
+          z -= dz;
+          if(fabs(dz) < 1e-15) break;
+        }
+
+        x[i] = z;
+        w[i] = 2/((1-z*z)*dp*dp);
+      }
+    }
+  }
+
+  //----------------------------------------------------------------------
+  void OscCurve::SetQuadraturePoints(unsigned int n)
+  {
+    if(n == 0){
+      std::cout << "OscCurve::SetQuadraturePoints: need at least one point per bin" << std::endl;
+      abort();
+    }
+
+    std::lock_guard<std::mutex> lock(gQuadMutex);
+
+    if(n == gQuadPoints) return;
+
+    if(gQuadFrozen.load(std::memory_order_relaxed)){
+      std::cout << "OscCurve::SetQuadraturePoints: OscCurves have already been made with "
+                << gQuadPoints << " point(s) per bin, and the spectra cached from them "
+                << "would be mixed with new ones. Set it before making any predictions." << std::endl;
+      abort();
+    }
+
+    gQuadPoints = n;
+
+    if(n == 1){
+      gQuadEnergies = kTrueEnergyBinCenters;
+      gQuadWeights.assign(kTrueEnergyBinCenters.size(), 1);
+      return;
+    }
+
+    std::vector<double> x, w;
+    GaussLegendre(n, x, w);
+
+    const std::vector<double>& edges = kTrueEnergyBins.Edges();
+    const unsigned int N = edges.size()-1;
+    gQuadEnergies.resize(N*n);
+    gQuadWeights.resize(N*n);
+    for(unsigned int i = 0; i < N; ++i){
+      const double mid = (edges[i+1]+edges[i])/2;
+      const double half = (edges[i+1]-edges[i])/2;
+      for(unsigned int j = 0; j < n; ++j){
+        gQuadEnergies[i*n+j] = mid + half*x[j];
+        gQuadWeights[i*n+j] = w[j]/2; // The weights sum to 2
+      }
+    }
+  }
+
+  //----------------------------------------------------------------------
+  unsigned int OscCurve::QuadraturePoints()
+  {
+    std::lock_guard<std::mutex> lock(gQuadMutex);
+    return gQuadPoints;
+  }
+
   //----------------------------------------------------------------------
   /// Helper for constructors
   template<class T> Eigen::Array<T, Eigen::Dynamic, 1>
   ToEigen(osc::_IOscCalc<T>* calc, int from, int to)
   {
+    FreezeQuadrature();
+
     const unsigned int N = kTrueEnergyBinCenters.size();
 
     // Have to allow for underflow and overflow
@@ -23,18 +138,84 @@ namespace ana
     ret[0] = 0; // underflow
     ret[N+1] = (from == to || to == 0) ? 1 : 0; // overflow
 
-    const Eigen::Array<T, Eigen::Dynamic, 1> Ps = calc->P(from, to, kTrueEnergyBinCenters);
+    // All the points in one call, so the calculator can vectorize over them
+    const Eigen::Array<T, Eigen::Dynamic, 1> Ps = calc->P(from, to, gQuadEnergies);
 
-    // This is clumsy, but hopefully faster than calculating oscillation probs
-    // for two dummy values.
-    for(unsigned int i = 0; i < N; ++i) ret[i+1] = Ps[i];
+    if(gQuadPoints == 1){
+      // This is clumsy, but hopefully faster than calculating oscillation
+      // probs for two dummy values.
+      for(unsigned int i = 0; i < N; ++i) ret[i+1] = Ps[i];
+    }
+    else{
+      for(unsigned int i = 0; i < N; ++i){
+        T P = 0;
+        for(unsigned int j = 0; j < gQuadPoints; ++j){
+          P += gQuadWeights[i*gQuadPoints+j] * Ps[i*gQuadPoints+j];
+        }
+        ret[i+1] = P;
+      }
+    }
 
     return ret;
   }
 
+  //----------------------------------------------------------------------
+  namespace
+  {
+    /// One probability curve already calculated
+    struct ProbCacheEntry
+    {
+      TMD5 hash;
+      int from, to;
+      unsigned int quadPoints;
+      Eigen::ArrayXd probs;
+    };
+
+    // Shared by all OscCurves, so that every OscillatableSpectrum in a joint
+    // fit can reuse each channel. All the curves are over kTrueEnergyBins, so
+    // that doesn't need to be part of the key. Entries are overwritten oldest
+    // first, which is plenty for all the channels of a few parameter sets.
+    std::mutex gProbCacheMutex;
+    std::vector<ProbCacheEntry> gProbCache;
+    size_t gProbCacheNext = 0;
+    const size_t kProbCacheSize = 256;
+
+    /// Cached version, only possible for calculators that hash themselves
+    Eigen::ArrayXd CachedToEigen(osc::IOscCalc* calc, int from, int to)
+    {
+      FreezeQuadrature();
+
+      std::unique_ptr<TMD5> hash(calc->GetParamsHash());
+      if(!hash) return ToEigen(calc, from, to);
+
+      {
+        std::lock_guard<std::mutex> lock(gProbCacheMutex);
+        for(const ProbCacheEntry& e: gProbCache){
+          if(e.from == from && e.to == to && e.quadPoints == gQuadPoints &&
+             e.hash == *hash) return e.probs;
+        }
+      }
+
+      // Don't hold the lock while calculating. Two threads might both do the
+      // same work, but that's harmless
+      Eigen::ArrayXd ret = ToEigen(calc, from, to);
+
+      std::lock_guard<std::mutex> lock(gProbCacheMutex);
+      if(gProbCache.size() < kProbCacheSize){
+        gProbCache.push_back({*hash, from, to, gQuadPoints, ret});
+      }
+      else{
+        gProbCache[gProbCacheNext] = {*hash, from, to, gQuadPoints, ret};
+        gProbCacheNext = (gProbCacheNext+1) % kProbCacheSize;
+      }
+
+      return ret;
+    }
+  }
+
   //----------------------------------------------------------------------
   OscCurve::OscCurve(osc::IOscCalc* calc, int from, int to)
-    : Ratio(Hist::Adopt(ToEigen(calc, from, to)),
+    : Ratio(Hist::Adopt(CachedToEigen(calc, from, to)),
             std::vector<Binning>(1, kTrueEnergyBins),
             std::vector<std::string>(1, "True Energy (GeV)")),
       fFrom(from), fTo(to)
@@ -7,7 +7,11 @@
 
 namespace ana
 {
-  /// Transition probability for any one channel as a function of energy
+  /// \brief Transition probability for any one channel as a function of energy
+  ///
+  /// For (double) calculators that implement GetParamsHash() the
+  /// probabilities are cached process-wide, so each channel is only
+  /// calculated once per set of oscillation parameters.
   class OscCurve : public Ratio
   {
   public:
@@ -20,6 +24,14 @@ namespace ana
 
     TH1D* ToTH1(bool title = false) const;
 
+    /// \brief Average the probability over each true energy bin
+    ///
+    /// Using \a n-point Gauss-Legendre quadrature. The default, 1, is the
+    /// probability at the bin center. Has to be set before the first OscCurve
+    /// is made, and aborts after that.
+    static void SetQuadraturePoints(unsigned int n);
+    static unsigned int QuadraturePoints();
+
   protected:
     int fFrom, fTo;
   };
@@ -73,6 +73,8 @@ namespace ana
     if(rhs.fCache->hash){
       fCache->spect = rhs.fCache->spect;
       fCache->hash = std::make_unique<TMD5>(*rhs.fCache->hash);
+      fCache->from = rhs.fCache->from;
+      fCache->to = rhs.fCache->to;
     }
 
     assert( rhs.fReferences.empty() ); // Copying with pending loads is unexpected
@@ -85,6 +87,8 @@ namespace ana
     if(rhs.fCache->hash){
       fCache->spect = std::move(rhs.fCache->spect);
       fCache->hash = std::move(rhs.fCache->hash);
+      fCache->from = rhs.fCache->from;
+      fCache->to = rhs.fCache->to;
     }
 
     assert( rhs.fReferences.empty() ); // Copying with pending loads is unexpected
@@ -100,6 +104,8 @@ namespace ana
     if(rhs.fCache->hash){
       fCache->spect = rhs.fCache->spect;
       fCache->hash = std::make_unique<TMD5>(*rhs.fCache->hash);
+      fCache->from = rhs.fCache->from;
+      fCache->to = rhs.fCache->to;
     }
     else{
       fCache->hash.reset();
@@ -121,6 +127,8 @@ namespace ana
     if(rhs.fCache->hash){
       fCache->spect = std::move(rhs.fCache->spect);
       fCache->hash = std::move(rhs.fCache->hash);
+      fCache->from = rhs.fCache->from;
+      fCache->to = rhs.fCache->to;
     }
     else{
       fCache->hash.reset();
@@ -137,7 +145,8 @@ namespace ana
   _Oscillated(osc::_IOscCalc<T>* calc, int from, int to) const
   {
     TMD5* hash = calc->GetParamsHash();
-    if(hash && fCache->hash && *hash == *fCache->hash){
+    if(hash && fCache->hash && *hash == *fCache->hash &&
+       fCache->from == from && fCache->to == to){
       delete hash;
       return fCache->spect;
     }
@@ -147,6 +156,8 @@ namespace ana
     if(hash){
       fCache->spect = ret;
       fCache->hash.reset(hash);
+      fCache->from = from;
+      fCache->to = to;
     }
 
     return ret;
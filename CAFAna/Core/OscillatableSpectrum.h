@@ -26,6 +26,7 @@ namespace ana
   struct OscCache
   {
     std::unique_ptr<TMD5> hash;
+    int from = 0, to = 0; ///< The channel \a spect was oscillated for
     Spectrum spect;
 
     OscCache()
@@ -10,6 +10,7 @@
 
 #include "CAFAna/Core/SignalHandlers.h"
 #include "CAFAna/Core/Spectrum.h"
+#include "CAFAna/Core/ThreadPool.h"
 #include "CAFAna/Core/Utilities.h"
 
 #include "CAFAna/Systs/XSecSystList.h"
@@ -17,30 +18,64 @@
 
 #include "duneanaobj/StandardRecord/Proxy/SRProxy.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <cstdlib>
 #include <iostream>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
 
 #include "TFile.h"
 #include "TH2.h"
+#include "TROOT.h"
 #include "TTree.h"
 
 namespace ana
 {
+  // The registered spectra aren't thread-safe, so workers merge their fills
+  // in under this lock.
+  std::mutex gSpectrumFillMutex;
+
+  // SRProxySystController keeps its transaction (and the backups it will
+  // restore on Rollback()) in process-wide statics. A worker that shifts its
+  // record holds this exclusively until it has rolled back. Any write made
+  // while a transaction is open would be backed up into it, and later
+  // restored into the wrong worker's record. So workers writing to their own
+  // records outside a transaction (FixupRecord()) hold it shared. They can
+  // all do that at once, and only wait while a shifted record is in
+  // progress.
+  std::shared_mutex gSRProxyTransactionMutex;
+
+  /// How many fills a worker stages before merging them into the spectra
+  const size_t kMaxBufferedFills = 1 << 16;
+
+  //----------------------------------------------------------------------
+  /// Helper for the constructors
+  unsigned int DefaultLoaderNThreads()
+  {
+    const char* env = getenv("CAFANA_LOADER_NTHREADS");
+    return env ? std::max(0, atoi(env)) : 1;
+  }
+
   //----------------------------------------------------------------------
   SpectrumLoader::SpectrumLoader(const std::string& wildcard, int max)
-    : SpectrumLoaderBase(wildcard), max_entries(max)
+    : SpectrumLoaderBase(wildcard), max_entries(max),
+      fNThreads(DefaultLoaderNThreads())
   {
   }
 
   //----------------------------------------------------------------------
   SpectrumLoader::SpectrumLoader(const std::vector<std::string>& fnames, int max)
-    : SpectrumLoaderBase(fnames), max_entries(max)
+    : SpectrumLoaderBase(fnames), max_entries(max),
+      fNThreads(DefaultLoaderNThreads())
   {
   }
 
   //----------------------------------------------------------------------
   SpectrumLoader::SpectrumLoader()
+    : max_entries(0), fNThreads(DefaultLoaderNThreads())
   {
   }
 
@@ -89,6 +124,13 @@ namespace ana
     fLivetimeByCut.resize(fAllCuts.size());
     fPOTByCut.resize(fAllCuts.size());
 
+    BuildFillPlan();
+
+    if(fNThreads != 1){
+      GoParallel();
+      return;
+    }
+
     const int Nfiles = NFiles();
 
     Progress* prog = 0;
@@ -121,12 +163,13 @@ namespace ana
 
     ReportExposures();
 
+    fPlan = FillPlan();
     fHistDefs.RemoveLoader(this);
     fHistDefs.Clear();
   }
 
   //----------------------------------------------------------------------
-  void SpectrumLoader::HandleFile(TFile* f, Progress* prog)
+  TTree* SpectrumLoader::GetCAFTree(TFile* f)
   {
     assert(!f->IsZombie());
 
@@ -137,6 +180,142 @@ namespace ana
     if(!tr) tr = (TTree*)f->Get("caf");
 
     assert(tr);
+    return tr;
+  }
+
+  //----------------------------------------------------------------------
+  void SpectrumLoader::GoParallel()
+  {
+    // We're going to be reading several files at once
+    ROOT::EnableThreadSafety();
+
+    const int Nfiles = NFiles();
+
+    caf::SRBranchRegistry::clear();
+
+    const unsigned int nThreads = fNThreads ? fNThreads : std::max(1u, std::thread::hardware_concurrency());
+    ThreadPool pool(nThreads);
+
+    std::string sum = TString::Format("Filling %lu spectra", fHistDefs.TotalSize()).Data();
+    sum += TString::Format(" from %d files matching '%s'", Nfiles, fWildcard.c_str()).Data();
+    sum += TString::Format(" on %u threads", nThreads).Data();
+    pool.ShowProgress(sum);
+
+    // GetNextFile() is where the POT is accumulated, so keep calling it from
+    // this thread only. That way the exposure accounting is exactly what the
+    // serial loop would get. The workers open their own handles on the file,
+    // since the file source closes the previous file when asked for the next.
+    while(TFile* f = GetNextFile()){
+      const std::string fname = f->GetName();
+
+      long Nentries = GetCAFTree(f)->GetEntries();
+      if(max_entries != 0 && max_entries < Nentries)
+        Nentries = max_entries;
+
+      // With fewer files than threads split each file into entry ranges so
+      // every thread has something to do.
+      long Nchunks = 1;
+      if(Nfiles >= 0 && Nfiles < int(nThreads))
+        Nchunks = (nThreads+Nfiles-1)/Nfiles;
+      Nchunks = std::max(1L, std::min(Nchunks, Nentries));
+
+      for(long chunk = 0; chunk < Nchunks; ++chunk){
+        const long first = (Nentries*chunk)/Nchunks;
+        const long last = (Nentries*(chunk+1))/Nchunks;
+        ThreadPool::func_t task = [=](){HandleFileRange(fname, first, last);};
+        pool.AddTask(task);
+      }
+
+      if(CAFAnaQuitRequested()) break;
+    }
+
+    pool.Finish();
+
+    StoreExposures();
+
+    ReportExposures();
+
+    fPlan = FillPlan();
+    fHistDefs.RemoveLoader(this);
+    fHistDefs.Clear();
+  }
+
+  //----------------------------------------------------------------------
+  void SpectrumLoader::HandleFileRange(const std::string& fname,
+                                       long firstEntry, long lastEntry)
+  {
+    if(CAFAnaQuitRequested()) return;
+
+    std::unique_ptr<TFile> f(TFile::Open(fname.c_str()));
+    if(!f || f->IsZombie()){
+      std::cout << "Bad file (zombie): " << fname << std::endl;
+      abort();
+    }
+
+    TTree* tr = GetCAFTree(f.get());
+
+    FillBuffer buf;
+
+    {
+      // Constructing the proxy touches SRProxy's global bookkeeping
+      std::unique_lock<std::shared_mutex> setup(gSRProxyTransactionMutex);
+
+      // Each worker gets its own proxy, and so its own view of the tree
+      caf::SRProxy sr(tr, "");
+
+      setup.unlock();
+
+      // This is per-thread state, so needs setting in each worker
+      FloatingExceptionOnNaN fpnan(false);
+
+      for(long n = firstEntry; n < lastEntry; ++n){
+        tr->LoadTree(n);
+
+        {
+          // FixupRecord() writes into the record, so must not happen while
+          // some other worker has a transaction open. Other fixups are fine.
+          std::shared_lock<std::shared_mutex> fixlock(gSRProxyTransactionMutex);
+          FixupRecord(&sr, tr);
+        }
+
+        HandleRecord(&sr, &buf);
+
+        if(buf.Size() > kMaxBufferedFills) buf.Flush();
+
+        if(n%1000 == 0 && CAFAnaQuitRequested()) break;
+      } // end for n
+
+      // And likewise for tearing it down again
+      setup.lock();
+    }
+
+    buf.Flush();
+  }
+
+  //----------------------------------------------------------------------
+  void SpectrumLoader::FillBuffer::Flush()
+  {
+    std::lock_guard<std::mutex> lock(gSpectrumFillMutex);
+
+    // Spectra can be deleted (and so unregister themselves) while we're
+    // running, hence checking the inner pointer here too
+    for(const auto& it: fills){
+      Spectrum** s = std::get<0>(it);
+      if(*s) (*s)->Fill(std::get<1>(it), std::get<2>(it));
+    }
+    for(const auto& it: rwFills){
+      ReweightableSpectrum** rw = std::get<0>(it);
+      if(*rw) (*rw)->Fill(std::get<1>(it), std::get<2>(it), std::get<3>(it));
+    }
+
+    fills.clear();
+    rwFills.clear();
+  }
+
+  //----------------------------------------------------------------------
+  void SpectrumLoader::HandleFile(TFile* f, Progress* prog)
+  {
+    TTree* tr = GetCAFTree(f);
 
     caf::SRProxy sr(tr, "");
 
@@ -185,111 +364,253 @@ namespace ana
   };
 
   //----------------------------------------------------------------------
-  void SpectrumLoader::HandleRecord(caf::SRProxy* sr)
+  /// Helper for \ref SpectrumLoader::HandleRecord
+  inline void FillSpectrum(SpectrumLoader::FillBuffer* buf, Spectrum** s,
+                           double val, double wei)
   {
-    // Some shifts only adjust the weight, so they're effectively nominal, but
-    // aren't grouped with the other nominal histograms. Keep track of the
-    // results for nominals in these caches to speed those systs up.
-    CutVarCache<bool, Cut> nomCutCache;
-    CutVarCache<double, Weight> nomWeiCache;
-    CutVarCache<double, Var> nomVarCache;
+    if(buf)
+      buf->fills.emplace_back(s, val, wei);
+    else if(*s)
+      (*s)->Fill(val, wei);
+  }
+
+  //----------------------------------------------------------------------
+  /// Helper for \ref SpectrumLoader::HandleRecord
+  inline void FillReweightableSpectrum(SpectrumLoader::FillBuffer* buf,
+                                       ReweightableSpectrum** rw,
+                                       double x, double y, double wei)
+  {
+    if(buf)
+      buf->rwFills.emplace_back(rw, x, y, wei);
+    else
+      (*rw)->Fill(x, y, wei);
+  }
+
+  //----------------------------------------------------------------------
+  void SpectrumLoader::CheckWeight(double wei)
+  {
+    if(wei < 0){
+      std::cerr << "Negative weight " << wei
+                << " returned from Var";
+      std::cerr << std::endl;
+      abort();
+    }
+  }
+
+  //----------------------------------------------------------------------
+  void SpectrumLoader::FillSpectList(const SpectList& sl, double val, double wei,
+                                     const double* yvals, FillBuffer* buf)
+  {
+    if(std::isnan(val) || std::isinf(val)){
+      std::cerr << "Warning: Bad value: " << val
+                << " returned from a Var. The input variable(s) could "
+                << "be NaN in the CAF, or perhaps your "
+                << "Var code computed 0/0?";
+      std::cout << " Not filling into this histogram for this slice."
+                << std::endl;
+      return;
+    }
+
+    for(Spectrum** s : sl.spects)
+      FillSpectrum(buf, s, val, wei);
+
+    for(unsigned int rvIdx = 0; rvIdx < sl.rwSpects.size(); ++rvIdx){
+      ReweightableSpectrum** rw = sl.rwSpects[rvIdx].first;
+      if(!*rw) continue;
+      const double yval = yvals[rvIdx];
+
+      if(std::isnan(yval) || std::isinf(yval)){
+        std::cerr << "Warning: Bad value: " << yval
+                  << " for reweighting Var";
+        std::cout << ". Not filling into histogram." << std::endl;
+        continue;
+      }
+
+      // TODO: ignoring events with no true neutrino etc
+      if(yval != 0)
+        FillReweightableSpectrum(buf, rw, val, yval, wei);
+    } // end for rvIdx
+  }
+
+  //----------------------------------------------------------------------
+  /// Helper for \ref SpectrumLoader::BuildFillPlan
+  template<class T, class K> T& FindOrAddByID(std::vector<T>& nodes, const K& key)
+  {
+    for(T& node: nodes) if(node.key->ID() == key.ID()) return node;
+    nodes.emplace_back();
+    nodes.back().key = &key;
+    return nodes.back();
+  }
+
+  //----------------------------------------------------------------------
+  void SpectrumLoader::BuildFillPlan()
+  {
+    fPlan = FillPlan();
 
     for(auto& shiftdef: fHistDefs){
-      const SystShifts& shift = shiftdef.first;
+      const unsigned int shiftIdx = fPlan.shifts.size();
+      fPlan.shifts.push_back(&shiftdef.first);
+      fPlan.cutdefs.push_back(&shiftdef.second);
+
+      for(auto& cutdef: shiftdef.second){
+        FillPlan::CutNode& cn = FindOrAddByID(fPlan.cuts, cutdef.first);
+        for(auto& weidef: cutdef.second){
+          FillPlan::WeiNode& wn = FindOrAddByID(cn.children, weidef.first);
+          for(auto& vardef: weidef.second){
+            FillPlan::VarNode& vn = FindOrAddByID(wn.children, vardef.first);
+            vn.targets.emplace_back(shiftIdx, &vardef.second);
+          }
+        }
+      }
+    } // end for shiftdef
+  }
+
+  //----------------------------------------------------------------------
+  void SpectrumLoader::HandleRecord(caf::SRProxy* sr, FillBuffer* buf)
+  {
+    // Weight each shift applies to this record on top of the nominal
+    // weight. Zero for shifts that alter the record itself, which have
+    // already been filled by HandleShiftedRecord() by the time it's used.
+    thread_local std::vector<double> systWeights;
+    systWeights.assign(fPlan.shifts.size(), 0);
+
+    // First pass: apply every shift once. Most systematics only adjust the
+    // weight, in which case the nominal cuts and vars are still valid and we
+    // can just remember the weight. The ones that actually change the record
+    // have to be evaluated from scratch, while the change is in place.
+    for(unsigned int shiftIdx = 0; shiftIdx < fPlan.shifts.size(); ++shiftIdx){
+      const SystShifts& shift = *fPlan.shifts[shiftIdx];
+
+      // Can special-case nominal to not pay cost of Shift()
+      if(shift.IsNominal()){
+        systWeights[shiftIdx] = 1;
+        continue;
+      }
+
+      // In multi-threaded mode the transaction state is shared between all
+      // the workers, so only one of them may hold a transaction at a time.
+      std::unique_lock<std::shared_mutex> lock(gSRProxyTransactionMutex, std::defer_lock);
+      if(buf) lock.lock();
 
       // Need to provide a clean slate for each new set of systematic shifts to
       // work from. Copying the whole StandardRecord is pretty expensive, so
       // modify it in place and revert it afterwards.
-
-      // Please do not continue/break out of the shiftdef loop. If this is
-      // required, let's use a RAII type here.
       caf::SRProxySystController::BeginTransaction();
 
       double systWeight = 1;
-      bool shifted = false;
+      shift.Shift(sr, systWeight);
 
-      // Can special-case nominal to not pay cost of Shift()
-      if(!shift.IsNominal()){
-        shift.Shift(sr, systWeight);
-        // If there were only weighting systs applied then the cached nominal
-        // values are still valid.
-        shifted = caf::SRProxySystController::AnyShifted();
-      }
+      if(caf::SRProxySystController::AnyShifted())
+        HandleShiftedRecord(sr, *fPlan.cutdefs[shiftIdx], systWeight, buf);
+      else
+        systWeights[shiftIdx] = systWeight;
 
-      for(auto& cutdef: shiftdef.second){
-        const Cut& cut = cutdef.first;
+      // Return StandardRecord to its unshifted form ready for the next
+      // shift.
+      caf::SRProxySystController::Rollback();
+    } // end for shiftIdx
 
-        const bool pass = shifted ? cut(sr) : nomCutCache.Get(cut, sr);
-        // Cut failed, skip all the histograms that depended on it
-        if(!pass) continue;
+    // Can't say anything about the shared state from a worker thread
+    assert(buf || !caf::SRProxySystController::AnyShifted());
 
-        for(auto& weidef: cutdef.second){
-          const Weight& weivar = weidef.first;
+    // Second pass: evaluate each nominal cut, weight and var at most once and
+    // fill it into every shift that didn't alter the record.
+    CutVarCache<bool, Cut> nomCutCache;
+    CutVarCache<double, Weight> nomWeiCache;
+    CutVarCache<double, Var> nomVarCache;
+    thread_local std::vector<double> yvals;
+
+    for(const FillPlan::CutNode& cn: fPlan.cuts){
+      // Cut failed, skip all the histograms that depended on it
+      if(!nomCutCache.Get(*cn.key, sr)) continue;
+
+      for(const FillPlan::WeiNode& wn: cn.children){
+        const double wei = nomWeiCache.Get(*wn.key, sr);
+        CheckWeight(wei);
+        if(wei == 0) continue;
+
+        for(const FillPlan::VarNode& vn: wn.children){
+          // Don't evaluate the var if everything wanting it was shifted or
+          // weighted away
+          bool any = false;
+          for(const auto& target: vn.targets)
+            if(systWeights[target.first] != 0){any = true; break;}
+          if(!any) continue;
+
+          if(vn.key->IsMulti()){
+            const std::vector<double> vals = vn.key->GetMultiVar()(sr);
+            for(const auto& target: vn.targets){
+              const double w = wei * systWeights[target.first];
+              if(w == 0) continue;
+              for(double val: vals)
+                for(Spectrum** s : target.second->spects)
+                  FillSpectrum(buf, s, val, w);
+            }
+            continue;
+          }
 
-          double wei = shifted ? weivar(sr) : nomWeiCache.Get(weivar, sr);
+          const double val = nomVarCache.Get(vn.key->GetVar(), sr);
 
-          if(wei < 0){
-            std::cerr << "Negative weight " << wei
-                      << " returned from Var";
-            std::cerr << std::endl;
-            abort();
-          }
+          for(const auto& target: vn.targets){
+            const double w = wei * systWeights[target.first];
+            if(w == 0) continue;
 
-          wei *= systWeight;
-          if(wei == 0) continue;
+            yvals.clear();
+            for(auto& rv: target.second->rwSpects)
+              yvals.push_back(*rv.first ? nomVarCache.Get(rv.second, sr) : 0);
 
-          for(auto& vardef: weidef.second){
-            if(vardef.first.IsMulti()){
-              for(double val: vardef.first.GetMultiVar()(sr)){
-                for(Spectrum** s : vardef.second.spects)
-                  if(*s) (*s)->Fill(val, wei);
-              }
-              continue;
-            }
+            FillSpectList(*target.second, val, w, yvals.data(), buf);
+          } // end for target
+        } // end for vn
+      } // end for wn
+    } // end for cn
+  }
+
+  //----------------------------------------------------------------------
+  void SpectrumLoader::HandleShiftedRecord(caf::SRProxy* sr,
+                                           CutDefs& cutdefs,
+                                           double systWeight,
+                                           FillBuffer* buf)
+  {
+    thread_local std::vector<double> yvals;
 
-            const Var& var = vardef.first.GetVar();
+    for(auto& cutdef: cutdefs){
+      const Cut& cut = cutdef.first;
 
-            const double val = shifted ? var(sr) : nomVarCache.Get(var, sr);
+      const bool pass = cut(sr);
+      // Cut failed, skip all the histograms that depended on it
+      if(!pass) continue;
 
-            if(std::isnan(val) || std::isinf(val)){
-              std::cerr << "Warning: Bad value: " << val
-                        << " returned from a Var. The input variable(s) could "
-                        << "be NaN in the CAF, or perhaps your "
-                        << "Var code computed 0/0?";
-              std::cout << " Not filling into this histogram for this slice."
-                        << std::endl;
-              continue;
+      for(auto& weidef: cutdef.second){
+        const Weight& weivar = weidef.first;
+
+        double wei = weivar(sr);
+        CheckWeight(wei);
+
+        wei *= systWeight;
+        if(wei == 0) continue;
+
+        for(auto& vardef: weidef.second){
+          if(vardef.first.IsMulti()){
+            for(double val: vardef.first.GetMultiVar()(sr)){
+              for(Spectrum** s : vardef.second.spects)
+                FillSpectrum(buf, s, val, wei);
             }
+            continue;
+          }
 
-            for(Spectrum** s : vardef.second.spects)
-              if(*s) (*s)->Fill(val, wei);
-
-            for(auto rv: vardef.second.rwSpects){
-              ReweightableSpectrum** rw = rv.first;
-              if(!*rw) continue;
-              const double yval = rv.second(sr);
-
-              if(std::isnan(yval) || std::isinf(yval)){
-                std::cerr << "Warning: Bad value: " << yval
-                          << " for reweighting Var";
-                std::cout << ". Not filling into histogram." << std::endl;
-                continue;
-              }
-
-              // TODO: ignoring events with no true neutrino etc
-              if(yval != 0)
-                (*rw)->Fill(val, yval, wei);
-            } // end for rw
-          } // end for vardef
-        } // end for weidef
-      } // end for cutdef
+          const Var& var = vardef.first.GetVar();
 
-      // Return StandardRecord to its unshifted form ready for the next
-      // histogram.
-      caf::SRProxySystController::Rollback();
-    } // end for shiftdef
+          const double val = var(sr);
+
+          yvals.clear();
+          for(auto& rv: vardef.second.rwSpects)
+            yvals.push_back(*rv.first ? rv.second(sr) : 0);
 
-    assert(!caf::SRProxySystController::AnyShifted());
+          FillSpectList(vardef.second, val, wei, yvals.data(), buf);
+        } // end for vardef
+      } // end for weidef
+    } // end for cutdef
   }
 
   //----------------------------------------------------------------------
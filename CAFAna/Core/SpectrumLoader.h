@@ -3,8 +3,12 @@
 #include "CAFAna/Core/SpectrumLoaderBase.h"
 
 #include <set>
+#include <string>
+#include <tuple>
+#include <vector>
 
 class TFile;
+class TTree;
 
 #include "duneanaobj/StandardRecord/Proxy/FwdDeclare.h"
 
@@ -35,6 +39,27 @@ namespace ana
 
     virtual void Go() override;
 
+    /// \brief Number of worker threads \ref Go should use
+    ///
+    /// 1 (the default) runs the usual serial loop. 0 means one per core. Can
+    /// also be set through $CAFANA_LOADER_NTHREADS.
+    void SetNThreads(unsigned int n) {fNThreads = n;}
+    unsigned int NThreads() const {return fNThreads;}
+
+    /// \brief Spectrum fills made by one worker thread, waiting to be merged
+    ///
+    /// Only used by the multi-threaded loop. The registered spectra aren't
+    /// safe to fill from several threads at once, so each worker stages its
+    /// fills here and \ref Flush merges them in under a lock.
+    struct FillBuffer
+    {
+      std::vector<std::tuple<Spectrum**, double, double>> fills;
+      std::vector<std::tuple<ReweightableSpectrum**, double, double, double>> rwFills;
+
+      size_t Size() const {return fills.size() + rwFills.size();}
+      void Flush();
+    };
+
   protected:
     SpectrumLoader();
 
@@ -46,9 +71,68 @@ namespace ana
     SpectrumLoader(const SpectrumLoader&) = delete;
     SpectrumLoader& operator=(const SpectrumLoader&) = delete;
 
+    /// The CAF tree in \a f
+    static TTree* GetCAFTree(TFile* f);
+
     virtual void HandleFile(TFile* f, Progress* prog = 0);
 
-    virtual void HandleRecord(caf::SRProxy* sr);
+    /// \brief Worker body for the multi-threaded loop
+    ///
+    /// Opens its own copy of \a fname so that it owns its TTree and
+    /// caf::SRProxy, and processes entries [\a firstEntry, \a lastEntry)
+    virtual void HandleFileRange(const std::string& fname,
+                                 long firstEntry, long lastEntry);
+
+    /// \param buf If set, stage fills there instead of filling the spectra
+    ///            directly (multi-threaded mode)
+    virtual void HandleRecord(caf::SRProxy* sr, FillBuffer* buf = 0);
+
+    typedef IDMap<Cut, IDMap<Weight, IDMap<VarOrMultiVar, SpectList>>> CutDefs;
+
+    /// Aborts on a negative weight
+    static void CheckWeight(double wei);
+
+    /// \brief Fill \a val into all the spectra of \a sl with weight \a wei
+    ///
+    /// \a yvals holds the y value for each of sl.rwSpects, only read for the
+    /// ones that are set. Skips non-finite values with a warning. \a buf as
+    /// for \ref HandleRecord
+    static void FillSpectList(const SpectList& sl, double val, double wei,
+                              const double* yvals, FillBuffer* buf);
+
+    /// \brief Fill the spectra of one shift that altered the record itself
+    ///
+    /// Called from within that shift's transaction, so nothing evaluated
+    /// here can be shared with the nominal
+    void HandleShiftedRecord(caf::SRProxy* sr,
+                             CutDefs& cutdefs,
+                             double systWeight,
+                             FillBuffer* buf);
+
+    /// \brief fHistDefs turned inside-out, [cut][wei][var] -> shifts
+    ///
+    /// Lets \ref HandleRecord evaluate every nominal cut and var once per
+    /// record and fill it into all the weight-only shifts in one go.
+    struct FillPlan
+    {
+      typedef std::pair<unsigned int, SpectList*> Target; ///< shift index
+
+      struct VarNode{const VarOrMultiVar* key; std::vector<Target> targets;};
+      struct WeiNode{const Weight* key; std::vector<VarNode> children;};
+      struct CutNode{const Cut* key; std::vector<WeiNode> children;};
+
+      std::vector<CutNode> cuts;
+
+      /// Indexing matches fHistDefs
+      std::vector<const SystShifts*> shifts;
+      std::vector<CutDefs*> cutdefs;
+    };
+
+    /// Set up \ref fPlan. Called from \ref Go once all spectra are known
+    void BuildFillPlan();
+
+    /// Implementation of \ref Go for \ref fNThreads != 1
+    void GoParallel();
 
     /// Save results of AccumulateExposures into the individual spectra
     virtual void StoreExposures();
@@ -62,5 +146,9 @@ namespace ana
     std::vector<double> fPOTByCut;      ///< Indexing matches fAllCuts
     int max_entries;
 
+    unsigned int fNThreads;
+
+    FillPlan fPlan;
+
   };
 }
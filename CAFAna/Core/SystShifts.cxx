@@ -6,6 +6,7 @@
 #include "CAFAna/Core/Stan.h"
 #include "CAFAna/Core/StanUtils.h"
 
+#include <algorithm>
 #include <cassert>
 #include <memory>
 #include <iostream>
@@ -19,47 +20,114 @@
 namespace ana
 {
   // Reserve 0 for unshifted
-  int SystShifts::fgNextID = 1;
+  std::atomic<int> SystShifts::fgNextID(1);
 
   const SystShifts kNoShift = SystShifts::Nominal();
 
+  namespace
+  {
+    /// Call f(idx) for each bit set in \a bits, in increasing order
+    template<class F> void ForEachBit(const std::vector<uint64_t>& bits, F f)
+    {
+      for(unsigned int w = 0; w < bits.size(); ++w){
+        for(uint64_t b = bits[w]; b; b &= b-1) f(64*w + __builtin_ctzll(b));
+      }
+    }
+
+    /// \brief As \ref ForEachBit, but calls f(idx, syst)
+    ///
+    /// Skips any syst that has since been deleted, there's nothing left to
+    /// shift or name
+    template<class F> void ForEachSyst(const std::vector<uint64_t>& bits, F f)
+    {
+      ForEachBit(bits, [&](unsigned int idx){
+          const ISyst* syst = ISyst::FromDenseIndex(idx);
+          if(syst) f(idx, syst);
+        });
+    }
+  }
+
   //----------------------------------------------------------------------
-  SystShifts::SystShifts() : fID(0) {}
+  SystShifts::SystShifts() : fNActive(0), fNActiveStan(0), fID(0) {}
 
   //----------------------------------------------------------------------
-  SystShifts::SystShifts(const ISyst *syst, double shift) : fID(fgNextID++)
+  SystShifts::SystShifts(const ISyst *syst, double shift)
+    : fNActive(0), fNActiveStan(0), fID(fgNextID++)
   {
     if (shift != 0)
-      fSystsDbl.emplace(syst, Clamp(shift, syst));
+      SetDbl(syst->DenseIndex(), Clamp(shift, syst));
   }
 
   //----------------------------------------------------------------------
   SystShifts::SystShifts(const ISyst* syst, stan::math::var shift)
-      : fID(fgNextID++)
+    : fNActive(0), fNActiveStan(0), fID(fgNextID++)
   {
-    fSystsStan.emplace(syst, Clamp(shift, syst));
+    SetStan(syst->DenseIndex(), Clamp(shift, syst));
     // we're always going to maintain a "double" copy
     // so that when the Stan cache gets invalidated we can still return something usable.
-    fSystsDbl.emplace(syst, Clamp(util::GetValAs<double>(shift), syst));
+    SetDbl(syst->DenseIndex(), Clamp(util::GetValAs<double>(shift), syst));
   }
 
   //----------------------------------------------------------------------
   SystShifts::SystShifts(const std::map<const ISyst *, double> &shifts)
-      : fID(fgNextID++) {
+    : fNActive(0), fNActiveStan(0), fID(fgNextID++)
+  {
     for (auto it : shifts)
       if (it.second != 0)
-        fSystsDbl.emplace(it.first, Clamp(it.second, it.first));
+        SetDbl(it.first->DenseIndex(), Clamp(it.second, it.first));
   }
 
   //----------------------------------------------------------------------
   SystShifts::SystShifts(const std::map<const ISyst*, stan::math::var>& shifts)
-      : fID(fgNextID++)
+    : fNActive(0), fNActiveStan(0), fID(fgNextID++)
   {
     for(auto it: shifts)
     {
-      fSystsStan.emplace(it.first, it.second);
-      fSystsDbl.emplace(it.first, util::GetValAs<double>(it.second));
+      SetStan(it.first->DenseIndex(), it.second);
+      SetDbl(it.first->DenseIndex(), util::GetValAs<double>(it.second));
+    }
+  }
+
+  //----------------------------------------------------------------------
+  void SystShifts::SetDbl(unsigned int idx, double x)
+  {
+    if(idx >= fShifts.size()){
+      fShifts.resize(idx+1, 0);
+      fActive.resize(idx/64+1, 0);
     }
+
+    fShifts[idx] = x;
+
+    uint64_t& word = fActive[idx/64];
+    const uint64_t bit = uint64_t(1) << (idx%64);
+    if(!(word & bit)) ++fNActive;
+    word |= bit;
+  }
+
+  //----------------------------------------------------------------------
+  void SystShifts::UnsetDbl(unsigned int idx)
+  {
+    if(!TestBit(fActive, idx)) return;
+
+    fShifts[idx] = 0;
+    fActive[idx/64] &= ~(uint64_t(1) << (idx%64));
+    --fNActive;
+  }
+
+  //----------------------------------------------------------------------
+  void SystShifts::SetStan(unsigned int idx, const stan::math::var& x) const
+  {
+    if(idx >= fShiftsStan.size()){
+      fShiftsStan.resize(idx+1);
+      fActiveStan.resize(idx/64+1, 0);
+    }
+
+    fShiftsStan[idx] = x;
+
+    uint64_t& word = fActiveStan[idx/64];
+    const uint64_t bit = uint64_t(1) << (idx%64);
+    if(!(word & bit)) ++fNActiveStan;
+    word |= bit;
   }
 
   //----------------------------------------------------------------------
@@ -75,27 +143,25 @@ namespace ana
 
     // if this slot already exists in the Stan systs, and we're not setting the same value,
     // some shenanigans are going on that we need to figure out.  abort.
-    auto itStan = fSystsStan.find(syst);
-    if(itStan != fSystsStan.end() && (itStan->second != shift && std::isnan(shift) != std::isnan(itStan->second)))
+    const unsigned int idx = syst->DenseIndex();
+    if(TestBit(fActiveStan, idx) && (fShiftsStan[idx] != shift && std::isnan(shift) != std::isnan(fShiftsStan[idx])))
     {
-      std::cerr << "Error Syst '" << syst->ShortName() << " already has a Stan pull set (" << itStan->second << ") "
+      std::cerr << "Error Syst '" << syst->ShortName() << " already has a Stan pull set (" << fShiftsStan[idx] << ") "
                 << "and you're trying to set a different double one (" << shift << ")." << std::endl;
       std::cerr << "You almost certainly didn't mean to do that." << std::endl;
       std::cerr << "Abort." << std::endl;
       abort();
     }
 
-    fSystsDbl.erase(syst);
-    if(force || shift != 0.) fSystsDbl.emplace(syst, Clamp(shift, syst));
+    if(force || shift != 0.) SetDbl(idx, Clamp(shift, syst)); else UnsetDbl(idx);
   }
 
   //----------------------------------------------------------------------
   void SystShifts::SetShift(const ISyst* syst, stan::math::var shift)
   {
-    fSystsStan.erase(syst);
     // note: _always_ put the syst in, even if the value is 0.
     // autodiff relies on the calculation happening so as to get the gradient
-    fSystsStan.emplace(syst, shift);
+    SetStan(syst->DenseIndex(), shift);
     SetShift(syst, util::GetValAs<double>(shift), true);
   }
 
@@ -105,8 +171,7 @@ namespace ana
   {
     assert(syst);
 
-    auto it = fSystsDbl.find(syst);
-    return (it == fSystsDbl.end()) ? 0 : it->second;
+    return GetShiftByIndex(syst->DenseIndex());
   }
 
   //----------------------------------------------------------------------
@@ -115,20 +180,18 @@ namespace ana
   {
     assert(syst);
 
-    auto it = fSystsStan.find(syst);
-    //assert ( (it == fSystsStan.end()) == (fSystsDbl.find(syst) == fSystsDbl.end()) );     // if you're asking for a Stan syst, and it's not there but a double one is, something went wrong
-    if (it == fSystsStan.end())
+    const unsigned int idx = syst->DenseIndex();
+    if (TestBit(fActiveStan, idx)) return fShiftsStan[idx];
+
+    // if you're asking for a Stan syst, and it's not there but a double one is, something went wrong
+    if (TestBit(fActive, idx))
     {
-      auto itDbl = fSystsDbl.find(syst);
-      if (itDbl != fSystsDbl.end())
-      {
-        std::cout << "Warning: creating stan::math::var out of double value for syst '" << syst->ShortName() << "'." << std::endl;
-        std::cout << "  If you see this repeatedly, it's likely a problem.  (A few times during startup is probably harmless.)" << std::endl;
-        fSystsStan[syst] = stan::math::var(itDbl->second);
-        it = fSystsStan.find(syst);
-      }
+      std::cout << "Warning: creating stan::math::var out of double value for syst '" << syst->ShortName() << "'." << std::endl;
+      std::cout << "  If you see this repeatedly, it's likely a problem.  (A few times during startup is probably harmless.)" << std::endl;
+      SetStan(idx, stan::math::var(fShifts[idx]));
+      return fShiftsStan[idx];
     }
-    return (it == fSystsStan.end()) ? 0 : it->second;
+    return 0;
   }
 
   //----------------------------------------------------------------------
@@ -136,8 +199,13 @@ namespace ana
   {
     fID = 0;
 
-    fSystsDbl.clear();
-    fSystsStan.clear();
+    // clear() keeps the capacity, so refilling doesn't allocate
+    fShifts.clear();
+    fActive.clear();
+    fNActive = 0;
+    fShiftsStan.clear();
+    fActiveStan.clear();
+    fNActiveStan = 0;
   }
 
   //----------------------------------------------------------------------
@@ -145,7 +213,8 @@ namespace ana
   {
     double ret = 0;
     // Systematics are all expressed in terms of sigmas
-    for(auto it: fSystsDbl) ret += it.second * it.second;
+    // (unset entries are zero)
+    for(double x: fShifts) ret += x * x;
     return ret;
   }
 
@@ -156,9 +225,11 @@ namespace ana
   void SystShifts::Shift(caf::SRProxy *sr,
                          double &weight) const
   {
-    // always fSystsDbl here because this is only used in the event loop, not in fitting
+    // always fShifts here because this is only used in the event loop, not in fitting
     // (so the autodiff'd version is not needed)
-    for(auto it: fSystsDbl) it.first->Shift(it.second, sr, weight);
+    ForEachSyst(fActive, [&](unsigned int idx, const ISyst* syst){
+        syst->Shift(fShifts[idx], sr, weight);
+      });
   }
 
   //----------------------------------------------------------------------
@@ -167,10 +238,10 @@ namespace ana
     if(IsNominal()) return "nominal";
 
     std::string ret;
-    for(auto it: fSystsDbl){
-      if(!ret.empty()) ret += ",";
-      ret += it.first->ShortName() + TString::Format("=%+g", it.second).Data();
-    }
+    ForEachSyst(fActive, [&](unsigned int idx, const ISyst* syst){
+        if(!ret.empty()) ret += ",";
+        ret += syst->ShortName() + TString::Format("=%+g", fShifts[idx]).Data();
+      });
 
     return ret;
   }
@@ -181,10 +252,10 @@ namespace ana
     if(IsNominal()) return "Nominal";
 
     std::string ret;
-    for(auto it: fSystsDbl){
-      if(!ret.empty()) ret += ", ";
-      ret += it.first->LatexName() + TString::Format(" = %+g", it.second).Data();
-    }
+    ForEachSyst(fActive, [&](unsigned int idx, const ISyst* syst){
+        if(!ret.empty()) ret += ", ";
+        ret += syst->LatexName() + TString::Format(" = %+g", fShifts[idx]).Data();
+      });
 
     return ret;
   }
@@ -193,7 +264,8 @@ namespace ana
   std::vector<const ISyst*> SystShifts::ActiveSysts() const
   {
     std::vector<const ISyst*> ret;
-    for(auto it: fSystsDbl) ret.push_back(it.first);
+    ret.reserve(fNActive);
+    ForEachSyst(fActive, [&](unsigned int, const ISyst* syst){ret.push_back(syst);});
     return ret;
   }
 
@@ -238,19 +310,18 @@ namespace ana
     TObjString("SystShifts").Write("type");
 
     // Don't write any histogram for the nominal case
-    if(!fSystsDbl.empty()){
-      TH1D h("", "", fSystsDbl.size(), 0, fSystsDbl.size());
+    if(!IsNominal()){
+      TH1D h("", "", fNActive, 0, fNActive);
       int ibin = 0;
-      // do this deterministically.  the ordering in the map may otherwise differ because pointers are allocated dynamically
+      // do this deterministically.  the index order depends on the order the systs were constructed in
       std::vector<std::pair<std::string, const ISyst*>> systs;
-      std::transform(fSystsDbl.begin(), fSystsDbl.end(), std::back_inserter(systs),
-                     [](const auto & pair){ return std::make_pair(pair.first->ShortName(), pair.first); });
+      for(const ISyst* s: ActiveSysts()) systs.emplace_back(s->ShortName(), s);
       std::sort(systs.begin(), systs.end(),
                 [](const auto & pairA, const auto & pairB) { return pairA.first < pairB.first; } );
       for(const auto& systPair: systs){
         ++ibin;
         h.GetXaxis()->SetBinLabel(ibin, systPair.first.c_str());
-        h.SetBinContent(ibin, fSystsDbl.at(systPair.second));
+        h.SetBinContent(ibin, GetShift(systPair.second));
       }
       h.Write("vals");
     }
@@ -299,7 +370,9 @@ namespace ana
     stan::math::var ret = 0;
     // Systematics are all expressed in terms of sigmas
     const double norm = log(2 * TMath::Pi());  // assumes sigma = 1, which is ok b/c we're working in units of sigma
-    for(auto it: fSystsStan) ret -= 0.5 * (norm + it.second * it.second);
+    ForEachBit(fActiveStan, [&](unsigned int idx){
+        ret -= 0.5 * (norm + fShiftsStan[idx] * fShiftsStan[idx]);
+      });
     return ret;
   }
 
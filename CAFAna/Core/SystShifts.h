@@ -3,22 +3,26 @@
 #include "CAFAna/Core/FwdDeclare.h"
 #include "duneanaobj/StandardRecord/Proxy/FwdDeclare.h"
 
+#include "CAFAna/Core/ISyst.h"
 #include "CAFAna/Core/StanVar.h"
 
+#include <atomic>
+#include <cstdint>
 #include <map>
 #include <memory>
 #include <string>
-#include <unordered_map>
 #include <vector>
 
 class TDirectory;
 
 namespace ana
 {
-  class ISyst;
   class Restorer;
 
-  /// Simple record of shifts applied to systematic parameters
+  /// \brief Simple record of shifts applied to systematic parameters
+  ///
+  /// Stored as flat arrays indexed by \ref ISyst::DenseIndex, so lookups are
+  /// array indexing and copies are memcpys.
   class SystShifts
   {
   public:
@@ -35,6 +39,7 @@ namespace ana
 
     static SystShifts Nominal() {return SystShifts();}
 
+    /// Leaves out any that have been deleted since they were set
     std::vector<const ISyst*> ActiveSysts() const;
 
     /// Allow derived classes to overload so they can copy themselves
@@ -42,7 +47,7 @@ namespace ana
     /// Note that you own the copy...
     virtual std::unique_ptr<SystShifts> Copy() const;
 
-    bool IsNominal() const {return fSystsDbl.empty(); }  // since there's always a 'double' copy of any stan ones too
+    bool IsNominal() const {return fNActive == 0;}  // since there's always a 'double' copy of any stan ones too
 
     /// shift: 0 = nominal; +-1 = 1sigma shifts etc. Arbitrary shifts allowed
     /// set force=true to insert a syst even if the shift is 0
@@ -56,10 +61,18 @@ namespace ana
     template <typename T=double>
     T GetShift(const ISyst* syst) const;
 
+    /// Same as GetShift<double>(), for hot loops that already know
+    /// syst->DenseIndex()
+    double GetShiftByIndex(unsigned int idx) const
+    {
+      return idx < fShifts.size() ? fShifts[idx] : 0;
+    }
+
     void ResetToNominal();
 
-    bool HasStan(const ISyst* s) const {return fSystsStan.count(s);}
-    bool HasAnyStan() const {return !fSystsStan.empty();}
+    bool HasStan(const ISyst* s) const {return HasStanByIndex(s->DenseIndex());}
+    bool HasStanByIndex(unsigned int idx) const {return TestBit(fActiveStan, idx);}
+    bool HasAnyStan() const {return fNActiveStan > 0;}
 
     /// Penalty term for (frequentist) chi-squared fits
     double Penalty() const;
@@ -89,13 +102,34 @@ namespace ana
     template <typename T>
     T Clamp(const T & t, const ISyst* s);
 
-    std::unordered_map<const ISyst*, double> fSystsDbl;
-    mutable std::unordered_map<const ISyst*, stan::math::var> fSystsStan;
+    static bool TestBit(const std::vector<uint64_t>& bits, unsigned int idx)
+    {
+      return idx/64 < bits.size() && (bits[idx/64] >> (idx%64)) & 1;
+    }
+
+    /// Set fShifts[idx] and mark it active
+    void SetDbl(unsigned int idx, double x);
+    /// Mark fShifts[idx] inactive, and zero it
+    void UnsetDbl(unsigned int idx);
+    /// Set fShiftsStan[idx] and mark it active
+    void SetStan(unsigned int idx, const stan::math::var& x) const;
+
+    /// Indexed by ISyst::DenseIndex(), zero where not set. May be shorter
+    /// than the number of systs.
+    std::vector<double> fShifts;
+    /// Which entries of fShifts are set. Can include explicit zeros
+    std::vector<uint64_t> fActive;
+    unsigned int fNActive;
+
+    /// As fShifts, for those with Stan values. Only read where fActiveStan is set
+    mutable std::vector<stan::math::var> fShiftsStan;
+    mutable std::vector<uint64_t> fActiveStan;
+    mutable unsigned int fNActiveStan;
 
   private:
     int fID;
-    /// The next unused ID
-    static int fgNextID;
+    /// The next unused ID. Fits on several threads make new ones concurrently
+    static std::atomic<int> fgNextID;
   };
 
   //----------------------------------------------------------------------
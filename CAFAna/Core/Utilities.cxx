@@ -139,6 +139,28 @@ namespace ana
     return chi;
   }
 
+  //----------------------------------------------------------------------
+  double LogLikelihoodWithGradient(const Eigen::ArrayXd& ea, const Eigen::ArrayXd& oa,
+                                   Eigen::ArrayXd& dexp, bool useOverflow)
+  {
+    assert(ea.size() == oa.size());
+    assert(LLPerBinFracSystErr::GetError() == 0);
+
+    dexp = Eigen::ArrayXd::Zero(ea.size());
+
+    double chi = 0;
+
+    const int bufferBins = useOverflow ? 0 : -1;
+
+    for(int i = 0; i < ea.size()+bufferBins; ++i){
+      chi += LogLikelihood(ea[i], oa[i]);
+      // The same in both of LogLikelihood()'s branches
+      dexp[i] = oa[i] ? 2*(1-oa[i]/ea[i]) : 2;
+    }
+
+    return chi;
+  }
+
   //----------------------------------------------------------------------
   Eigen::MatrixXd EigenMatrixXdFromTMatrixD(const TMatrixD* mat)
   {
@@ -188,33 +210,124 @@ namespace ana
   }
 
   //----------------------------------------------------------------------
-  double LogLikelihoodCovMx(const Eigen::ArrayXd& e,
-                            const Eigen::ArrayXd& o,
-                            const Eigen::MatrixXd& M,
-                            std::vector<double>* hint)
+  /// The quantity \ref LogLikelihoodCovMx minimizes over \a m
+  static double LLCovMxObjective(const double* m, const double* m0, const double* d,
+                          unsigned int N, const Eigen::MatrixXd& M)
   {
-    // Don't use under/overflow bins (the covariance matrix doesn't have them)
-    const double* m0 = e.data()+1;
-    const double* d = o.data()+1;
-    const unsigned int N = e.size()-2;
+    double ret = 0;
+    // There's the LL of the data to the updated prediction...
+    for(unsigned int i = 0; i < N; ++i) ret += LogLikelihood(m[i], d[i]);
 
-    assert(M.rows() == int(N));
+    // ...plus the penalty the prediction picks up from its covariance
+    for(unsigned int i = 0; i < N; ++i)
+      for(unsigned int j = 0; j < N; ++j)
+        ret += (m[i]-m0[i]) * M(i, j) * (m[j]-m0[j]);
 
-    // We're trying to solve for the best expectation in each bin 'm'
+    return ret;
+  }
 
-    // if no hint is provided, use this as our working area
-    std::vector<double> localm;
-    // The hint is hopefully our m's from a similar problem that was previously
-    // posed, which should be a good starting point.
-    std::vector<double>& mv = hint ? *hint : localm;
-    // If not...
-    if(mv.size() != N){
-      mv.resize(N);
-      // A good seed value is the nominal MC
-      for(unsigned int i = 0; i < N; ++i) mv[i] = m0[i];
+  //----------------------------------------------------------------------
+  /// \brief Helper for \ref LogLikelihoodCovMx
+  ///
+  /// Damped Newton steps on all the m's at once. Returns false if it didn't
+  /// converge, leaving its best attempt in \a m.
+  static bool LogLikelihoodCovMxNewton(const double* m0, const double* d,
+                                unsigned int N, const Eigen::MatrixXd& M,
+                                double* m)
+  {
+    // Bins with no MC are held fixed, same as the Gauss-Seidel version
+    thread_local std::vector<unsigned int> idx;
+    idx.clear();
+    for(unsigned int k = 0; k < N; ++k) if(m0[k] != 0) idx.push_back(k);
+    const unsigned int K = idx.size();
+    if(K == 0) return true;
+
+    thread_local Eigen::MatrixXd MA, H;
+    MA.resize(K, K);
+    Eigen::ArrayXd mA(K), m0A(K), dA(K);
+    for(unsigned int i = 0; i < K; ++i){
+      for(unsigned int j = 0; j < K; ++j) MA(i, j) = M(idx[i], idx[j]);
+      mA[i] = m[idx[i]];
+      m0A[i] = m0[idx[i]];
+      dA[i] = d[idx[i]];
     }
-    double* m = mv.data();
 
+    auto objective = [&](const Eigen::ArrayXd& x)
+      {
+        double ret = 0;
+        for(unsigned int i = 0; i < K; ++i) ret += LogLikelihood(x[i], dA[i]);
+        const Eigen::VectorXd dx = (x-m0A).matrix();
+        return ret + dx.dot(MA*dx);
+      };
+
+    // A starting point left at zero (or negative) by an earlier problem
+    // isn't somewhere the gradient can be evaluated. Use the nominal MC.
+    for(unsigned int i = 0; i < K; ++i) if(!(mA[i] > 0)) mA[i] = m0A[i] > 0 ? m0A[i] : 1;
+
+    double f = objective(mA);
+
+    thread_local Eigen::LLT<Eigen::MatrixXd> llt;
+
+    // Typically converges in a handful of iterations
+    for(int n = 0; n < 50; ++n){
+      // Both the LL and the penalty are convex, so the Hessian is positive
+      // definite as long as M is
+      const Eigen::ArrayXd g = 2*(1 - dA/mA) + 2*(MA*(mA-m0A).matrix()).array();
+      H = 2*MA;
+      H.diagonal() += (2*dA/mA.square()).matrix();
+
+      llt.compute(H);
+      if(llt.info() != Eigen::Success) break;
+      const Eigen::ArrayXd step = -llt.solve(g.matrix()).array();
+
+      // The Newton decrement, roughly how much f could still fall by
+      const double dec = -(g*step).sum();
+      if(!(dec >= 0)) break;
+      if(dec < 1e-12){
+        for(unsigned int i = 0; i < K; ++i) m[idx[i]] = mA[i];
+        return true;
+      }
+
+      // Don't step as far as zero prediction
+      double alpha = 1;
+      for(unsigned int i = 0; i < K; ++i){
+        if(step[i] < 0) alpha = std::min(alpha, -.99*mA[i]/step[i]);
+      }
+
+      // Close enough that rounding in f would confuse the line search
+      if(alpha == 1 && dec < 1e-8){
+        mA += step;
+        f = objective(mA);
+        continue;
+      }
+
+      // Backtrack until f falls by a reasonable fraction of what the quadratic
+      // model promises
+      Eigen::ArrayXd trial;
+      double ftrial;
+      while(true){
+        trial = mA + alpha*step;
+        ftrial = objective(trial);
+        if(ftrial <= f - 1e-4*alpha*dec) break;
+        alpha /= 2;
+        if(alpha < 1e-10) break;
+      }
+      if(alpha < 1e-10) break;
+
+      mA = trial;
+      f = ftrial;
+    } // end for n
+
+    for(unsigned int i = 0; i < K; ++i) m[idx[i]] = mA[i];
+    return false;
+  }
+
+  //----------------------------------------------------------------------
+  /// Helper for \ref LogLikelihoodCovMx. Iterate from \a m until converged
+  static double LogLikelihoodCovMxGaussSeidel(const double* m0, const double* d,
+                                       unsigned int N, const Eigen::MatrixXd& M,
+                                       double* m)
+  {
     double prev = -999;
     double ret = 0;
 
@@ -256,14 +369,7 @@ namespace ana
 
       // Update the chisq
       prev = ret;
-      ret = 0;
-      // There's the LL of the data to the updated prediction...
-      for(unsigned int i = 0; i < N; ++i) ret += LogLikelihood(m[i], d[i]);
-
-      // ...plus the penalty the prediction picks up from its covariance
-      for(unsigned int i = 0; i < N; ++i)
-        for(unsigned int j = 0; j < N; ++j)
-          ret += (m[i]-m0[i]) * M(i, j) * (m[j]-m0[j]);
+      ret = LLCovMxObjective(m, m0, d, N, M);
 
       // If the updates didn't change anything at all then we're done
       if(ret == prev) return ret;
@@ -285,6 +391,46 @@ namespace ana
     abort();
   }
 
+  //----------------------------------------------------------------------
+  double LogLikelihoodCovMx(const Eigen::ArrayXd& e,
+                            const Eigen::ArrayXd& o,
+                            const Eigen::MatrixXd& M,
+                            std::vector<double>* hint,
+                            ELLCovMxSolver solver)
+  {
+    // Don't use under/overflow bins (the covariance matrix doesn't have them)
+    const double* m0 = e.data()+1;
+    const double* d = o.data()+1;
+    const unsigned int N = e.size()-2;
+
+    assert(M.rows() == int(N));
+
+    // We're trying to solve for the best expectation in each bin 'm'
+
+    // if no hint is provided, use this as our working area
+    std::vector<double> localm;
+    // The hint is hopefully our m's from a similar problem that was previously
+    // posed, which should be a good starting point.
+    std::vector<double>& mv = hint ? *hint : localm;
+    // If not...
+    if(mv.size() != N){
+      mv.resize(N);
+      // A good seed value is the nominal MC
+      for(unsigned int i = 0; i < N; ++i) mv[i] = m0[i];
+    }
+    double* m = mv.data();
+
+    // The Newton derivatives assume the plain Poisson LL. With the per-bin
+    // systematic error turned on, only the old method is right
+    if(solver == kLLCovMxNewton && LLPerBinFracSystErr::GetError() <= 0){
+      if(LogLikelihoodCovMxNewton(m0, d, N, M, m))
+        return LLCovMxObjective(m, m0, d, N, M);
+      // Otherwise finish off from wherever it got to
+    }
+
+    return LogLikelihoodCovMxGaussSeidel(m0, d, N, M, m);
+  }
+
   //----------------------------------------------------------------------
   TH2F* ExpandedHistogram(const std::string& title,
                           int nbinsx, double xmin, double xmax,
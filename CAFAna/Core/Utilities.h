@@ -99,6 +99,17 @@ namespace ana
   **/
   double LogLikelihood(const Eigen::ArrayXd& exp, const Eigen::ArrayXd& obs, bool useOverflow = false);
 
+  /** \brief \ref LogLikelihood, and its derivative with respect to each
+      expected count
+
+      \param dexp Filled with \f$\partial\chi^2/\partial e_i=2(1-o_i/e_i)\f$.
+                  Zero for the overflow bin unless \a useOverflow is set.
+
+      Doesn't support \ref LLPerBinFracSystErr.
+  **/
+  double LogLikelihoodWithGradient(const Eigen::ArrayXd& exp, const Eigen::ArrayXd& obs,
+                                   Eigen::ArrayXd& dexp, bool useOverflow = false);
+
   /** \brief The log-likelihood formula for a single bin
 
       \param exp Expected count
@@ -166,6 +177,12 @@ namespace ana
   **/
   double Chi2CovMx(const Eigen::ArrayXd& exp, const Eigen::ArrayXd& obs, const Eigen::MatrixXd& covmxinv);
 
+  /// Methods for \ref LogLikelihoodCovMx
+  enum ELLCovMxSolver{
+    kLLCovMxNewton,     ///< Damped Newton steps on all bins together
+    kLLCovMxGaussSeidel ///< One bin at a time, the original method
+  };
+
   /// \brief For use with low-statistics data in combination with a MC
   /// prediction whose bins have a correlated uncertainty.
   ///
@@ -177,10 +194,12 @@ namespace ana
   /// \param hint Optional. It's a substantial optimization to pass the same
   ///             vector here each time so that we can learn from a previous
   ///             similar problem.
+  /// \param solver How to find the best-fit expectations. Newton falls back
+  ///               to Gauss-Seidel if it fails to converge.
   ///
   /// The matrix must be symmetric and have dimension equal to the number of
   /// non-overflow bins in the histograms.
-  double LogLikelihoodCovMx(const Eigen::ArrayXd& exp, const Eigen::ArrayXd& obs, const Eigen::MatrixXd& covmxinv, std::vector<double>* hint = 0);
+  double LogLikelihoodCovMx(const Eigen::ArrayXd& exp, const Eigen::ArrayXd& obs, const Eigen::MatrixXd& covmxinv, std::vector<double>* hint = 0, ELLCovMxSolver solver = kLLCovMxNewton);
 
 
   /// \brief Internal helper for \ref Surface and \ref FCSurface
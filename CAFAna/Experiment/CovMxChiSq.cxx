@@ -2,53 +2,123 @@
 
 #include "CAFAna/Core/Utilities.h"
 
+#include <iostream>
+
 namespace ana
 {
   //----------------------------------------------------------------------
-  CovMxChiSq::CovMxChiSq(const Eigen::MatrixXd& mat)
-    : fCovMxFrac(mat)
+  CovMxChiSq::CovMxChiSq(const Eigen::MatrixXd& mat, bool lowRank)
+    : fCovMxFrac(mat), fLowRank(lowRank)
   {
+    if(!fLowRank) return;
+
+    const Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> eig(fCovMxFrac);
+    if(eig.info() != Eigen::Success){
+      std::cout << "CovMxChiSq: eigendecomposition failed, not using low-rank method" << std::endl;
+      fLowRank = false;
+      return;
+    }
+
+    // Eigenvalues are in increasing order. Anything this small (or
+    // negative, which can only be rounding) contributes nothing
+    const Eigen::VectorXd& vals = eig.eigenvalues();
+    const int N = vals.size();
+    const double thresh = 1e-12 * (N > 0 ? vals[N-1] : 0);
+    int first = 0;
+    while(first < N && vals[first] <= thresh) ++first;
+    const int rank = N-first;
+
+    // Per evaluation the low-rank method is O(N*rank^2), against N^3/3 for
+    // Cholesky
+    if(3*rank > N){
+      std::cout << "CovMxChiSq: matrix has rank " << rank << " of " << N
+                << ", too high for the low-rank method to help" << std::endl;
+      fLowRank = false;
+      return;
+    }
+
+    fEigVecs = eig.eigenvectors().rightCols(rank);
+    fInvEigVals = vals.tail(rank).cwiseInverse();
   }
 
   //----------------------------------------------------------------------
   double CovMxChiSq::ChiSq(Eigen::ArrayXd apred, Eigen::ArrayXd adata) const
   {
-    const Eigen::MatrixXd covInvM = GetAbsInvCovMat(apred);
+    const int N = fCovMxFrac.rows();
+
+    if(apred.size() != N+2 || adata.size() != N+2){
+      std::cout << "CovMxChiSq: expected " << N << " bins plus under/overflow. Got "
+                << apred.size() << " and " << adata.size() << std::endl;
+      abort();
+    }
+
+    // The statistical errors come from the unmasked prediction
+    const Eigen::ArrayXd pred = apred.segment(1, N);
 
-    // Now the matrix is in order apply the mask to the two histograms
     ApplyMask(apred, adata);
 
-    // Now it's absolute it's suitable for use in the chisq calculation
-    return Chi2CovMx(apred, adata, covInvM);
+    // The absolute inverse covariance matrix is D^-1 (F + S)^-1 D^-1, where D
+    // has the prediction on the diagonal, F is the fractional matrix, and S
+    // the fractional statistical errors. So solve F + S against the residuals
+    // divided by the prediction. Bins with no prediction are left out, as
+    // they always were.
+    Eigen::VectorXd y(N);
+    for(int b = 0; b < N; ++b){
+      y[b] = (pred[b] != 0) ? (apred[b+1] - adata[b+1]) / pred[b] : 0;
+    }
+
+    // Woodbury needs every bin to have some statistical error
+    if(fLowRank && (pred > 0).all()) return ChiSqLowRank(pred, y);
+
+    return ChiSqFactorize(pred, y);
   }
 
   //----------------------------------------------------------------------
-  Eigen::MatrixXd CovMxChiSq::GetAbsInvCovMat(const Eigen::ArrayXd& apred) const
+  double CovMxChiSq::ChiSqFactorize(const Eigen::ArrayXd& pred,
+                                    const Eigen::VectorXd& y) const
   {
-    const int N = apred.size()-2; // no under/overflow
+    const int N = pred.size();
 
-    // We have to manually add statistical uncertainty in quadrature
-    Eigen::MatrixXd cov = fCovMxFrac;
+    // We have to manually add statistical uncertainty in quadrature. Reuse
+    // the storage between calls
+    thread_local Eigen::MatrixXd cov;
+    cov = fCovMxFrac;
     for(int b = 0; b < N; ++b){
-      const double Nevt = apred[b+1];
+      const double Nevt = pred[b];
       if(Nevt > 0) cov(b, b) += 1/Nevt;
     }
 
-    // And then invert
-    Eigen::MatrixXd covInv = cov.inverse();
+    thread_local Eigen::LLT<Eigen::MatrixXd> llt;
+    llt.compute(cov);
+    if(llt.info() == Eigen::Success) return y.dot(llt.solve(y));
 
-    // Covariance matrix is fractional; convert it to absolute by multiplying
-    // out the prediction
+    // Not positive definite, which can happen when some bins have no
+    // statistical error. The pivoting version copes
+    thread_local Eigen::LDLT<Eigen::MatrixXd> ldlt;
+    ldlt.compute(cov);
+    return y.dot(ldlt.solve(y));
+  }
+
+  //----------------------------------------------------------------------
+  double CovMxChiSq::ChiSqLowRank(const Eigen::ArrayXd& pred,
+                                  const Eigen::VectorXd& y) const
+  {
+    // With F = U L U^T and S^-1 = P, the prediction on the diagonal
     //
-    // TODO there is probably a nice Eigen expression that will do this
-    for(int b0 = 0; b0 < N; ++b0){
-      for(int b1 = 0; b1 < N; ++b1){
-        const double f = apred[b0+1] * apred[b1+1];
-        if(f != 0) covInv.coeffRef(b0, b1) /= f;
-        else covInv.coeffRef(b0, b1) = 0.;
-      }
-    }
+    //   (F + S)^-1 = P - P U (L^-1 + U^T P U)^-1 U^T P
+    //
+    // so only a rank x rank matrix needs factorizing
+    const Eigen::VectorXd Py = (pred * y.array()).matrix();
+    const Eigen::VectorXd z = fEigVecs.transpose() * Py;
+
+    thread_local Eigen::MatrixXd PU, K;
+    PU = pred.matrix().asDiagonal() * fEigVecs;
+    K = fEigVecs.transpose() * PU;
+    K.diagonal() += fInvEigVals;
+
+    thread_local Eigen::LLT<Eigen::MatrixXd> llt;
+    llt.compute(K);
 
-    return covInv;
+    return y.dot(Py) - z.dot(llt.solve(z));
   }
 }
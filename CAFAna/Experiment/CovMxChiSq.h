@@ -4,16 +4,38 @@
 
 namespace ana
 {
+  /// \brief Chi-square from a fractional covariance matrix, with the
+  /// statistical errors of the prediction added
+  ///
+  /// The inverse is never formed. The prediction is scaled into the
+  /// residuals instead, and the fractional matrix plus statistical errors is
+  /// factorized and solved.
   class CovMxChiSq: public ICovarianceMatrix
   {
   public:
-    CovMxChiSq(const Eigen::MatrixXd& mat);
+    /// \param lowRank Eigendecompose \a mat up front, and add the statistical
+    ///                errors on each evaluation using the Woodbury identity.
+    ///                Only faster if \a mat has rank well below its size,
+    ///                otherwise the normal method is used.
+    CovMxChiSq(const Eigen::MatrixXd& mat, bool lowRank = false);
 
     double ChiSq(Eigen::ArrayXd apred, Eigen::ArrayXd adata) const override;
 
   protected:
-    Eigen::MatrixXd GetAbsInvCovMat(const Eigen::ArrayXd& apred) const;
+    /// Solve by Cholesky factorization of the full matrix
+    double ChiSqFactorize(const Eigen::ArrayXd& pred,
+                          const Eigen::VectorXd& y) const;
+
+    /// Solve using the precomputed eigendecomposition
+    double ChiSqLowRank(const Eigen::ArrayXd& pred,
+                        const Eigen::VectorXd& y) const;
 
     Eigen::MatrixXd fCovMxFrac;
+
+    bool fLowRank;
+    /// Eigenvectors of \ref fCovMxFrac with non-negligible eigenvalues
+    Eigen::MatrixXd fEigVecs;
+    /// Reciprocals of the corresponding eigenvalues
+    Eigen::VectorXd fInvEigVals;
   };
 }
@@ -5,8 +5,8 @@
 namespace ana
 {
   //----------------------------------------------------------------------
-  CovMxLL::CovMxLL(const Eigen::MatrixXd& mat)
-    : fCovMxInv(mat.inverse())
+  CovMxLL::CovMxLL(const Eigen::MatrixXd& mat, ELLCovMxSolver solver)
+    : fCovMxInv(mat.inverse()), fSolver(solver)
   {
   }
 
@@ -15,6 +15,6 @@ namespace ana
   {
     ApplyMask(apred, adata);
 
-    return LogLikelihoodCovMx(apred, adata, fCovMxInv, &fState);
+    return LogLikelihoodCovMx(apred, adata, fCovMxInv, &fState, fSolver);
   }
 }
@@ -2,6 +2,8 @@
 
 #include "CAFAna/Experiment/ICovarianceMatrix.h"
 
+#include "CAFAna/Core/Utilities.h"
+
 #include <vector>
 
 namespace ana
@@ -9,12 +11,14 @@ namespace ana
   class CovMxLL: public ICovarianceMatrix
   {
   public:
-    CovMxLL(const Eigen::MatrixXd& mat);
+    CovMxLL(const Eigen::MatrixXd& mat,
+            ELLCovMxSolver solver = kLLCovMxNewton);
 
     double ChiSq(Eigen::ArrayXd apred, Eigen::ArrayXd adata) const override;
 
   protected:
     Eigen::MatrixXd fCovMxInv;
+    ELLCovMxSolver fSolver;
 
     mutable std::vector<double> fState;
   };
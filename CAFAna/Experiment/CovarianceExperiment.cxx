@@ -48,6 +48,10 @@ namespace ana
       fCov = new CovMxChiSq(EigenMatrixXdFromTMatrixD(cov));
       break;
 
+    case kCovMxChiSqLowRank:
+      fCov = new CovMxChiSq(EigenMatrixXdFromTMatrixD(cov), true);
+      break;
+
     case kCovMxChiSqPreInvert:
       fCov = new CovMxChiSqPreInvert(EigenMatrixXdFromTMatrixD(cov), Predict(0));
       break;
@@ -14,7 +14,8 @@ namespace ana
   enum ETestStatistic{
     kCovMxChiSq,
     kCovMxChiSqPreInvert, ///< good approximation for ND
-    kCovMxLogLikelihood ///< for FD
+    kCovMxLogLikelihood, ///< for FD
+    kCovMxChiSqLowRank ///< same as kCovMxChiSq, faster if the matrix has low rank
   };
 
   /// Compare a single data spectrum to the MC expectation
@@ -4,6 +4,8 @@
 #include "CAFAna/Core/StanTypedefs.h"
 #include "CAFAna/Core/SystShifts.h"
 
+#include <vector>
+
 class TDirectory;
 
 class TH1;
@@ -26,6 +28,20 @@ namespace ana
         return 0;
       };
 
+      /// \brief \ref ChiSq and its derivatives with respect to \a systs
+      ///
+      /// Fills \a grad[i] with d(chisq)/d(systs[i]), all in one pass. Null
+      /// entries of \a systs get zero. Returns false, without necessarily
+      /// setting the outputs, if the derivatives can't be found analytically.
+      virtual bool ChiSqWithGradient(osc::IOscCalcAdjustable* osc,
+                                     const SystShifts& syst,
+                                     const std::vector<const ISyst*>& systs,
+                                     double& chisq,
+                                     std::vector<double>& grad) const
+      {
+        return false;
+      }
+
       virtual stan::math::var LogLikelihood(osc::IOscCalcAdjustableStan *osc,
                                             const SystShifts &syst = kNoShift) const
       {
@@ -5,60 +5,215 @@
 #include "CAFAna/Core/LoadFromFile.h"
 #include "CAFAna/Core/LoadFromRegistry.h"
 #include "CAFAna/Core/Stan.h"
+#include "CAFAna/Core/ThreadPool.h"
 
 #include "OscLib/IOscCalc.h"
 
 #include "TDirectory.h"
 #include "TH1D.h"
+#include "TMD5.h"
 #include "TObjString.h"
 #include "TVectorD.h"
 
+#include <algorithm>
 #include <cassert>
 
+#ifdef USE_PREDINTERP_OMP
+#include <omp.h>
+#endif
+
 namespace ana
 {
   REGISTER_LOADFROM("MultiExperiment", IExperiment, MultiExperiment);
 
+  namespace
+  {
+    /// Set in the tasks of a parallel ChiSq(), which don't start any more
+    thread_local bool gInParallelChiSq = false;
+  }
+
   //----------------------------------------------------------------------
-  SystShifts MultiExperiment::TranslateShifts(const SystShifts& syst, int idx) const
+  const SystShifts& MultiExperiment::TranslateShifts(const SystShifts& syst,
+                                                     int idx) const
   {
-    // Make a local copy we're going to rewrite into the terms this
-    // sub-experiment will accept.
-    SystShifts localShifts = syst;
-    for(auto it: fSystCorrelations[idx]){
+    // Assigning into the same object each time reuses its storage
+    std::vector<SystShifts>& translated = *fTranslated;
+    if(translated.size() != fExpts.size()) translated.resize(fExpts.size());
+
+    return TranslateShifts(syst, idx, translated[idx]);
+  }
+
+  //----------------------------------------------------------------------
+  const SystShifts& MultiExperiment::TranslateShifts(const SystShifts& syst,
+                                                     int idx,
+                                                     SystShifts& localShifts) const
+  {
+    const std::vector<Corr>& corrs = fCorrs[idx].corrs;
+
+    auto shifted = [&syst](const Corr& c)
+      {
+        return syst.GetShiftByIndex(c.prim) != 0 || syst.HasStanByIndex(c.prim);
+      };
+
+    // Nothing to translate, and no need for a copy
+    if(std::none_of(corrs.begin(), corrs.end(), shifted)) return syst;
+
+    // Rewrite a local copy into the terms this sub-experiment will accept
+    localShifts = syst;
+    for(const Corr& c: corrs){
       // We're mapping prim -> sec
-      const ISyst* prim = it.first;
-      const ISyst* sec = it.second;
-      if(syst.GetShift(prim) != 0 || syst.HasStan(prim)){
-        // sec can be unset, which means there's no representation needed
-        // of prim in the sub-experiment.
-        if(sec){
-          if(syst.HasStan(prim)){
-            localShifts.SetShift(sec, syst.GetShift<stan::math::var>(prim));
-          }
-          else{
-            localShifts.SetShift(sec, syst.GetShift(prim));
-          }
+      if(!shifted(c)) continue;
+
+      // sec can be unset, which means there's no representation needed
+      // of prim in the sub-experiment.
+      if(c.sec){
+        if(syst.HasStanByIndex(c.prim)){
+          localShifts.SetShift(c.sec, syst.GetShift<stan::math::var>(c.primSyst));
+        }
+        else{
+          localShifts.SetShift(c.sec, syst.GetShiftByIndex(c.prim));
         }
-        // We've either translated or discarded prim, so drop it here.
-        localShifts.SetShift(prim, 0);
       }
+      // We've either translated or discarded prim, so drop it here.
+      localShifts.SetShift(c.primSyst, 0);
     }
 
     return localShifts;
   }
 
+  //----------------------------------------------------------------------
+  osc::IOscCalcAdjustable* MultiExperiment::LocalCalc(osc::IOscCalcAdjustable* osc,
+                                                      CalcCopy& local) const
+  {
+    if(!osc) return 0;
+
+    if(local.src == osc && local.calc){
+      // Some calculators have parameters beyond the standard ones, so only
+      // keep the copy if it provably matches
+      CopyParams(osc, local.calc.get());
+      std::unique_ptr<TMD5> want(osc->GetParamsHash());
+      std::unique_ptr<TMD5> got(local.calc->GetParamsHash());
+      if(want && got && *want == *got) return local.calc.get();
+    }
+
+    // Calculators cache internally, so each task needs its own
+    local.src = osc;
+    local.calc.reset(osc->Copy());
+    return local.calc.get();
+  }
+
   //----------------------------------------------------------------------
   double MultiExperiment::ChiSq(osc::IOscCalcAdjustable* osc,
                                 const SystShifts& syst) const
   {
+    const int N = fExpts.size();
+
+    bool parallel = fParallel && N > 1 && !gInParallelChiSq &&
+      fWarmedUp.load(std::memory_order_acquire);
+#ifdef USE_PREDINTERP_OMP
+    parallel = parallel && !omp_in_parallel();
+#endif
+
+    // If someone else already has the workers, this call stays serial
+    std::unique_lock<std::mutex> lock(fWorkersMutex, std::defer_lock);
+    if(parallel) parallel = lock.try_lock();
+
+    if(parallel){
+      if(int(fWorkers.size()) != N) fWorkers.resize(N);
+
+      std::vector<double> chis(N);
+
+#ifdef USE_PREDINTERP_OMP
+      // The OpenMP threads are shared out between the sub-experiments
+      const int nThreadsPerExpt = std::max(1, omp_get_max_threads()/N);
+#endif
+
+      ThreadPool pool;
+      for(int idx = 0; idx < N; ++idx){
+        pool.AddTask([&, idx](){
+#ifdef USE_PREDINTERP_OMP
+            omp_set_num_threads(nThreadsPerExpt);
+#endif
+            gInParallelChiSq = true;
+            Worker& w = fWorkers[idx];
+            chis[idx] = fExpts[idx]->ChiSq(LocalCalc(osc, w.calc),
+                                           TranslateShifts(syst, idx, w.translated));
+            gInParallelChiSq = false;
+          });
+      }
+      pool.Finish();
+
+      // Same order as the serial sum, so the same answer
+      double ret = 0.;
+      for(double chi: chis) ret += chi;
+      return ret;
+    }
+
     double ret = 0.;
-    for(unsigned int idx = 0; idx < fExpts.size(); ++idx){
+    for(int idx = 0; idx < N; ++idx){
       ret += fExpts[idx]->ChiSq(osc, TranslateShifts(syst, idx));
     }
+
+    fWarmedUp.store(true, std::memory_order_release);
+
     return ret;
   }
 
+  //----------------------------------------------------------------------
+  bool MultiExperiment::ChiSqWithGradient(osc::IOscCalcAdjustable* osc,
+                                          const SystShifts& syst,
+                                          const std::vector<const ISyst*>& systs,
+                                          double& chisq,
+                                          std::vector<double>& grad) const
+  {
+    chisq = 0;
+    grad.assign(systs.size(), 0);
+
+    std::vector<const ISyst*> localSysts;
+    std::vector<double> localGrad;
+    for(unsigned int idx = 0; idx < fExpts.size(); ++idx){
+      // The sub-experiment sees each primary as its secondary, so that's the
+      // derivative we want from it
+      localSysts = systs;
+      for(const ISyst*& s: localSysts){
+        const Corr* c = fCorrs[idx].Find(s);
+        if(!c) continue;
+
+        // TranslateShifts() overwrites sec with the primary's value, so if
+        // sec is fitted too its own derivative would be wrong. And a primary
+        // mapped twice moves two secondaries at once. Leave both cases to
+        // finite differences.
+        if(c->sec && std::find(systs.begin(), systs.end(), c->sec) != systs.end()){
+          std::cout << "MultiExperiment: " << s->ShortName() << " and "
+                    << c->sec->ShortName() << " are both fitted, but the first "
+                    << "overrides the second in experiment " << idx
+                    << ". No analytic gradient." << std::endl;
+          return false;
+        }
+        if(fCorrs[idx].dupPrims &&
+           std::count_if(fCorrs[idx].corrs.begin(), fCorrs[idx].corrs.end(),
+                         [c](const Corr& o){return o.prim == c->prim;}) > 1){
+          std::cout << "MultiExperiment: " << s->ShortName() << " has several "
+                    << "secondaries in experiment " << idx
+                    << ". No analytic gradient." << std::endl;
+          return false;
+        }
+
+        s = c->sec;
+      }
+
+      double chi;
+      if(!fExpts[idx]->ChiSqWithGradient(osc, TranslateShifts(syst, idx),
+                                         localSysts, chi, localGrad))
+        return false;
+
+      chisq += chi;
+      for(unsigned int i = 0; i < systs.size(); ++i) grad[i] += localGrad[i];
+    }
+
+    return true;
+  }
+
   //----------------------------------------------------------------------
   void MultiExperiment::
   SetSystCorrelations(int idx,
@@ -86,6 +241,21 @@ namespace ana
 
     // Apply it
     fSystCorrelations[idx] = corrs;
+
+    // And index it for TranslateShifts()
+    Corrs& dense = fCorrs[idx];
+    dense.corrs.clear();
+    dense.byPrim.clear();
+    dense.dupPrims = false;
+    for(auto it: corrs){
+      const unsigned int prim = it.first->DenseIndex();
+      if(prim >= dense.byPrim.size()) dense.byPrim.resize(prim+1, -1);
+      // A primary mapped twice is translated to both, but Find() returns
+      // the first
+      if(dense.byPrim[prim] < 0) dense.byPrim[prim] = dense.corrs.size();
+      else dense.dupPrims = true;
+      dense.corrs.push_back({prim, it.first, it.second});
+    }
   }
 
 
@@ -2,7 +2,14 @@
 
 #include "CAFAna/Experiment/IExperiment.h"
 
+#include "CAFAna/Core/SystShifts.h"
+#include "CAFAna/Core/ThreadLocal.h"
+
+#include "OscLib/IOscCalc.h"
+
+#include <atomic>
 #include <memory>
+#include <mutex>
 #include <vector>
 
 namespace ana
@@ -14,17 +21,30 @@ namespace ana
     MultiExperiment(std::vector<const IExperiment*> expts = {}) : fExpts(expts)
     {
       fSystCorrelations.resize(expts.size());
+      fCorrs.resize(expts.size());
     }
 
     void Add(const IExperiment* expt)
     {
       fExpts.push_back(expt);
       fSystCorrelations.resize(fExpts.size());
+      fCorrs.resize(fExpts.size());
     }
 
     virtual double ChiSq(osc::IOscCalcAdjustable* osc,
                          const SystShifts& syst = SystShifts::Nominal()) const override;
 
+    /// \brief Sum of the sub-experiments' gradients, in terms of \a systs
+    ///
+    /// Always serial. False if any of the sub-experiments can't do it, or if
+    /// the correlations make the derivatives ambiguous: a primary and its
+    /// secondary both in \a systs, or a primary with several secondaries.
+    bool ChiSqWithGradient(osc::IOscCalcAdjustable* osc,
+                           const SystShifts& syst,
+                           const std::vector<const ISyst*>& systs,
+                           double& chisq,
+                           std::vector<double>& grad) const override;
+
     /// Sum up log-likelihoods of sub-expts.  N.b.: covariance matrix business not currently supported for Stan.
     stan::math::var LogLikelihood(osc::IOscCalcAdjustableStan* osc,
                                   const SystShifts& syst) const override;
@@ -44,14 +64,88 @@ namespace ana
                              const std::vector<std::pair<const ISyst*,
                                                          const ISyst*>>& corrs);
 
+    /// \brief Evaluate the sub-experiments concurrently in \ref ChiSq
+    ///
+    /// One task per sub-experiment on a ThreadPool, each with its own copy of
+    /// the oscillation calculator, kept between calls. The first call is
+    /// serial, so that lazy initialization happens only once. Calls made
+    /// meanwhile from other threads, or from inside an OpenMP parallel region,
+    /// stay serial too.
+    void SetParallel(bool parallel = true){fParallel = parallel;}
+
     virtual void SaveTo(TDirectory* dir, const std::string& name) const override;
     static std::unique_ptr<MultiExperiment> LoadFrom(TDirectory* dir, const std::string& name);
 
   protected:
-    SystShifts TranslateShifts(const SystShifts& syst, int idx) const;
+    /// \brief The shifts sub-experiment \a idx should see
+    ///
+    /// \a syst itself if none of the primaries for \a idx are shifted,
+    /// otherwise a rewritten copy held in \a storage
+    const SystShifts& TranslateShifts(const SystShifts& syst, int idx,
+                                      SystShifts& storage) const;
+    /// Held in this thread's entry of \ref fTranslated
+    const SystShifts& TranslateShifts(const SystShifts& syst, int idx) const;
 
     std::vector<std::vector<std::pair<const ISyst*, const ISyst*>>> fSystCorrelations;
 
+    /// One entry of \ref fSystCorrelations
+    struct Corr
+    {
+      unsigned int prim; ///< ISyst::DenseIndex of the primary
+      const ISyst* primSyst;
+      const ISyst* sec; ///< Can be null
+    };
+    /// \brief \ref fSystCorrelations, set up by \ref SetSystCorrelations
+    ///
+    /// \a byPrim indexes \a corrs by the DenseIndex of the primary (its first
+    /// entry, if there are several), -1 where it isn't one
+    struct Corrs
+    {
+      std::vector<Corr> corrs;
+      std::vector<int> byPrim;
+      /// Does any primary appear more than once?
+      bool dupPrims = false;
+
+      /// The Corr with primary \a s, or null
+      const Corr* Find(const ISyst* s) const
+      {
+        const unsigned int idx = s->DenseIndex();
+        if(idx >= byPrim.size() || byPrim[idx] < 0) return 0;
+        return &corrs[byPrim[idx]];
+      }
+    };
+    /// Per sub-experiment
+    std::vector<Corrs> fCorrs;
+
     std::vector<const IExperiment*> fExpts;
+
+    /// One per sub-experiment, assigned to rather than constructed each time
+    mutable ThreadLocal<std::vector<SystShifts>> fTranslated;
+
+    /// Reused as long as the same calculator is passed in
+    struct CalcCopy
+    {
+      const osc::IOscCalcAdjustable* src = 0;
+      std::unique_ptr<osc::IOscCalcAdjustable> calc;
+    };
+    /// \a local's copy of \a osc, with the same parameters
+    osc::IOscCalcAdjustable* LocalCalc(osc::IOscCalcAdjustable* osc,
+                                       CalcCopy& local) const;
+
+    /// What the task for one sub-experiment in the parallel \ref ChiSq uses
+    struct Worker
+    {
+      CalcCopy calc;
+      SystShifts translated;
+    };
+    /// Per sub-experiment
+    mutable std::vector<Worker> fWorkers;
+    /// Held while \ref fWorkers are in use
+    mutable std::mutex fWorkersMutex;
+
+    bool fParallel = false;
+    /// Has \ref ChiSq been run serially yet, giving everything a chance to
+    /// do its lazy initialization?
+    mutable std::atomic<bool> fWarmedUp{false};
   };
 }
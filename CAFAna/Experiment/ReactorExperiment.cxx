@@ -22,6 +22,18 @@ namespace ana
     return util::sqr((kFitSinSq2Theta13.GetValue(osc)-fBestFit)/fSigma);
   }
 
+  //----------------------------------------------------------------------
+  bool ReactorExperiment::ChiSqWithGradient(osc::IOscCalcAdjustable* osc,
+                                            const SystShifts& syst,
+                                            const std::vector<const ISyst*>& systs,
+                                            double& chisq,
+                                            std::vector<double>& grad) const
+  {
+    chisq = ChiSq(osc, syst);
+    grad.assign(systs.size(), 0);
+    return true;
+  }
+
   //----------------------------------------------------------------------
   double ReactorExperiment::SSTh13(osc::IOscCalcAdjustable* osc) const
   {
@@ -18,6 +18,13 @@ namespace ana
     virtual double ChiSq(osc::IOscCalcAdjustable* osc,
                          const SystShifts& shift = SystShifts::Nominal()) const override;
 
+    /// Independent of the systematics, so the gradient is all zeros
+    bool ChiSqWithGradient(osc::IOscCalcAdjustable* osc,
+                           const SystShifts& syst,
+                           const std::vector<const ISyst*>& systs,
+                           double& chisq,
+                           std::vector<double>& grad) const override;
+
     void SaveTo(TDirectory* dir, const std::string& name) const override;
     static std::unique_ptr<ReactorExperiment> LoadFrom(TDirectory* dir, const std::string& name);
   protected:
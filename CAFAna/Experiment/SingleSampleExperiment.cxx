@@ -42,6 +42,37 @@ namespace ana
     return ana::LogLikelihood(apred, adata);
   }
 
+  //----------------------------------------------------------------------
+  bool SingleSampleExperiment::ChiSqWithGradient(osc::IOscCalcAdjustable* calc,
+                                                 const SystShifts& syst,
+                                                 const std::vector<const ISyst*>& systs,
+                                                 double& chisq,
+                                                 std::vector<double>& grad) const
+  {
+    // The profiled per-bin error isn't differentiated
+    if(LLPerBinFracSystErr::GetError() > 0) return false;
+
+    Eigen::ArrayXd apred;
+    std::vector<Eigen::ArrayXd> dpred;
+    if(!fMC->PredictSystWithGradient(calc, syst, systs, fData.POT(), apred, dpred))
+      return false;
+
+    Eigen::ArrayXd adata = fData.GetEigen(fData.POT());
+
+    ApplyMask(apred, adata);
+
+    Eigen::ArrayXd dchi;
+    chisq = LogLikelihoodWithGradient(apred, adata, dchi);
+    // Masked-out bins don't contribute
+    if(fMaskA.size() != 0) dchi *= fMaskA;
+
+    grad.resize(systs.size());
+    for(unsigned int i = 0; i < systs.size(); ++i)
+      grad[i] = (dchi*dpred[i]).sum();
+
+    return true;
+  }
+
   //----------------------------------------------------------------------
   void SingleSampleExperiment::ApplyMask(Eigen::ArrayXd& a,
                                          Eigen::ArrayXd& b) const
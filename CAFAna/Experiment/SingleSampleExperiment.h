@@ -19,6 +19,13 @@ namespace ana
     virtual double ChiSq(osc::IOscCalcAdjustable* osc,
                          const SystShifts& syst = kNoShift) const override;
 
+    /// Needs an \ref IPrediction supporting PredictSystWithGradient()
+    bool ChiSqWithGradient(osc::IOscCalcAdjustable* osc,
+                           const SystShifts& syst,
+                           const std::vector<const ISyst*>& systs,
+                           double& chisq,
+                           std::vector<double>& grad) const override;
+
     stan::math::var LogLikelihood(osc::_IOscCalcAdjustable<stan::math::var> *osc,
                                   const SystShifts &syst = kNoShift) const override;
 
@@ -54,6 +54,18 @@ namespace ana
     return ret;
   }
 
+  //----------------------------------------------------------------------
+  bool SolarConstraints::ChiSqWithGradient(osc::IOscCalcAdjustable* osc,
+                                           const SystShifts& syst,
+                                           const std::vector<const ISyst*>& systs,
+                                           double& chisq,
+                                           std::vector<double>& grad) const
+  {
+    chisq = ChiSq(osc, syst);
+    grad.assign(systs.size(), 0);
+    return true;
+  }
+
   //----------------------------------------------------------------------
   void SolarConstraints::SaveTo(TDirectory* dir, const std::string& name) const
   {
@@ -19,6 +19,13 @@ namespace ana
     virtual double ChiSq(osc::IOscCalcAdjustable* osc,
                          const SystShifts& syst = SystShifts::Nominal()) const override;
 
+    /// Independent of the systematics, so the gradient is all zeros
+    bool ChiSqWithGradient(osc::IOscCalcAdjustable* osc,
+                           const SystShifts& syst,
+                           const std::vector<const ISyst*>& systs,
+                           double& chisq,
+                           std::vector<double>& grad) const override;
+
     virtual void SaveTo(TDirectory* dir, const std::string& name) const override;
     static std::unique_ptr<SolarConstraints> LoadFrom(TDirectory* dir, const std::string& name);
 
@@ -10,40 +10,70 @@ namespace ana
   public:
     virtual ~IExtrap() {};
 
+    /// \brief Charged current component \a from -> \a to (signed PDG codes,
+    /// eg +14, +12 for \f$\nu_\mu\to\nu_e\f$)
+    ///
+    /// Refers to the extrapolation's own copy, so repeated Oscillated() calls
+    /// reuse its oscillation cache. Valid as long as this IExtrap is.
+    virtual const OscillatableSpectrum& CCComponentRef(int from, int to) const = 0;
+
+    /// Neutral currents, valid as long as this IExtrap is
+    virtual const Spectrum& NCTotalComponentRef() const = 0;
+    virtual const Spectrum& NCComponentRef() const = 0;
+    virtual const Spectrum& NCAntiComponentRef() const = 0;
+
+    // The by-value versions below copy a full reco x true matrix on every
+    // call. They remain for existing callers, prefer the Ref versions above.
+
     /// Charged current electron neutrino survival (\f$\nu_e\to\nu_e\f$)
-    virtual OscillatableSpectrum NueSurvComponent() = 0;
+    [[deprecated("Use CCComponentRef(+12, +12)")]]
+    virtual OscillatableSpectrum NueSurvComponent()       {return CCComponentRef(+12, +12);}
     /// Charged current electron antineutrino survival (\f$\bar\nu_e\to\bar\nu_e\f$)
-    virtual OscillatableSpectrum AntiNueSurvComponent() = 0;
+    [[deprecated("Use CCComponentRef(-12, -12)")]]
+    virtual OscillatableSpectrum AntiNueSurvComponent()   {return CCComponentRef(-12, -12);}
 
     /// Charged current muon neutrino survival (\f$\nu_\mu\to\nu_\mu\f$)
-    virtual OscillatableSpectrum NumuSurvComponent() = 0;
+    [[deprecated("Use CCComponentRef(+14, +14)")]]
+    virtual OscillatableSpectrum NumuSurvComponent()      {return CCComponentRef(+14, +14);}
     /// Charged current muon antineutrino survival (\f$\bar\nu_\mu\to\bar\nu_\mu\f$)
-    virtual OscillatableSpectrum AntiNumuSurvComponent() = 0;
+    [[deprecated("Use CCComponentRef(-14, -14)")]]
+    virtual OscillatableSpectrum AntiNumuSurvComponent()  {return CCComponentRef(-14, -14);}
 
     /// Charged current electron neutrino appearance (\f$\nu_\mu\to\nu_e\f$)
-    virtual OscillatableSpectrum NueAppComponent() = 0;
+    [[deprecated("Use CCComponentRef(+14, +12)")]]
+    virtual OscillatableSpectrum NueAppComponent()        {return CCComponentRef(+14, +12);}
     /// Charged current electron antineutrino appearance (\f$\bar\nu_\mu\to\bar\nu_e\f$)
-    virtual OscillatableSpectrum AntiNueAppComponent() = 0;
+    [[deprecated("Use CCComponentRef(-14, -12)")]]
+    virtual OscillatableSpectrum AntiNueAppComponent()    {return CCComponentRef(-14, -12);}
 
     /// Charged current muon neutrino appearance (\f$\nu_e\to\nu_\mu\f$)
-    virtual OscillatableSpectrum NumuAppComponent() = 0;
+    [[deprecated("Use CCComponentRef(+12, +14)")]]
+    virtual OscillatableSpectrum NumuAppComponent()       {return CCComponentRef(+12, +14);}
     /// Charged current muon antineutrino appearance (\f$\bar\nu_e\to\bar\nu_\mu\f$)
-    virtual OscillatableSpectrum AntiNumuAppComponent() = 0;
+    [[deprecated("Use CCComponentRef(-12, -14)")]]
+    virtual OscillatableSpectrum AntiNumuAppComponent()   {return CCComponentRef(-12, -14);}
 
     /// Charged current tau neutrino appearance from electron neutrino (\f$\nu_e\to\nu_\tau\f$)
-    virtual OscillatableSpectrum TauFromEComponent() = 0;
+    [[deprecated("Use CCComponentRef(+12, +16)")]]
+    virtual OscillatableSpectrum TauFromEComponent()      {return CCComponentRef(+12, +16);}
     /// Charged current tau antineutrino appearance from electron antineutrino (\f$\bar\nu_e\to\bar\nu_\tau\f$)
-    virtual OscillatableSpectrum AntiTauFromEComponent() = 0;
+    [[deprecated("Use CCComponentRef(-12, -16)")]]
+    virtual OscillatableSpectrum AntiTauFromEComponent()  {return CCComponentRef(-12, -16);}
 
     /// Charged current tau neutrino appearance from muon neutrino (\f$\nu_\mu\to\nu_\tau\f$)
-    virtual OscillatableSpectrum TauFromMuComponent() = 0;
+    [[deprecated("Use CCComponentRef(+14, +16)")]]
+    virtual OscillatableSpectrum TauFromMuComponent()     {return CCComponentRef(+14, +16);}
     /// Charged current tau antineutrino appearance from muon antineutrino (\f$\bar\nu_\mu\to\bar\nu_\tau\f$)
-    virtual OscillatableSpectrum AntiTauFromMuComponent() = 0;
+    [[deprecated("Use CCComponentRef(-14, -16)")]]
+    virtual OscillatableSpectrum AntiTauFromMuComponent() {return CCComponentRef(-14, -16);}
 
     /// Neutral currents
-    virtual Spectrum NCTotalComponent() = 0;
-    virtual Spectrum NCComponent() = 0;
-    virtual Spectrum NCAntiComponent() = 0;
+    [[deprecated("Use NCTotalComponentRef()")]]
+    virtual Spectrum NCTotalComponent() {return NCTotalComponentRef();}
+    [[deprecated("Use NCComponentRef()")]]
+    virtual Spectrum NCComponent()      {return NCComponentRef();}
+    [[deprecated("Use NCAntiComponentRef()")]]
+    virtual Spectrum NCAntiComponent()  {return NCAntiComponentRef();}
 
     virtual void SaveTo(TDirectory* dir, const std::string& name) const;
   };
@@ -8,6 +8,8 @@
 #include "TObjString.h"
 #include "TDirectory.h"
 
+#include <iostream>
+
 namespace ana
 {
 
@@ -385,44 +387,48 @@ namespace ana
 
   //---------------------------------------------------------------------------
 
-  OscillatableSpectrum ModularExtrap::NueSurvComponent()
-    {return fEEextrap->Return();}
-
-  OscillatableSpectrum ModularExtrap::AntiNueSurvComponent()
-    {return fEEAntiextrap->Return();}
-
-  OscillatableSpectrum ModularExtrap::NumuSurvComponent()
-    {return fMMextrap->Return();}
-
-  OscillatableSpectrum ModularExtrap::AntiNumuSurvComponent()
-    {return fMMAntiextrap->Return();}
-
-  OscillatableSpectrum ModularExtrap::NueAppComponent()
-    {return fMEextrap->Return();}
+  const OscillatableSpectrum& ModularExtrap::CCComponentRef(int from, int to) const
+  {
+    if(from == +12 && to == +12) return fEEextrap->Return();
+    if(from == -12 && to == -12) return fEEAntiextrap->Return();
 
-  OscillatableSpectrum ModularExtrap::AntiNueAppComponent()
-    {return fMEAntiextrap->Return();}
+    if(from == +12 && to == +14) return fEMextrap->Return();
+    if(from == -12 && to == -14) return fEMAntiextrap->Return();
 
-  OscillatableSpectrum ModularExtrap::NumuAppComponent()
-    {return fEMextrap->Return();}
+    if(from == +12 && to == +16) return fETextrap->Return();
+    if(from == -12 && to == -16) return fETAntiextrap->Return();
 
-  OscillatableSpectrum ModularExtrap::AntiNumuAppComponent()
-    {return fEMAntiextrap->Return();}
+    if(from == +14 && to == +12) return fMEextrap->Return();
+    if(from == -14 && to == -12) return fMEAntiextrap->Return();
 
-  Spectrum ModularExtrap::NCComponent()
-    {return fNCextrap->Return().Unoscillated();}
+    if(from == +14 && to == +14) return fMMextrap->Return();
+    if(from == -14 && to == -14) return fMMAntiextrap->Return();
 
-  OscillatableSpectrum ModularExtrap::TauFromMuComponent()
-    {return fMTextrap->Return();}
+    if(from == +14 && to == +16) return fMTextrap->Return();
+    if(from == -14 && to == -16) return fMTAntiextrap->Return();
 
-  OscillatableSpectrum ModularExtrap::AntiTauFromMuComponent()
-    {return fMTAntiextrap->Return();}
+    std::cout << "ModularExtrap: no CC component " << from << " -> " << to << std::endl;
+    abort();
+  }
 
-  OscillatableSpectrum ModularExtrap::TauFromEComponent()
-    {return fETextrap->Return();}
+  //---------------------------------------------------------------------------
+  const Spectrum& ModularExtrap::NCTotalComponentRef() const
+  {
+    // The components are only evaluated on first use, so these are too
+    if(!fNCTotal){
+      fNCTotal = std::make_unique<Spectrum>(fNCextrap->Return().Unoscillated());
+      fNCAnti = std::make_unique<Spectrum>(*fNCTotal);
+      fNCAnti->Clear();
+    }
+    return *fNCTotal;
+  }
 
-  OscillatableSpectrum ModularExtrap::AntiTauFromEComponent()
-    {return fETAntiextrap->Return();}
+  //---------------------------------------------------------------------------
+  const Spectrum& ModularExtrap::NCAntiComponentRef() const
+  {
+    NCTotalComponentRef();
+    return *fNCAnti;
+  }
 
 }
 
@@ -99,19 +99,13 @@ namespace ana
       static std::unique_ptr<ModularExtrap> LoadFrom(TDirectory* dir);
 
       // Override abstract methods.
-      OscillatableSpectrum NueSurvComponent()       override;
-      OscillatableSpectrum AntiNueSurvComponent()   override;
-      OscillatableSpectrum NumuSurvComponent()      override;
-      OscillatableSpectrum AntiNumuSurvComponent()  override;
-      OscillatableSpectrum NueAppComponent()        override;
-      OscillatableSpectrum AntiNueAppComponent()    override;
-      OscillatableSpectrum NumuAppComponent()       override;
-      OscillatableSpectrum AntiNumuAppComponent()   override;
-      OscillatableSpectrum TauFromMuComponent()     override;
-      OscillatableSpectrum AntiTauFromMuComponent() override;
-      OscillatableSpectrum TauFromEComponent()      override;
-      OscillatableSpectrum AntiTauFromEComponent()  override;
-      Spectrum             NCComponent()            override;
+      const OscillatableSpectrum& CCComponentRef(int from, int to) const override;
+
+      /// Neutrinos and antineutrinos aren't separated. All the NC is in
+      /// \ref NCComponentRef, \ref NCAntiComponentRef is empty.
+      const Spectrum& NCTotalComponentRef() const override;
+      const Spectrum& NCComponentRef() const override {return NCTotalComponentRef();}
+      const Spectrum& NCAntiComponentRef() const override;
 
       std::vector<ModularExtrapComponent*> GetModExtrapComponents() const
       {
@@ -155,6 +149,10 @@ namespace ana
       std::unique_ptr<ModularExtrapComponent> fETextrap;
       std::unique_ptr<ModularExtrapComponent> fETAntiextrap;
 
+      /// Made from \ref fNCextrap on first use
+      mutable std::unique_ptr<Spectrum> fNCTotal;
+      mutable std::unique_ptr<Spectrum> fNCAnti;
+
     private:
 
       ModularExtrap(){};
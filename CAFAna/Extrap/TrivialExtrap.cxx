@@ -9,6 +9,8 @@
 #include "TDirectory.h"
 #include "TObjString.h"
 
+#include <iostream>
+
 namespace ana
 {
   REGISTER_LOADFROM("TrivialExtrap", IExtrap, TrivialExtrap);
@@ -98,6 +100,31 @@ namespace ana
   {
   }
 
+  //----------------------------------------------------------------------
+  const OscillatableSpectrum& TrivialExtrap::CCComponentRef(int from, int to) const
+  {
+    if(from == +12 && to == +12) return fNueSurv;
+    if(from == -12 && to == -12) return fNueSurvAnti;
+
+    if(from == +12 && to == +14) return fNumuApp;
+    if(from == -12 && to == -14) return fNumuAppAnti;
+
+    if(from == +12 && to == +16) return fTauFromE;
+    if(from == -12 && to == -16) return fTauFromEAnti;
+
+    if(from == +14 && to == +12) return fNueApp;
+    if(from == -14 && to == -12) return fNueAppAnti;
+
+    if(from == +14 && to == +14) return fNumuSurv;
+    if(from == -14 && to == -14) return fNumuSurvAnti;
+
+    if(from == +14 && to == +16) return fTauFromMu;
+    if(from == -14 && to == -16) return fTauFromMuAnti;
+
+    std::cout << "TrivialExtrap: no CC component " << from << " -> " << to << std::endl;
+    abort();
+  }
+
   //----------------------------------------------------------------------
   void TrivialExtrap::SaveTo(TDirectory* dir, const std::string& name) const
   {
@@ -43,27 +43,11 @@ namespace ana
                   const SystShifts& shift = kNoShift,
                   const Weight& wei = kUnweighted);
 
-    virtual OscillatableSpectrum NueSurvComponent() override       {return fNueSurv;}
-    virtual OscillatableSpectrum AntiNueSurvComponent() override   {return fNueSurvAnti;}
+    virtual const OscillatableSpectrum& CCComponentRef(int from, int to) const override;
 
-    virtual OscillatableSpectrum NumuSurvComponent() override      {return fNumuSurv;}
-    virtual OscillatableSpectrum AntiNumuSurvComponent() override  {return fNumuSurvAnti;}
-
-    virtual OscillatableSpectrum NueAppComponent() override        {return fNueApp;}
-    virtual OscillatableSpectrum AntiNueAppComponent() override    {return fNueAppAnti;}
-
-    virtual OscillatableSpectrum NumuAppComponent() override       {return fNumuApp;}
-    virtual OscillatableSpectrum AntiNumuAppComponent() override   {return fNumuAppAnti;}
-
-    virtual OscillatableSpectrum TauFromEComponent() override      {return fTauFromE;}
-    virtual OscillatableSpectrum AntiTauFromEComponent() override  {return fTauFromEAnti;}
-
-    virtual OscillatableSpectrum TauFromMuComponent() override     {return fTauFromMu;}
-    virtual OscillatableSpectrum AntiTauFromMuComponent() override {return fTauFromMuAnti;}
-
-    virtual Spectrum NCTotalComponent() override {return fNCTot;}
-    virtual Spectrum NCComponent()  override{return fNC;}
-    virtual Spectrum NCAntiComponent()  override {return fNCAnti;}
+    virtual const Spectrum& NCTotalComponentRef() const override {return fNCTot;}
+    virtual const Spectrum& NCComponentRef()      const override {return fNC;}
+    virtual const Spectrum& NCAntiComponentRef()  const override {return fNCAnti;}
 
     virtual void SaveTo(TDirectory* dir, const std::string& name) const override;
 
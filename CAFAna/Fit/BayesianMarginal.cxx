@@ -423,57 +423,75 @@ namespace ana
     //  denom = std::make_unique<TH3D>(*dynamic_cast<TH3D*>(ret.get()));
     denom->SetName(UniqueName().c_str());
 
-    // this could certainly be done less sloppily
-    // but I wanted to ensure we don't do lots of expensive lookups in std::maps
-    // inside the loop over samples, which could run into the millions of iterations
-    union VarOrSyst
-    {
-      const IFitVar * var;
-      const ISyst * syst;
-    };
-    std::vector<bool> isVar(fVars.size() + fSysts.size(), true);
-    std::vector<VarOrSyst> varsOrSysts(fVars.size() + fSysts.size());
+    // work straight from the samples' contiguous columns.
+    // first a pass per axis finding every sample's bin, which vectorizes
+    // for the usual evenly spaced binning, then one to accumulate
+    const std::size_t nSamples = fMCMCSamples->NumSamples();
+    const TAxis * axes[2] = {ret->GetXaxis(), ret->GetYaxis()};
+    std::vector<int> cells(nSamples, 0);
+    int stride = 1;
     for (std::size_t brIdx = 0; brIdx < fOrderedBrNames.size(); brIdx++)
     {
       const auto & brName = fOrderedBrNames[brIdx];
+      const double * vals = nullptr;
       if (auto var = Registry<IFitVar>::ShortNameToPtr(brName, true))
-        varsOrSysts[brIdx].var = var;
+        vals = fMCMCSamples->Column(var);
       else if (auto syst = Registry<ISyst>::ShortNameToPtr(brName, true))
+        vals = fMCMCSamples->Column(syst);
+      assert(vals);
+
+      const TAxis * axis = axes[brIdx];
+      const int nBins = axis->GetNbins();
+      if (!axis->GetXbins()->GetSize())
       {
-        isVar[brIdx] = false;
-        varsOrSysts[brIdx].syst = syst;
+        // same as TAxis::FindFixBin(), including NaN ending up in the overflow
+        const double lo = axis->GetXmin();
+        const double hi = axis->GetXmax();
+        for (std::size_t sample = 0; sample < nSamples; ++sample)
+        {
+          const double x = vals[sample];
+          const int bin = (x < lo) ? 0 : (!(x < hi) ? nBins + 1 : 1 + int(nBins * (x - lo) / (hi - lo)));
+          cells[sample] += stride * bin;
+        }
       }
-    }
-    for (std::size_t sample = 0; sample < fMCMCSamples->NumSamples(); ++sample)
-    {
-      double logprob = fMCMCSamples->SampleLL(sample);
-      if (std::isnan(logprob))
-        std::cerr << "Warning: Encountered NaN log-probability in an MCMC sample.  Other things will probably go wrong..." << std::endl;
-
-      std::map<const IFitVar*, double> varVals;
-      std::map<const ISyst*, double> systVals;
-      fMCMCSamples->SampleValues(sample, fVars, varVals, fSysts, systVals);
-      std::vector<double> vals;
-      for (std::size_t brIdx = 0; brIdx < varsOrSysts.size(); ++brIdx)
-        vals.push_back(
-            isVar[brIdx] ? fMCMCSamples->SampleValue(varsOrSysts[brIdx].var, sample)
-                         : fMCMCSamples->SampleValue(varsOrSysts[brIdx].syst, sample));
-
-      // could template this, but probably not worth the effort?
-      double numWgt = (fMode == MarginalMode::kHistogram) ? 1.0 : logprob;
-      if (bins.size() == 1)
-        ret->Fill(vals[0], numWgt);
-      else if (bins.size() == 2)
+      else
       {
-        dynamic_cast<TH2*>(ret.get())->Fill(vals[0], vals[1], numWgt);
-        dynamic_cast<TH2*>(denom.get())->Fill(vals[0], vals[1]);
+        for (std::size_t sample = 0; sample < nSamples; ++sample)
+          cells[sample] += stride * axis->FindFixBin(vals[sample]);
       }
-      else if (bins.size() == 3)
+      stride *= nBins + 2;
+    }
+
+    const double * LLs = fMCMCSamples->ColumnLL();
+    std::vector<double> numer(ret->GetNcells(), 0);
+    std::vector<double> numerW2(ret->GetNcells(), 0);
+    std::vector<double> counts(ret->GetNcells(), 0);
+    bool warnedNaN = false;
+    for (std::size_t sample = 0; sample < nSamples; ++sample)
+    {
+      const double logprob = LLs[sample];
+      if (std::isnan(logprob) && !warnedNaN)
       {
-        dynamic_cast<TH3*>(ret.get())->Fill(vals[0], vals[1], vals[2], numWgt);
-        dynamic_cast<TH3*>(denom.get())->Fill(vals[0], vals[1], vals[2]);
+        std::cerr << "Warning: Encountered NaN log-probability in an MCMC sample.  Other things will probably go wrong..." << std::endl;
+        warnedNaN = true;
       }
+
+      const double numWgt = (fMode == MarginalMode::kHistogram) ? 1.0 : logprob;
+      numer[cells[sample]] += numWgt;
+      numerW2[cells[sample]] += numWgt * numWgt;
+      counts[cells[sample]] += 1;
+    }
+
+    // the errors too, as weighted Fill()s would have left them
+    for (int cell = 0; cell < ret->GetNcells(); cell++)
+    {
+      ret->SetBinContent(cell, numer[cell]);
+      ret->SetBinError(cell, std::sqrt(numerW2[cell]));
+      denom->SetBinContent(cell, counts[cell]);
+      denom->SetBinError(cell, std::sqrt(counts[cell]));
     }
+    ret->SetEntries(nSamples);
+    denom->SetEntries(nSamples);
 
     // now exponentiate the log-probs to get probabilities
     if (fMode == MarginalMode::kLLWgtdHistogram)
@@ -1,5 +1,9 @@
 #include <iostream>
 #include <functional>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <string>
 
 #include "TCanvas.h"
 #include "TGraph.h"
@@ -25,8 +29,42 @@
 
 #include "OscLib/IOscCalc.h"
 
+#include <memory>
+
 namespace ana
 {
+  /// \brief Length of the stretches of Hilbert curve \ref
+  /// FrequentistSurface::FillSurfaceWarm walks
+  ///
+  /// Fixed, rather than depending on the number of threads, so that which
+  /// bins seed which doesn't either
+  const unsigned int kWarmStretchLength = 32;
+
+  namespace
+  {
+    /// Position \a d along the Hilbert curve filling a \a side x \a side
+    /// square, \a side a power of two
+    void HilbertPoint(int side, long d, int& x, int& y)
+    {
+      x = y = 0;
+      for(int s = 1; s < side; s *= 2){
+        const int rx = 1 & (d/2);
+        const int ry = 1 & (d ^ rx);
+        // Rotate the quadrant
+        if(ry == 0){
+          if(rx == 1){
+            x = s-1-x;
+            y = s-1-y;
+          }
+          std::swap(x, y);
+        }
+        x += s*rx;
+        y += s*ry;
+        d /= 4;
+      }
+    }
+  }
+
   //----------------------------------------------------------------------
   FrequentistSurface::FrequentistSurface(const IExperiment* expt,
                                          osc::IOscCalcAdjustable* calc,
@@ -37,8 +75,9 @@ namespace ana
                                          const SeedList& seedPts,
                                          const std::vector<SystShifts>& systSeedPts,
                                          bool parallel,
-                                         MinuitFitter::FitOpts opts)
-    : fParallel(parallel), fFitOpts(opts)
+                                         MinuitFitter::FitOpts opts,
+                                         const FillOpts& fill)
+    : fParallel(parallel), fFitOpts(opts), fFill(fill)
   {
     CreateHistograms(xvar, nbinsx, xmin, xmax,
                      yvar, nbinsy, ymin, ymax,
@@ -112,6 +151,18 @@ namespace ana
                                        const SeedList& seedPts,
                                        const std::vector<SystShifts> &systSeedPts)
   {
+    if(fFill.coarseStep > 0 &&
+       fHist->GetNbinsX() > 1 && fHist->GetNbinsY() > 1){
+      FillSurfaceAdaptive(expt, calc, xvar, yvar, profVars, profSysts, seedPts, systSeedPts);
+      return;
+    }
+
+    // Nothing to warm-start unless profiling
+    if(fFill.warmStart && (!profVars.empty() || !profSysts.empty())){
+      FillSurfaceWarm(expt, calc, xvar, yvar, profVars, profSysts, seedPts, systSeedPts);
+      return;
+    }
+
     // Nothing created during surface filling belongs in a
     // directory. Unfortunately the local guards in Spectrum etc are racey when
     // run in parallel. But this should cover the whole lot safely.
@@ -155,20 +206,8 @@ namespace ana
       const double xv = fHist->GetXaxis()->GetBinCenter(x);
       const double yv = fHist->GetYaxis()->GetBinCenter(y);
 
-      if (xvar->Penalty(xv, calc) > 1e-10)
-      {
-        std::cerr << "Warning! " << xvar->ShortName() << " = " << xv
-                  << " has penalty of " << xvar->Penalty(xv, calc)
-                  << " that could have been applied in surface. "
-                  << "This should never happen." << std::endl;
-      }
-      if (yvar->Penalty(yv, calc) > 1e-10)
-      {
-        std::cerr << "Warning! " << yvar->ShortName() << " = " << yv
-                  << " has penalty of " << yvar->Penalty(yv, calc)
-                  << " that could have been applied in surface. "
-                  << "This should never happen." << std::endl;
-      }
+      WarnPenalty(xvar, xv, calc);
+      WarnPenalty(yvar, yv, calc);
 
       ThreadPool::func_t task = [=](){
         FillSurfacePoint(expt, calc,
@@ -200,6 +239,306 @@ namespace ana
     }
   }
 
+  //----------------------------------------------------------------------
+  void FrequentistSurface::WarnPenalty(const IFitVar* var, double val,
+                                       osc::IOscCalcAdjustable* calc) const
+  {
+    if (var->Penalty(val, calc) > 1e-10)
+    {
+      std::cerr << "Warning! " << var->ShortName() << " = " << val
+                << " has penalty of " << var->Penalty(val, calc)
+                << " that could have been applied in surface. "
+                << "This should never happen." << std::endl;
+    }
+  }
+
+  //---------------------------------------------------------------------
+  void FrequentistSurface::FillSurfaceAdaptive(const IExperiment* expt,
+                                               osc::IOscCalcAdjustable* calc,
+                                               const IFitVar* xvar, const IFitVar* yvar,
+                                               const std::vector<const IFitVar*>& profVars,
+                                               const std::vector<const ISyst*>& profSysts,
+                                               const SeedList& seedPts,
+                                               const std::vector<SystShifts>& systSeedPts)
+  {
+    // See FillSurface()
+    DontAddDirectory guard;
+
+    const std::string progTitle = ProgressBarTitle(xvar, yvar, profVars, profSysts);
+
+    // Lazy initialization before going parallel, as in FillSurface()
+    if(fParallel) expt->ChiSq(calc);
+
+    const int Nx = fHist->GetNbinsX();
+    const int Ny = fHist->GetNbinsY();
+    const int step = fFill.coarseStep;
+
+    // Everything below works in zero-based bin indices, bin = y*Nx+x
+    std::vector<bool> done(Nx*Ny, false);
+    std::vector<double> chis(Nx*Ny);
+    std::vector<std::vector<double>> profs(Nx*Ny);
+
+    // Rectangles of bins whose corners have all been (or are about to be)
+    // fitted. Always at least one bin wide in each direction
+    struct Cell{int x0, x1, y0, y1;};
+
+    std::vector<int> xs, ys;
+    for(int x = 0; x < Nx-1; x += step) xs.push_back(x);
+    xs.push_back(Nx-1);
+    for(int y = 0; y < Ny-1; y += step) ys.push_back(y);
+    ys.push_back(Ny-1);
+
+    std::vector<Cell> cells;
+    for(unsigned int i = 0; i+1 < xs.size(); ++i)
+      for(unsigned int j = 0; j+1 < ys.size(); ++j)
+        cells.push_back({xs[i], xs[i+1], ys[j], ys[j+1]});
+
+    // Points to fit in the next pass, and the bin to seed each from (or -1)
+    std::vector<std::pair<int, int>> todo;
+    for(int x: xs){
+      for(int y: ys){
+        todo.emplace_back(y*Nx+x, -1);
+        done[y*Nx+x] = true;
+      }
+    }
+
+    // Cells that will not be refined further, coarsest first
+    std::vector<Cell> leaves;
+
+    int nfit = 0;
+    for(int pass = 0; ; ++pass){
+      if(!todo.empty()){
+        const std::string title = progTitle+" (pass "+std::to_string(pass)+", "+
+          std::to_string(todo.size())+" points)";
+
+        auto task = [&](int bin, int seedBin){
+          const double xv = fHist->GetXaxis()->GetBinCenter(bin%Nx+1);
+          const double yv = fHist->GetYaxis()->GetBinCenter(bin/Nx+1);
+          WarnPenalty(xvar, xv, calc);
+          WarnPenalty(yvar, yv, calc);
+          chis[bin] = FitSurfacePoint(expt, calc, xvar, xv, yvar, yv,
+                                      profVars, profSysts, seedPts, systSeedPts,
+                                      seedBin >= 0 ? profs[seedBin] : std::vector<double>(),
+                                      profs[bin]);
+        };
+
+        if(fParallel){
+          ThreadPool pool;
+          pool.ShowProgress(title);
+          for(const std::pair<int, int>& pt: todo){
+            pool.AddTask([&task, pt](){task(pt.first, pt.second);});
+          }
+          pool.Finish();
+        }
+        else{
+          Progress prog(title);
+          for(unsigned int i = 0; i < todo.size(); ++i){
+            task(todo[i].first, todo[i].second);
+            prog.SetProgress((i+1)/double(todo.size()));
+          }
+          prog.Done();
+        }
+
+        nfit += todo.size();
+        todo.clear();
+      }
+
+      if(cells.empty()) break;
+
+      // Levels are relative to the best point so far
+      double minchi = std::numeric_limits<double>::infinity();
+      for(int bin = 0; bin < Nx*Ny; ++bin) if(done[bin]) minchi = std::min(minchi, chis[bin]);
+
+      std::vector<Cell> next;
+      for(const Cell& c: cells){
+        const int corners[4] = {c.y0*Nx+c.x0, c.y0*Nx+c.x1, c.y1*Nx+c.x0, c.y1*Nx+c.x1};
+
+        double lo = chis[corners[0]], hi = chis[corners[0]];
+        for(int bin: corners){
+          lo = std::min(lo, chis[bin]);
+          hi = std::max(hi, chis[bin]);
+        }
+
+        bool straddle = false;
+        for(double level: fFill.levels){
+          if(lo-minchi < level && hi-minchi >= level) straddle = true;
+        }
+
+        if(!straddle || (c.x1-c.x0 < 2 && c.y1-c.y0 < 2)){
+          leaves.push_back(c);
+          continue;
+        }
+
+        // Split in half along any direction more than one bin wide
+        std::vector<int> cx = {c.x0}, cy = {c.y0};
+        if(c.x1-c.x0 >= 2) cx.push_back((c.x0+c.x1)/2);
+        if(c.y1-c.y0 >= 2) cy.push_back((c.y0+c.y1)/2);
+        cx.push_back(c.x1);
+        cy.push_back(c.y1);
+
+        for(unsigned int i = 0; i+1 < cx.size(); ++i)
+          for(unsigned int j = 0; j+1 < cy.size(); ++j)
+            next.push_back({cx[i], cx[i+1], cy[j], cy[j+1]});
+
+        for(int x: cx){
+          for(int y: cy){
+            const int bin = y*Nx+x;
+            if(done[bin]) continue;
+            done[bin] = true;
+
+            // Nearest corner, preferring the better fit
+            int seedBin = corners[0];
+            int seedDist = Nx+Ny;
+            for(int corner: corners){
+              const int dist = std::abs(corner%Nx-x) + std::abs(corner/Nx-y);
+              if(dist < seedDist || (dist == seedDist && chis[corner] < chis[seedBin])){
+                seedBin = corner;
+                seedDist = dist;
+              }
+            }
+            todo.emplace_back(bin, seedBin);
+          }
+        }
+      } // end for c
+
+      cells.swap(next);
+    } // end for pass
+
+    std::cout << "FrequentistSurface: adaptive filling fit " << nfit
+              << " of " << Nx*Ny << " points" << std::endl;
+
+    for(int bin = 0; bin < Nx*Ny; ++bin){
+      if(!done[bin]) continue;
+      fHist->SetBinContent(bin%Nx+1, bin/Nx+1, chis[bin]);
+      for(unsigned int k = 0; k < profs[bin].size(); ++k)
+        fProfHists[k]->SetBinContent(bin%Nx+1, bin/Nx+1, profs[bin][k]);
+    }
+
+    // Bilinear interpolation within each leaf cell. Finer cells come later,
+    // and so win on any shared edges
+    for(const Cell& c: leaves){
+      const int c00 = c.y0*Nx+c.x0, c10 = c.y0*Nx+c.x1;
+      const int c01 = c.y1*Nx+c.x0, c11 = c.y1*Nx+c.x1;
+
+      for(int x = c.x0; x <= c.x1; ++x){
+        for(int y = c.y0; y <= c.y1; ++y){
+          if(done[y*Nx+x]) continue;
+
+          const double tx = (x-c.x0)/double(c.x1-c.x0);
+          const double ty = (y-c.y0)/double(c.y1-c.y0);
+          const double w00 = (1-tx)*(1-ty), w10 = tx*(1-ty);
+          const double w01 = (1-tx)*ty,     w11 = tx*ty;
+
+          fHist->SetBinContent(x+1, y+1, w00*chis[c00] + w10*chis[c10] +
+                                         w01*chis[c01] + w11*chis[c11]);
+
+          for(unsigned int k = 0; k < fProfHists.size(); ++k){
+            fProfHists[k]->SetBinContent(x+1, y+1,
+                                         w00*profs[c00][k] + w10*profs[c10][k] +
+                                         w01*profs[c01][k] + w11*profs[c11][k]);
+          }
+        }
+      }
+    } // end for c
+  }
+
+  //---------------------------------------------------------------------
+  void FrequentistSurface::FillSurfaceWarm(const IExperiment* expt,
+                                           osc::IOscCalcAdjustable* calc,
+                                           const IFitVar* xvar, const IFitVar* yvar,
+                                           const std::vector<const IFitVar*>& profVars,
+                                           const std::vector<const ISyst*>& profSysts,
+                                           const SeedList& seedPts,
+                                           const std::vector<SystShifts>& systSeedPts)
+  {
+    // See FillSurface()
+    DontAddDirectory guard;
+
+    const std::string progTitle = ProgressBarTitle(xvar, yvar, profVars, profSysts);
+
+    // Lazy initialization before going parallel, as in FillSurface()
+    if(fParallel) expt->ChiSq(calc);
+
+    const int Nx = fHist->GetNbinsX();
+    const int Ny = fHist->GetNbinsY();
+
+    // Zero-based bins, bin = y*Nx+x, in order along a Hilbert curve covering
+    // the grid. Consecutive points are (almost always) neighbours
+    int side = 1;
+    while(side < Nx || side < Ny) side *= 2;
+    std::vector<int> order;
+    order.reserve(Nx*Ny);
+    for(long d = 0; d < long(side)*side; ++d){
+      int x, y;
+      HilbertPoint(side, d, x, y);
+      if(x < Nx && y < Ny) order.push_back(y*Nx+x);
+    }
+
+    // Where each bin falls along the curve
+    std::vector<unsigned int> pos(Nx*Ny);
+    for(unsigned int i = 0; i < order.size(); ++i) pos[order[i]] = i;
+
+    std::vector<double> chis(Nx*Ny);
+    std::vector<std::vector<double>> profs(Nx*Ny);
+
+    // Fit one stretch of the curve, in order
+    auto walk = [&](unsigned int first, unsigned int last, Progress* prog){
+      for(unsigned int i = first; i < last; ++i){
+        const int bin = order[i];
+        const int x = bin%Nx;
+        const int y = bin/Nx;
+
+        // Seed from the best neighbour fitted earlier in this stretch. Those
+        // from other stretches might or might not be done yet, depending on
+        // the threads, so aren't used
+        int seedBin = -1;
+        for(int nx = std::max(x-1, 0); nx <= std::min(x+1, Nx-1); ++nx){
+          for(int ny = std::max(y-1, 0); ny <= std::min(y+1, Ny-1); ++ny){
+            const int nb = ny*Nx+nx;
+            if(pos[nb] < first || pos[nb] >= i) continue;
+            if(seedBin < 0 || chis[nb] < chis[seedBin]) seedBin = nb;
+          }
+        }
+
+        const double xv = fHist->GetXaxis()->GetBinCenter(x+1);
+        const double yv = fHist->GetYaxis()->GetBinCenter(y+1);
+        WarnPenalty(xvar, xv, calc);
+        WarnPenalty(yvar, yv, calc);
+
+        chis[bin] = FitSurfacePoint(expt, calc, xvar, xv, yvar, yv,
+                                    profVars, profSysts, seedPts, systSeedPts,
+                                    seedBin >= 0 ? profs[seedBin] : std::vector<double>(),
+                                    profs[bin]);
+
+        if(prog) prog->SetProgress((i+1)/double(order.size()));
+      }
+    };
+
+    // The first point of each stretch starts cold. The same stretches serial
+    // or parallel, so the result doesn't depend on which
+    if(fParallel){
+      ThreadPool pool;
+      pool.ShowProgress(progTitle);
+      for(unsigned int first = 0; first < order.size(); first += kWarmStretchLength){
+        const unsigned int last = std::min<unsigned int>(order.size(), first+kWarmStretchLength);
+        pool.AddTask([&walk, first, last](){walk(first, last, 0);});
+      }
+      pool.Finish();
+    }
+    else{
+      Progress prog(progTitle);
+      for(unsigned int first = 0; first < order.size(); first += kWarmStretchLength)
+        walk(first, std::min<unsigned int>(order.size(), first+kWarmStretchLength), &prog);
+      prog.Done();
+    }
+
+    for(int bin = 0; bin < Nx*Ny; ++bin){
+      fHist->SetBinContent(bin%Nx+1, bin/Nx+1, chis[bin]);
+      for(unsigned int k = 0; k < profs[bin].size(); ++k)
+        fProfHists[k]->SetBinContent(bin%Nx+1, bin/Nx+1, profs[bin][k]);
+    }
+  }
+
   //----------------------------------------------------------------------
   double FrequentistSurface::FillSurfacePoint(const IExperiment* expt,
                                               osc::IOscCalcAdjustable* calc,
@@ -209,6 +548,30 @@ namespace ana
                                               const std::vector<const ISyst*>& profSysts,
                                               const SeedList& seedPts,
                                               const std::vector<SystShifts>& systSeedPts)
+  {
+    std::vector<double> prof;
+    const double chi = FitSurfacePoint(expt, calc, xvar, x, yvar, y,
+                                       profVars, profSysts, seedPts, systSeedPts,
+                                       {}, prof);
+
+    for(unsigned int i = 0; i < prof.size(); ++i) fProfHists[i]->Fill(x, y, prof[i]);
+
+    fHist->Fill(x, y, chi);
+
+    return chi;
+  }
+
+  //----------------------------------------------------------------------
+  double FrequentistSurface::FitSurfacePoint(const IExperiment* expt,
+                                             osc::IOscCalcAdjustable* calc,
+                                             const IFitVar* xvar, double x,
+                                             const IFitVar* yvar, double y,
+                                             const std::vector<const IFitVar*>& profVars,
+                                             const std::vector<const ISyst*>& profSysts,
+                                             const SeedList& seedPts,
+                                             const std::vector<SystShifts>& systSeedPts,
+                                             const std::vector<double>& neighbour,
+                                             std::vector<double>& prof)
   {
     if(fParallel){
       // Need to take our own copy so that we don't get overwritten by someone
@@ -220,7 +583,11 @@ namespace ana
     yvar->SetValue(calc, y);
 
     //Make sure that the profiled values of fitvars do not persist between steps.
-    for(int i = 0; i < (int)fSeedValues.size(); ++i) profVars[i]->SetValue( calc, fSeedValues[i] );
+    for(int i = 0; i < (int)fSeedValues.size(); ++i){
+      profVars[i]->SetValue(calc, neighbour.empty() ? fSeedValues[i] : neighbour[i]);
+    }
+
+    prof.clear();
 
     double chi;
     if(profVars.empty() && profSysts.empty()){
@@ -229,19 +596,49 @@ namespace ana
     else{
       MinuitFitter fitter(expt, profVars, profSysts);
       fitter.SetFitOpts(fFitOpts);
+
+      // The neighbour's systs replace whichever requested seed is nearest
+      // them, since they're presumably a refinement of it. Or the nominal,
+      // which is what the fitter starts from without any. Either way the
+      // number of fits stays the same.
+      std::vector<SystShifts> systSeeds;
+      if(!neighbour.empty() && !profSysts.empty()){
+        SystShifts seed;
+        for(unsigned int j = 0; j < profSysts.size(); ++j)
+          seed.SetShift(profSysts[j], neighbour[profVars.size()+j]);
+
+        systSeeds = systSeedPts;
+        if(systSeeds.empty()){
+          systSeeds.push_back(seed);
+        }
+        else{
+          unsigned int nearest = 0;
+          double bestDist = std::numeric_limits<double>::infinity();
+          for(unsigned int k = 0; k < systSeeds.size(); ++k){
+            double dist = 0;
+            for(unsigned int j = 0; j < profSysts.size(); ++j){
+              const double d = systSeeds[k].GetShift(profSysts[j]) - seed.GetShift(profSysts[j]);
+              dist += d*d;
+            }
+            if(dist < bestDist){bestDist = dist; nearest = k;}
+          }
+          systSeeds[nearest] = seed;
+        }
+      }
+
       SystShifts bestSysts;
-      chi = fitter.Fit(calc, bestSysts, seedPts, systSeedPts, MinuitFitter::kQuiet)->EvalMetricVal();
+      chi = fitter.Fit(calc, bestSysts, seedPts,
+                       systSeeds.empty() ? systSeedPts : systSeeds,
+                       MinuitFitter::kQuiet)->EvalMetricVal();
 
       for(unsigned int i = 0; i < profVars.size(); ++i){
-        fProfHists[i]->Fill(x, y, profVars[i]->GetValue(calc));
+        prof.push_back(profVars[i]->GetValue(calc));
       }
       for(unsigned int j = 0; j < profSysts.size(); ++j){
-        fProfHists[j+profVars.size()]->Fill(x, y, bestSysts.GetShift(profSysts[j]));
+        prof.push_back(bestSysts.GetShift(profSysts[j]));
       }
     }
 
-    fHist->Fill(x, y, chi);
-
     if(fParallel) delete calc;
 
     return chi;
@@ -12,6 +12,7 @@
 
 #include <iostream>
 #include <map>
+#include <vector>
 
 class TGraph;
 class TH2;
@@ -29,6 +30,33 @@ namespace ana
       friend class NumuSurface;
       friend class NueSurface;
 
+      /// \brief How to go about filling the surface
+      ///
+      /// With \a coarseStep set, start from every \a coarseStep'th bin, then
+      /// repeatedly subdivide only those cells whose corners straddle one of
+      /// \a levels (in \f$ \Delta\chi^2 \f$ from the lowest point found so
+      /// far), down to single bins. New points are seeded from the profiled
+      /// values of the nearest corner. Bins never fitted are bilinearly
+      /// interpolated. A contour closing entirely inside one coarse cell will
+      /// be missed.
+      ///
+      /// Otherwise every bin is fitted. With \a warmStart, in fixed stretches
+      /// of a Hilbert curve, each seeded from the profiled values of the best
+      /// neighbouring bin fitted earlier in the same stretch. Those values
+      /// replace the nearest of the syst seeds. The result doesn't depend on
+      /// the number of threads or their timing.
+      struct FillOpts
+      {
+        /// Defaults to 1, 2 and 3 sigma in 2D
+        explicit FillOpts(int step = 0, bool warm = false)
+          : coarseStep(step), levels({2.30, 6.18, 11.83}), warmStart(warm) {}
+
+        /// Zero fits every bin
+        int coarseStep;
+        std::vector<double> levels;
+        bool warmStart;
+      };
+
       /// \param expt The experiment object to draw \f$ \chi^2 \f$ values from
       /// \param calc Values for oscillation parameters to be held fixed
       /// \param xvar Oscillation parameter to place on the x axis
@@ -43,6 +71,8 @@ namespace ana
       /// \param seedPts Try all combinations of these params as seeds
       /// \param systSeedPts Try all of these systematic combinations as seeds
       /// \param parallel Use all the cores on this machine? Be careful...
+      /// \param opts Fitter options for the profiling fits
+      /// \param fill Fill adaptively, or with warm starts, see \ref FillOpts
       FrequentistSurface(const IExperiment* expt,
               osc::IOscCalcAdjustable* calc,
               const IFitVar* xvar, int nbinsx, double xmin, double xmax,
@@ -52,7 +82,8 @@ namespace ana
               const SeedList& seedPts = SeedList(),
               const std::vector<SystShifts>& systSeedPts = {},
               bool parallel = false,
-              MinuitFitter::FitOpts opts = MinuitFitter::kNormal);
+              MinuitFitter::FitOpts opts = MinuitFitter::kNormal,
+              const FillOpts& fill = FillOpts());
 
         virtual ~FrequentistSurface();
 
@@ -82,6 +113,22 @@ namespace ana
                                const SeedList& seedPts,
                                const std::vector<SystShifts>& systSeedPts);
 
+      void FillSurfaceAdaptive(const IExperiment* expt,
+                               osc::IOscCalcAdjustable* calc,
+                               const IFitVar* xvar, const IFitVar* yvar,
+                               const std::vector<const IFitVar*>& profVars,
+                               const std::vector<const ISyst*>& profSysts,
+                               const SeedList& seedPts,
+                               const std::vector<SystShifts>& systSeedPts);
+
+      void FillSurfaceWarm(const IExperiment* expt,
+                           osc::IOscCalcAdjustable* calc,
+                           const IFitVar* xvar, const IFitVar* yvar,
+                           const std::vector<const IFitVar*>& profVars,
+                           const std::vector<const ISyst*>& profSysts,
+                           const SeedList& seedPts,
+                           const std::vector<SystShifts>& systSeedPts);
+
       double FillSurfacePoint(const IExperiment* expt,
                               osc::IOscCalcAdjustable* calc,
                               const IFitVar* xvar, double x,
@@ -91,6 +138,26 @@ namespace ana
                               const SeedList& seedPts,
                               const std::vector<SystShifts>& systSeedPts);
 
+      /// \brief Profiled \f$ \chi^2 \f$ at one point, without touching the
+      /// histograms
+      ///
+      /// \param neighbour Profiled values (vars then systs) to seed from
+      ///                  instead of \ref fSeedValues. Empty for none
+      /// \param[out] prof The profiled values found
+      double FitSurfacePoint(const IExperiment* expt,
+                             osc::IOscCalcAdjustable* calc,
+                             const IFitVar* xvar, double x,
+                             const IFitVar* yvar, double y,
+                             const std::vector<const IFitVar*>& profVars,
+                             const std::vector<const ISyst*>& profSysts,
+                             const SeedList& seedPts,
+                             const std::vector<SystShifts>& systSeedPts,
+                             const std::vector<double>& neighbour,
+                             std::vector<double>& prof);
+
+      void WarnPenalty(const IFitVar* var, double val,
+                       osc::IOscCalcAdjustable* calc) const;
+
       void FindMinimum(const IExperiment* expt,
                        osc::IOscCalcAdjustable* calc,
                        const IFitVar* xvar, const IFitVar* yvar,
@@ -103,6 +170,8 @@ namespace ana
 
       MinuitFitter::FitOpts fFitOpts;
 
+      FillOpts fFill;
+
       // Best fit point
       std::vector<TH2*> fProfHists;
   };
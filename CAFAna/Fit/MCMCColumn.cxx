@@ -0,0 +1,69 @@
+#include "CAFAna/Fit/MCMCColumn.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace ana
+{
+  //----------------------------------------------------------------------
+  std::size_t MCMCColumn::MmapThreshold()
+  {
+    static const std::size_t threshold = []()
+    {
+      std::size_t mb = 256;
+      if (const char* env = getenv("CAFANA_MCMC_MMAP_MB"))
+        mb = std::stoul(env);
+      return mb << 20;
+    }();
+    return threshold;
+  }
+
+  //----------------------------------------------------------------------
+  MCMCColumn::MCMCColumn(std::size_t n, const std::string& mapDir)
+    : fData(nullptr), fSize(n), fMapped(false)
+  {
+    const std::size_t bytes = n * sizeof(double);
+    if (!mapDir.empty() && bytes > 0 && bytes > MmapThreshold())
+    {
+      std::string path = mapDir + "/cafana_mcmc_XXXXXX";
+
+      // The file goes away as soon as it's unmapped, however the job ends
+      const int fd = mkstemp(&path[0]);
+      if (fd >= 0)
+      {
+        unlink(path.c_str());
+        if (ftruncate(fd, bytes) == 0)
+        {
+          void* addr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+          if (addr != MAP_FAILED)
+          {
+            fData = static_cast<double*>(addr);
+            fMapped = true;
+          }
+        }
+        close(fd);
+      }
+
+      if (!fMapped)
+        std::cerr << "MCMCColumn: couldn't map a temporary file in " << path
+                  << " for " << bytes << " bytes, keeping them in memory instead" << std::endl;
+    }
+
+    if (!fMapped)
+    {
+      fHeap.resize(n);
+      fData = fHeap.data();
+    }
+  }
+
+  //----------------------------------------------------------------------
+  MCMCColumn::~MCMCColumn()
+  {
+    if (fMapped)
+      munmap(fData, fSize * sizeof(double));
+  }
+}
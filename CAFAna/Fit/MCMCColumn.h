@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace ana
+{
+  /// \brief Contiguous values of one branch of an MCMCSamples, for fast
+  /// sequential passes over millions of samples.
+  ///
+  /// Columns live on the heap unless given a directory to map them from.
+  /// Then those larger than \ref MmapThreshold() are put in an (already
+  /// deleted) temporary file there, mapped into memory, so that the kernel can
+  /// page them out rather than the job running out of memory.
+  class MCMCColumn
+  {
+    public:
+      /// Room for \a n values, uninitialized. Large columns are mapped from
+      /// a file in \a mapDir, if not empty
+      explicit MCMCColumn(std::size_t n, const std::string& mapDir = "");
+      ~MCMCColumn();
+
+      MCMCColumn(const MCMCColumn&) = delete;
+      MCMCColumn& operator=(const MCMCColumn&) = delete;
+
+      double* Data() { return fData; }
+      const double* Data() const { return fData; }
+      std::size_t Size() const { return fSize; }
+
+      /// Is this column backed by a temporary file?
+      bool IsMapped() const { return fMapped; }
+
+      /// Size in bytes beyond which columns are mapped.
+      /// $CAFANA_MCMC_MMAP_MB, default 256
+      static std::size_t MmapThreshold();
+
+    private:
+      double* fData;
+      std::size_t fSize;
+      bool fMapped;
+      std::vector<double> fHeap;
+  };
+}
@@ -1,3 +1,7 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
 #include <limits>
 #include <string>
 #include <vector>
@@ -35,6 +39,111 @@ namespace
     private:
       TTree * fTree;
   };
+
+  /// Split R-hat of \a chains, each \a n long.  As
+  /// stan::analyze::compute_potential_scale_reduction(), but with the caller doing the splitting
+  double SplitRHat(const std::vector<const double*> & chains, std::size_t n)
+  {
+    const std::size_t M = chains.size();
+
+    std::vector<double> means(M, 0), vars(M, 0);
+    for (std::size_t m = 0; m < M; m++)
+    {
+      for (std::size_t i = 0; i < n; i++)
+        means[m] += chains[m][i] / n;
+      for (std::size_t i = 0; i < n; i++)
+        vars[m] += util::sqr(chains[m][i] - means[m]) / (n - 1);
+    }
+
+    double meanOfMeans = 0, varWithin = 0;
+    for (std::size_t m = 0; m < M; m++)
+    {
+      meanOfMeans += means[m] / M;
+      varWithin += vars[m] / M;
+    }
+    double varBetween = 0;
+    for (std::size_t m = 0; m < M; m++)
+      varBetween += n * util::sqr(means[m] - meanOfMeans) / (M - 1);
+
+    return std::sqrt((varBetween / varWithin + n - 1) / n);
+  }
+
+  /// Effective sample size of \a chains, each \a n long, using Geyer's
+  /// initial monotone sequence.  As stan::analyze::compute_effective_sample_size()
+  double EffectiveSampleSize(const std::vector<const double*> & chains, std::size_t n)
+  {
+    const std::size_t M = chains.size();
+
+    std::vector<double> means(M, 0);
+    for (std::size_t m = 0; m < M; m++)
+      for (std::size_t i = 0; i < n; i++)
+        means[m] += chains[m][i] / n;
+
+    // Only as many lags as the sequence needs, so computed directly as we go
+    auto meanAutocov = [&](std::size_t t)
+    {
+      double ret = 0;
+      for (std::size_t m = 0; m < M; m++)
+      {
+        double acov = 0;
+        for (std::size_t i = 0; i + t < n; i++)
+          acov += (chains[m][i] - means[m]) * (chains[m][i + t] - means[m]);
+        ret += acov / n / M;
+      }
+      return ret;
+    };
+
+    const double meanVar = meanAutocov(0) * n / (n - 1);
+    double varPlus = meanVar * (n - 1) / n;
+    if (M > 1)
+    {
+      double meanOfMeans = 0;
+      for (double mean : means)
+        meanOfMeans += mean / M;
+      for (double mean : means)
+        varPlus += util::sqr(mean - meanOfMeans) / (M - 1);
+    }
+
+    std::vector<double> rho(n, 0);
+    double rhoEven = 1;
+    double rhoOdd = 1 - (meanVar - meanAutocov(1)) / varPlus;
+    rho[0] = rhoEven;
+    rho[1] = rhoOdd;
+
+    std::size_t t = 1;
+    while (t < n - 4 && rhoEven + rhoOdd > 0)
+    {
+      rhoEven = 1 - (meanVar - meanAutocov(t + 1)) / varPlus;
+      rhoOdd = 1 - (meanVar - meanAutocov(t + 2)) / varPlus;
+      if (rhoEven + rhoOdd >= 0)
+      {
+        rho[t + 1] = rhoEven;
+        rho[t + 2] = rhoOdd;
+      }
+      t += 2;
+    }
+    const std::size_t maxT = t;
+    if (rhoEven > 0)
+      rho[maxT + 1] = rhoEven;
+
+    // initial positive sequence -> initial monotone sequence
+    for (std::size_t t = 1; t + 3 <= maxT; t += 2)
+    {
+      if (rho[t + 1] + rho[t + 2] > rho[t - 1] + rho[t])
+      {
+        rho[t + 1] = (rho[t - 1] + rho[t]) / 2;
+        rho[t + 2] = rho[t + 1];
+      }
+    }
+
+    const double numDraws = M * n;
+    double tau = -1 + rho[maxT + 1];
+    for (std::size_t t = 0; t < maxT; t++)
+      tau += 2 * rho[t];
+    tau = std::max(tau, 1 / std::log10(numDraws));
+
+    return numDraws / tau;
+  }
 }
 
 namespace ana
@@ -48,13 +157,15 @@ namespace ana
       fVars(vars),
       fSysts(systs),
       fBestFitFound(false),
-      fSamples(std::make_unique<TTree>("samples", "MCMC samples"))
+      fSamples(std::make_unique<TTree>("samples", "MCMC samples")),
+      fNumChains(1)
   {}
 
   //----------------------------------------------------------------------
   MCMCSamples::MCMCSamples(std::size_t offset, const std::vector<std::string> &diagBranchNames,
                            const std::vector<const IFitVar *> &vars, const std::vector<const ana::ISyst *> &systs,
-                           std::unique_ptr<TTree> &tree, const Hyperparameters &hyperParams, double samplingTime)
+                           std::unique_ptr<TTree> &tree, const Hyperparameters &hyperParams, double samplingTime,
+                           unsigned int numChains)
     : fOffset(offset),
       fDiagBranches(diagBranchNames),
       fVars(vars),
@@ -62,7 +173,8 @@ namespace ana
       fBestFitFound(false),
       fSamples(std::move(tree)),
       fHyperparams(hyperParams),
-      fSamplingTime(samplingTime)
+      fSamplingTime(samplingTime),
+      fNumChains(numChains)
   {
     // note: SetupTree() takes care of fDiagnosticVals and fEntryVals
     SetupTree();
@@ -81,7 +193,10 @@ namespace ana
         fEntryVals(std::move(other.fEntryVals)),
         fDiagnosticVals(std::move(other.fDiagnosticVals)),
         fHyperparams(std::move(other.fHyperparams)),
-        fSamplingTime(std::move(other.fSamplingTime))
+        fSamplingTime(std::move(other.fSamplingTime)),
+        fNumChains(other.fNumChains),
+        fColumns(std::move(other.fColumns)),
+        fColumnMapDir(std::move(other.fColumnMapDir))
   {
     // note: SetupTree() takes care of fDiagnosticVals and fEntryVals
     SetupTree();
@@ -111,6 +226,9 @@ namespace ana
 
     fHyperparams = std::move(other.fHyperparams);
     fSamplingTime = std::move(other.fSamplingTime);
+    fNumChains = other.fNumChains;
+    fColumns = std::move(other.fColumns);
+    fColumnMapDir = std::move(other.fColumnMapDir);
 
     // note: SetupTree() takes care of fDiagnosticVals and fEntryVals
     SetupTree();
@@ -139,12 +257,16 @@ namespace ana
       fEntryVals[targetIdx] = sample[sourceIdx];
     }
     fSamples->Fill();
+    fColumns.clear();
 //    fSamples->Scan("*");
   }
 
   //----------------------------------------------------------------------
   void MCMCSamples::AdoptSamples(MCMCSamples && other)
   {
+    fColumns.clear();
+    other.fColumns.clear();
+
     // if we don't have any samples at all, then just swap
     if (!fSamples || (fDiagBranches.size() + fVars.size() + fSysts.size()) == 0)
     {
@@ -152,6 +274,7 @@ namespace ana
       this->fDiagBranches = other.fDiagBranches;
       this->fVars = other.fVars;
       this->fSysts = other.fSysts;
+      this->fNumChains = other.fNumChains;
       //SetupTree();
 
       // make sure we extract this guy out of his old directory, if any,
@@ -185,6 +308,8 @@ namespace ana
     otherTreeList.Clear();
     other.fSamples.reset(nullptr);
 
+    fNumChains += other.fNumChains;
+
     // clear the rest of the other MCMCSamples so it isn't left in an intermediate state
     other.fDiagBranches.clear();
     other.fVars.clear();
@@ -195,6 +320,7 @@ namespace ana
     other.fEntryLL = 0;
     other.fDiagnosticVals.clear();
     other.fEntryVals.clear();
+    other.fNumChains = 1;
 
     // finally, the best fit point isn't necessarily the same any more, so force recalculation the next time it's needed
     fBestFitFound = false;
@@ -207,21 +333,56 @@ namespace ana
       return fBestFitSampleIdx;
 
     double maxLL = -std::numeric_limits<double>::infinity();
-    auto branch = fSamples->GetBranch(MCMCSamples::LOGLIKELIHOOD_BRANCH_NAME.c_str());
-    branch->SetStatus(true);
-    for (int idx = 0; idx < fSamples->GetEntries(); idx++)
+    const double * LLs = ColumnLL();
+    for (std::size_t idx = 0; idx < NumSamples(); idx++)
     {
-      branch->GetEntry(idx);
-      if (fEntryLL > maxLL)
+      if (LLs[idx] > maxLL)
       {
         fBestFitSampleIdx = idx;
-        maxLL = fEntryLL;
+        maxLL = LLs[idx];
         fBestFitFound = true;
       }
     }
     return fBestFitSampleIdx;
   }
 
+  //----------------------------------------------------------------------
+  const std::vector<std::unique_ptr<MCMCColumn>> & MCMCSamples::Columns() const
+  {
+    if (!fColumns.empty())
+      return fColumns;
+
+    BranchStatusResetter bsr(fSamples.get());  // turn branches off when done
+
+    // one pass over the tree, reading only what we need
+    fSamples->SetBranchStatus("*", false);
+    fSamples->SetBranchStatus(MCMCSamples::LOGLIKELIHOOD_BRANCH_NAME.c_str(), true);
+    for (const auto & var : fVars)
+      fSamples->SetBranchStatus(var->ShortName().c_str(), true);
+    for (const auto & syst : fSysts)
+      fSamples->SetBranchStatus(syst->ShortName().c_str(), true);
+
+    std::string mapDir = fColumnMapDir;
+    if (const char* env = getenv("CAFANA_MCMC_MMAP_DIR"))
+      mapDir = env;
+
+    const std::size_t n = NumSamples();
+    std::vector<std::unique_ptr<MCMCColumn>> columns;
+    for (std::size_t col = 0; col < 1 + fEntryVals.size(); col++)
+      columns.push_back(std::make_unique<MCMCColumn>(n, mapDir));
+
+    for (std::size_t idx = 0; idx < n; idx++)
+    {
+      fSamples->GetEntry(idx);
+      columns[0]->Data()[idx] = fEntryLL;
+      for (std::size_t valIdx = 0; valIdx < fEntryVals.size(); valIdx++)
+        columns[1 + valIdx]->Data()[idx] = fEntryVals[valIdx];
+    }
+
+    fColumns = std::move(columns);
+    return fColumns;
+  }
+
   //----------------------------------------------------------------------
   std::size_t MCMCSamples::DiagOffset(const std::string &diagName) const
   {
@@ -303,6 +464,11 @@ namespace ana
     if (auto key = samplingTimeDir->FindKey("samplingTime"))
       samplingTime = key->ReadObject<TParameter<double>>()->GetVal();
 
+    // ditto
+    unsigned int numChains = 1;
+    if (auto key = dir->FindKey("numChains"))
+      numChains = key->ReadObject<TParameter<int>>()->GetVal();
+
     delete dir;
 
     return std::unique_ptr<MCMCSamples>(new MCMCSamples(offset->GetVal(),
@@ -311,7 +477,8 @@ namespace ana
                                                         systs,
                                                         samples,
                                                         hyperparams,
-                                                        samplingTime));
+                                                        samplingTime,
+                                                        numChains));
   }
 
   //----------------------------------------------------------------------
@@ -372,12 +539,11 @@ namespace ana
     static_assert(std::is_same<IFitVar, T>::value || std::is_same<IConstrainedFitVar, T>::value || std::is_same<ISyst, T>::value,
                   "MCMCSamples::MaxValue() can only be used with IFitVars and ISysts");
     double max = -std::numeric_limits<double>::infinity();
-    std::size_t offset = VarOffset(var);
-    for (int idx = 0; idx < fSamples->GetEntries(); idx++)
+    const double * vals = Column(var);
+    for (std::size_t idx = 0; idx < NumSamples(); idx++)
     {
-      double val = SampleValue(idx, var->ShortName(), offset);
-      if (val > max)
-        max = val;
+      if (vals[idx] > max)
+        max = vals[idx];
     }
     return max;
   }
@@ -393,12 +559,11 @@ namespace ana
     static_assert(std::is_same<IFitVar, T>::value || std::is_same<IConstrainedFitVar, T>::value || std::is_same<ISyst, T>::value,
                   "MCMCSamples::MinValue() can only be used with IFitVars and ISysts");
     double min = std::numeric_limits<double>::infinity();
-    std::size_t offset = VarOffset(var);
-    for (int idx = 0; idx < fSamples->GetEntries(); idx++)
+    const double * vals = Column(var);
+    for (std::size_t idx = 0; idx < NumSamples(); idx++)
     {
-      double val = SampleValue(idx, var->ShortName(), offset);
-      if (val < min)
-        min = val;
+      if (vals[idx] < min)
+        min = vals[idx];
     }
     return min;
   }
@@ -552,23 +717,41 @@ namespace ana
                   << std::endl << std::endl;
     }
 
-    // unfortunately the remaining diagnostics really require a stan::mcmc::chains<> object.
-    // this presents an annoying issue: the TTree storage is necessary for use with RooNDKeysPDF,
-    // and is much more convenient for persistence.
-    // even more unfortunately, these are the most important diagnostics.
-    // Should we build a stan::mcmc::chains from it?
-    // todo: decide how to implement remaining diagnostics
-/*
-  else if (chains.param_name(i).find("__") == std::string::npos) {
-
-        double n_eff = chains.effective_sample_size(i);
-        if (n_eff / num_samples < 0.001)
-          bad_n_eff_names.push_back(chains.param_name(i));
-
-        double split_rhat = chains.split_potential_scale_reduction(i);
-        if (split_rhat > 1.1)
-          bad_rhat_names.push_back(chains.param_name(i));
+    // the remaining diagnostics follow CmdStan's too, but are computed here
+    // from the tree since we don't have a stan::mcmc::chains<> object.
+    // each chain is split in half, as Stan does, to also catch drifts within a chain
+    const std::size_t half = NumSamples() / fNumChains / 2;
+    if (half < 4)
+      return;
+
+    std::vector<std::string> bad_n_eff_names;
+    std::vector<std::string> bad_rhat_names;
+    for (std::size_t varIdx = 0; varIdx < fVars.size() + fSysts.size(); varIdx++)
+    {
+      const std::string name = varIdx < fVars.size() ? fVars[varIdx]->ShortName()
+                                                     : fSysts[varIdx - fVars.size()]->ShortName();
+      const double * vals = Columns()[1 + varIdx]->Data();
+
+      std::vector<const double*> chains;
+      for (unsigned int chain = 0; chain < fNumChains; chain++)
+      {
+        const double * start = vals + chain * (NumSamples() / fNumChains);
+        chains.push_back(start);
+        chains.push_back(start + NumSamples() / fNumChains - half);
       }
+
+      const double n_eff = EffectiveSampleSize(chains, half);
+      if (n_eff / NumSamples() < 0.001)
+        bad_n_eff_names.push_back(name);
+
+      const double split_rhat = SplitRHat(chains, half);
+      if (split_rhat > 1.1)
+        bad_rhat_names.push_back(name);
+
+      if (cfg.verbosity > StanConfig::Verbosity::kQuiet)
+        std::cout << name << ": split R-hat = " << split_rhat
+                  << ", effective sample size = " << n_eff
+                  << " (" << fNumChains << " chain" << (fNumChains > 1 ? "s" : "") << ")" << std::endl;
     }
 
     if (bad_n_eff_names.size() > 0) {
@@ -586,7 +769,7 @@ namespace ana
     }
 
     if (bad_rhat_names.size() > 0) {
-      std::cout << "The following parameters had split R-hat less than 1.1:"
+      std::cout << "The following parameters had split R-hat greater than 1.1:"
                 << std::endl;
       std::cout << "  ";
       for (size_t n = 0; n < bad_rhat_names.size() - 1; ++n)
@@ -594,12 +777,11 @@ namespace ana
       std::cout << bad_rhat_names.back() << std::endl;
 
       std::cout << "Such high values indicate incomplete mixing and biased"
-                << "estimation.  You should consider regularization your model"
+                << " estimation.  You should consider regularizing your model"
                 << " with additional prior information or looking for a more"
                 << " effective parameterization."
                 << std::endl << std::endl;
     }
-*/
 
   }
 
@@ -610,22 +792,12 @@ namespace ana
 
     fSamples->SetBranchStatus("*", true);
     fSamples->GetEntry(idx);
-    return MCMCSample(SampleLL(idx), fDiagnosticVals, fEntryVals, fDiagBranches, fVars, fSysts);
+    // Not SampleLL(), which might build the columns and so overwrite the
+    // entry just read
+    return MCMCSample(fEntryLL, fDiagnosticVals, fEntryVals, fDiagBranches, fVars, fSysts);
   }
 
 
-  //----------------------------------------------------------------------
-  double MCMCSamples::SampleValue(std::size_t rowIdx, const std::string & branchName, std::size_t varIdx) const
-  {
-    BranchStatusResetter bsr(fSamples.get());  // turn branches off when done
-
-    fSamples->SetBranchStatus(branchName.c_str(), true);
-    auto branch = fSamples->GetBranch(branchName.c_str());
-    branch->SetStatus(true);
-    branch->GetEntry(rowIdx);
-    return fEntryVals[varIdx];
-  }
-
   //----------------------------------------------------------------------
   void MCMCSamples::SampleValues(std::size_t idx,
                                  const std::vector<const IFitVar *> &vars,
@@ -661,6 +833,9 @@ namespace ana
     TParameter<int> offset("offset", fOffset);
     offset.Write();
 
+    // hadd'ing samples sums this, which is what we want
+    TParameter<int>("numChains", fNumChains).Write();
+
     TList diagBranchNames;
     diagBranchNames.SetOwner();
     for (const auto & brName : fDiagBranches)
@@ -764,15 +939,10 @@ namespace ana
   std::vector<std::pair<std::size_t, double>> MCMCSamples::SortedLLs() const
   {
     std::vector<std::pair<std::size_t, double>> LLs;
-    LLs.reserve(fSamples->GetEntries());
-    auto branch = fSamples->GetBranch(MCMCSamples::LOGLIKELIHOOD_BRANCH_NAME.c_str());
-    fSamples->SetBranchStatus("*", false);
-    fSamples->SetBranchStatus(MCMCSamples::LOGLIKELIHOOD_BRANCH_NAME.c_str(), true);
-    for (int idx = 0; idx < fSamples->GetEntries(); idx++)
-    {
-      branch->GetEntry(idx);
-      LLs.push_back(std::make_pair(idx, fEntryLL));
-    }
+    LLs.reserve(NumSamples());
+    const double * column = ColumnLL();
+    for (std::size_t idx = 0; idx < NumSamples(); idx++)
+      LLs.push_back(std::make_pair(idx, column[idx]));
 
     std::sort(LLs.begin(), LLs.end(),
         [](const std::pair<std::size_t, double> & a, const std::pair<std::size_t, double> & b)
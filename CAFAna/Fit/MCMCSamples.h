@@ -9,6 +9,7 @@
 #include "CAFAna/Core/ISyst.h"
 #include "CAFAna/Core/StanTypedefs.h"
 #include "CAFAna/Fit/BayesianMarginal.h"   // for MarginalMode enum
+#include "CAFAna/Fit/MCMCColumn.h"
 #include "CAFAna/Fit/MCMCSample.h"
 #include "CAFAna/Fit/StanConfig.h"
 
@@ -25,6 +26,9 @@ namespace ana
   /// (rather than MCMCSample objects), but MCMCSample objects can be obtained
   /// using the Sample() method.
   ///
+  /// Reading the LL and fitted values goes through contiguous per-branch
+  /// copies (see Column()), made in one pass over the tree when first needed.
+  ///
   /// \param varOffset  The offset to the first Var value.  (Previous values are the LL and internal fitter vars.)
   /// \param vars       The ana::Vars passed to the fitter
   /// \param systs      The ana::ISysts passed to the fitter
@@ -80,13 +84,20 @@ namespace ana
       void AddSample(const std::vector<double> &sample);
 
       /// Add the samples from \ref other into this MCMCSamples.  Warning: \ref other will be cleared!
+      /// Each set of samples adopted counts as (at least) one more chain in RunDiagnostics()
       void AdoptSamples(MCMCSamples&& other);
 
       /// Retrieve the index of the best-fit sample (lowest LL), which can then be used with the SampleLL() or SampleValue() methods
       std::size_t BestFitSampleIdx() const;
 
       /// Discard any samples
-      void Clear() { fSamples->Clear(); }
+      void Clear() { fSamples->Clear(); fColumns.clear(); }
+
+      /// \brief Map large contiguous columns (see \ref ColumnLL()) from
+      /// temporary files in \a dir, rather than holding them in memory
+      ///
+      /// Off (empty) by default. $CAFANA_MCMC_MMAP_DIR overrides it
+      void SetColumnMapDir(const std::string& dir) { fColumnMapDir = dir; }
 
       const Hyperparameters & Hyperparams() const   { return fHyperparams; }
 
@@ -116,6 +127,9 @@ namespace ana
       /// How many samples do we have?
       std::size_t NumSamples() const { return fSamples->GetEntries(); };
 
+      /// How many independent chains (stored one after another, of equal length) are the samples from?
+      unsigned int NumChains() const { return fNumChains; }
+
       /// Determine the LL at given quantile
       ///
       /// \param quantile e.g. 90% smallest LL of set of samples --> 0.9
@@ -133,7 +147,7 @@ namespace ana
       /// Like QuantileLL(double) except requesting multiple LLs at once
       std::map<double, std::pair<std::size_t, double>> QuantileLL(const std::vector<double>& quantiles) const;
 
-      /// Do some checks on the post-fit samples
+      /// Do some checks on the post-fit samples, including split R-hat and effective sample size across chains
       void RunDiagnostics(const StanConfig & cfg) const;
 
       /// The entire sample at index \idx.
@@ -143,22 +157,31 @@ namespace ana
       /// Get the LL for sample number \idx
       double SampleLL(std::size_t idx) const
       {
-        fSamples->GetEntry(idx);
-        return fEntryLL;
+        return ColumnLL()[idx];
       }
 
       /// Get the value of Var \a var for sample number \idx
       double SampleValue(const IFitVar *var, std::size_t idx) const
       {
-        return SampleValue(idx, var->ShortName(), VarOffset(var));
+        return Column(var)[idx];
       }
 
       /// Get the value of Syst \a syst for sample number \idx
       double SampleValue(const ana::ISyst *syst, std::size_t idx) const
       {
-        return SampleValue(idx, syst->ShortName(), VarOffset(syst));
+        return Column(syst)[idx];
       }
 
+      /// The LLs of all the samples, contiguous and NumSamples() long.
+      /// Valid until samples are next added or removed
+      const double * ColumnLL() const { return Columns()[0]->Data(); }
+
+      /// The values of \a var for all the samples.  Same validity as ColumnLL()
+      const double * Column(const IFitVar * var) const { return Columns()[1 + VarOffset(var)]->Data(); }
+
+      /// The values of \a syst for all the samples.  Same validity as ColumnLL()
+      const double * Column(const ana::ISyst * syst) const { return Columns()[1 + VarOffset(syst)]->Data(); }
+
       /// Get the values of FitVars \a vars for sample number \a idx
       void SampleValues(std::size_t idx,
                         const std::vector<const ana::IFitVar *> &vars,
@@ -205,14 +228,15 @@ namespace ana
       /// Internal-use constructor needed for LoadFrom()
       MCMCSamples(std::size_t offset, const std::vector<std::string> &diagBranchNames,
                   const std::vector<const IFitVar *> &vars, const std::vector<const ana::ISyst *> &systs,
-                  std::unique_ptr<TTree> &tree, const Hyperparameters &hyperParams, double samplingTime);
+                  std::unique_ptr<TTree> &tree, const Hyperparameters &hyperParams, double samplingTime,
+                  unsigned int numChains = 1);
+
+      /// LL, then vars and systs in fEntryVals order.  Built if need be
+      const std::vector<std::unique_ptr<MCMCColumn>> & Columns() const;
 
       /// Where in fDiagnosticVals is the given diagnostic?
       std::size_t DiagOffset(const std::string& diagName) const;
 
-      /// Internal method for getting the value of a var when you know where it is in fEntryVals
-      double SampleValue(std::size_t rowIdx, const std::string & branchName, std::size_t varIdx) const;
-
       /// Set up the storage tree based on the branch names given us by Stan
       void ParseDiagnosticBranches(const std::vector<std::string>& names);
 
@@ -245,6 +269,11 @@ namespace ana
 
       mutable Hyperparameters fHyperparams; ///< Hyperparameters deduced after adaptation, or manually set
       double fSamplingTime;                 ///< how long did we spend sampling?
+      unsigned int fNumChains;              ///< how many chains, in order, are the samples from?
+
+      /// Contiguous copies of the LL and fitted branches.  Empty until needed
+      mutable std::vector<std::unique_ptr<MCMCColumn>> fColumns;
+      std::string fColumnMapDir;            ///< where to map large columns from, if anywhere
   };
 
 }
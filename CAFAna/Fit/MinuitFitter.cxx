@@ -5,6 +5,7 @@
 
 #include "CAFAna/Core/IFitVar.h"
 #include "CAFAna/Core/Progress.h"
+#include "CAFAna/Core/ThreadPool.h"
 #include "CAFAna/Core/Utilities.h"
 #include "CAFAna/Experiment/IExperiment.h"
 
@@ -23,8 +24,16 @@
 
 #include "Minuit2/StackAllocator.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef USE_PREDINTERP_OMP
+#include <omp.h>
+#endif
 
 namespace ana
 {
@@ -54,12 +63,19 @@ namespace ana
   {
   }
 
+  //----------------------------------------------------------------------
+  MinuitFitter* MinuitFitter::Clone() const
+  {
+    return new MinuitFitter(fExpt, fVars, fSysts, fFitOpts);
+  }
+
   //----------------------------------------------------------------------
   bool MinuitFitter::SupportsDerivatives() const
   {
-    // Most of this framework was torn out. But keep the hooks here in case we
-    // want to replace the derivatives with stan.
-    return false;
+    // Only with $CAFANA_FIT_GRADIENT=1, otherwise the derivatives are left to
+    // Minuit. Whether the experiment can actually provide them is only known
+    // once there's a seed to try.
+    return getenv("CAFANA_FIT_GRADIENT") && atoi(getenv("CAFANA_FIT_GRADIENT"));
   }
 
   //----------------------------------------------------------------------
@@ -138,7 +154,18 @@ namespace ana
     // One way this can go wrong is if two variables have the same ShortName
     assert(mnMin->NFree() == fVars.size() + fSysts.size());
 
-    if (fSupportsDerivatives) {
+    // Only worth giving Minuit our gradient if the syst derivatives are
+    // analytic. Otherwise its own numerical ones are at least as good.
+    fUseGradient = false;
+    // The calculator's other parameters may differ from the last fit
+    fDerivPars.clear();
+    if (fSupportsDerivatives && !fSysts.empty()) {
+      double chisq;
+      fUseGradient = fExpt->ChiSqWithGradient(fCalc, *fShifts, fSysts,
+                                              chisq, fSystGrad);
+    }
+
+    if (fUseGradient) {
       mnMin->SetFunction(*this);
     } else {
       mnMin->SetFunction((ROOT::Math::IBaseFunctionMultiDim &)*this);
@@ -264,9 +291,63 @@ namespace ana
   {
     ++fNEvalGrad;
 
-    // All this logic was torn out, but this is where you would reimplement it
-    // in terms of stan.
-    abort();
+    DecodePars(pars); // Updates fCalc and fShifts
+
+    const unsigned int nVars = fVars.size();
+
+    double chisq;
+    const bool analytic = fExpt->ChiSqWithGradient(fCalc, *fShifts, fSysts,
+                                                   chisq, fSystGrad);
+
+    if (analytic) {
+      for (unsigned int j = 0; j < fSysts.size(); ++j) {
+        const double x = pars[nVars + j];
+        // A clamped syst doesn't move the prediction any further
+        double g = (fShifts->GetShift(fSysts[j]) == x) ? fSystGrad[j] : 0;
+        // The penalties are (piecewise) quadratic, so this is exact
+        const double h = 1e-4;
+        g += (fSysts[j]->Penalty(x + h) - fSysts[j]->Penalty(x - h)) / (2 * h);
+        ret[nVars + j] = g;
+      }
+    }
+
+    // The oscillation parameters, and the systs if the experiment couldn't
+    // do them, by central differences
+    const unsigned int nFD = analytic ? nVars : NDim();
+    std::vector<double> shifted(pars, pars + NDim());
+    for (unsigned int i = 0; i < nFD; ++i) {
+      ++fNEvalFiniteDiff;
+      const double h = FiniteDiffStep(i);
+      shifted[i] = pars[i] + h;
+      const double up = DoEval(shifted.data());
+      shifted[i] = pars[i] - h;
+      const double dn = DoEval(shifted.data());
+      shifted[i] = pars[i];
+      ret[i] = (up - dn) / (2 * h);
+    }
+
+    // Leave fCalc and fShifts as they were asked for
+    if (nFD > 0) DecodePars(pars);
+  }
+
+  //----------------------------------------------------------------------
+  double MinuitFitter::DoDerivative(const double *pars,
+                                    unsigned int icoord) const
+  {
+    const unsigned int N = NDim();
+    if (fDerivPars.size() != N || !std::equal(pars, pars + N, fDerivPars.begin())) {
+      fDerivGrad.resize(N);
+      Gradient(pars, fDerivGrad.data());
+      fDerivPars.assign(pars, pars + N);
+    }
+    return fDerivGrad[icoord];
+  }
+
+  //----------------------------------------------------------------------
+  double MinuitFitter::FiniteDiffStep(unsigned int i) const
+  {
+    assert(i < fLastPreFitErrors.size());
+    return 1e-4 * fabs(fLastPreFitErrors[i]);
   }
 
   //----------------------------------------------------------------------
@@ -287,7 +368,101 @@ namespace ana
     }
   }
 
-   //----------------------------------------------------------------------
+  //----------------------------------------------------------------------
+  std::unique_ptr<IFitter::IFitSummary>
+  MinuitFitter::FitHelper(osc::IOscCalcAdjustable* initseed,
+                          SystShifts& bestSysts,
+                          const SeedList& seedPts,
+                          const std::vector<SystShifts>& systSeedPts,
+                          Verbosity verb) const
+  {
+    const std::vector<SeedPt> pts = ExpandSeeds(seedPts, systSeedPts);
+
+    if(!fParallelSeeds || pts.size() < 2)
+      return IFitter::FitHelper(initseed, bestSysts, seedPts, systSeedPts, verb);
+
+    // if user passed a derived kind of SystShifts, this preserves it
+    fShifts = bestSysts.Copy();
+    fShifts->ResetToNominal();
+
+    // Nothing created during the fits belongs in a directory, and the guards
+    // in Spectrum etc are racey when run in parallel
+    DontAddDirectory guard;
+
+    // Give all the constituents of the experiment a chance to do their lazy
+    // initialization, before they race themselves trying to do it in parallel
+    {
+      std::unique_ptr<osc::IOscCalcAdjustable> calc(initseed ? initseed->Copy() : 0);
+      pts[0].fitvars.ResetCalc(calc.get());
+      fExpt->ChiSq(calc.get(), pts[0].shift);
+    }
+
+    struct SeedFit
+    {
+      std::unique_ptr<MinuitFitter> fitter;
+      std::unique_ptr<osc::IOscCalcAdjustable> seed;
+      std::unique_ptr<SystShifts> shift;
+      std::unique_ptr<IFitSummary> summary;
+    };
+    std::vector<SeedFit> fits(pts.size());
+
+#ifdef USE_PREDINTERP_OMP
+    const int nThreadsPerSeed = std::max(1, omp_get_max_threads()/int(pts.size()));
+#endif
+
+    ThreadPool pool;
+    for(unsigned int i = 0; i < pts.size(); ++i){
+      pool.AddTask([&, i](){
+#ifdef USE_PREDINTERP_OMP
+          omp_set_num_threads(nThreadsPerSeed);
+#endif
+          SeedFit& fit = fits[i];
+          fit.fitter.reset(Clone());
+          fit.fitter->fShifts = fShifts->Copy();
+
+          fit.seed.reset(initseed ? initseed->Copy() : 0);
+          pts[i].fitvars.ResetCalc(fit.seed.get());
+
+          // be sure to keep any derived class stuff around
+          fit.shift = fShifts->Copy();
+          *fit.shift = pts[i].shift;
+
+          fit.summary = fit.fitter->FitHelperSeeded(fit.seed.get(), *fit.shift, verb);
+        });
+    }
+    pool.Finish();
+
+    // Same choice, in the same order, as the serial version
+    unsigned int best = 0;
+    for(unsigned int i = 1; i < fits.size(); ++i){
+      if(fits[i].summary->IsBetterThan(fits[best].summary.get())) best = i;
+    }
+
+    for(const SeedFit& fit: fits){
+      fNEval += fit.fitter->fNEval;
+      fNEvalGrad += fit.fitter->fNEvalGrad;
+      fNEvalFiniteDiff += fit.fitter->fNEvalFiniteDiff;
+    }
+
+    // UpdatePostFit() works from what the winning seed fit recorded
+    const MinuitFitter& winner = *fits[best].fitter;
+    fLastParamNames = winner.fLastParamNames;
+    fLastPreFitValues = winner.fLastPreFitValues;
+    fLastPreFitErrors = winner.fLastPreFitErrors;
+    fLastCentralValues = winner.fLastCentralValues;
+    fTempMinosErrors = winner.fTempMinosErrors;
+    UpdatePostFit(fits[best].summary.get());
+
+    // Stuff the results of the actual best fit back into the seeds
+    for (unsigned int i = 0; i < fVars.size(); ++i)
+      fVars[i]->SetValue(initseed, fVars[i]->GetValue(fits[best].seed.get()));
+    for (unsigned int i = 0; i < fSysts.size(); ++i)
+      bestSysts.SetShift(fSysts[i], fits[best].shift->GetShift(fSysts[i]));
+
+    return std::move(fits[best].summary);
+  }
+
+  //----------------------------------------------------------------------
   void MinuitFitter::UpdatePostFit(const IFitter::IFitSummary *fitSummary) const
   {
     // Get them as set by the last seed fit
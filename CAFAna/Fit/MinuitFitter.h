@@ -97,20 +97,32 @@ namespace ana
       // Part of the fitter interface
       virtual unsigned int NDim() const override { return fVars.size() + fSysts.size(); }
 
+      /// \brief Systs from IExperiment::ChiSqWithGradient, oscillation
+      /// parameters by central differences
+      ///
+      /// If the experiment can't do the systs analytically they get central
+      /// differences too.
       void Gradient(const double *x, double *grad) const override;
 
+      /// \brief One element of \ref Gradient
+      ///
+      /// The whole gradient costs the same as one element, so it's kept for
+      /// the other elements at the same \a x
       virtual double DoDerivative(const double *x,
-                                  unsigned int icoord) const override
-      {
-        std::cout << "Fitter::DoDerivative() not implemented" << std::endl;
-        abort();
-      }
+                                  unsigned int icoord) const override;
 
-      MinuitFitter *Clone() const override
-      {
-        std::cout << "MinuitFitter::Clone() not implemented" << std::endl;
-        abort();
-      }
+      /// A fresh fitter with the same experiment, parameters and options. None
+      /// of the fit results are copied.
+      MinuitFitter *Clone() const override;
+
+      /// \brief Fit each seed on its own thread
+      ///
+      /// Each seed gets its own clone of this fitter, oscillation calculator
+      /// and SystShifts. The experiment and its predictions are shared, so
+      /// must be safe to evaluate concurrently, as for a parallel
+      /// FrequentistSurface. With USE_PREDINTERP_OMP the OpenMP threads are
+      /// divided between the seeds.
+      void SetParallelSeeds(bool parallel = true){fParallelSeeds = parallel;}
 
       // TODO unused
       bool CheckGradient() const { return (fFitOpts & kPrecisionMask) != kFast; }
@@ -161,16 +173,34 @@ namespace ana
 
       void UpdatePostFit(const IFitSummary * fitSummary) const override;
 
+      /// Parallel version of IFitter::FitHelper(), see \ref SetParallelSeeds
+      std::unique_ptr<IFitSummary> FitHelper(osc::IOscCalcAdjustable* seed,
+                                             SystShifts& bestSysts,
+                                             const SeedList& seedPts,
+                                             const std::vector<SystShifts>& systSeedPts,
+                                             Verbosity verb) const override;
+
       /// Intended to be called only once (from constructor) to initialize
-      /// fSupportsDerivatives
+      /// fSupportsDerivatives. Off unless $CAFANA_FIT_GRADIENT=1
       bool SupportsDerivatives() const;
 
+      /// Central difference step for parameter \a i, a small fraction of the
+      /// initial step Minuit was given
+      double FiniteDiffStep(unsigned int i) const;
+
       mutable osc::IOscCalcAdjustable *fCalc;
       const IExperiment *fExpt;
 
       FitOpts fFitOpts;
 
       bool fSupportsDerivatives;
+      bool fParallelSeeds = false;
+      /// Could the experiment do the syst derivatives analytically at the
+      /// current seed? Otherwise Minuit is left to do its own.
+      mutable bool fUseGradient = false;
+      mutable std::vector<double> fSystGrad;
+      /// \ref Gradient at \ref fDerivPars, for \ref DoDerivative
+      mutable std::vector<double> fDerivPars, fDerivGrad;
 
       mutable int fNEval = 0;
       mutable int fNEvalGrad = 0;
@@ -58,7 +58,7 @@ namespace ana
       {}
 
     unsigned int random_seed;  ///< Random seed used by Stan internally
-    unsigned int chain;        ///< Number of Markov chains to run (1 per core)
+    unsigned int chain;        ///< Number of Markov chains to run (1 per core).  They run concurrently if Stan is built with STAN_THREADS (cmake -DUSE_STAN_THREADS=ON) and ROOT::EnableThreadSafety() has been called, and their samples are merged
     double init_radius;        ///< Size of the range in *unconstrained* parameter space where the initial point for un-specified parameters is randomly seeded
     int num_warmup;            ///< Number of initial steps in the Markov chain (used to enter the typical set).  These are usually discarded because they may not be sampled proportionally to the likelihood.
     int num_samples;           ///< Number of steps in the Markov chain retained for analysis (after warmup).
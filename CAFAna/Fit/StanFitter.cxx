@@ -21,6 +21,8 @@
 
 #include "CAFAna/Fit/StanFitter.h"
 
+#include "TVirtualMutex.h"
+
 #include "CAFAna/Core/Utilities.h"
 
 #include "CAFAna/Experiment/IExperiment.h"
@@ -34,6 +36,7 @@
 
 #include "CAFAna/Core/MathUtil.h"
 #include "CAFAna/Core/StanUtils.h"
+#include "CAFAna/Core/ThreadPool.h"
 
 // these will come in handy below
 using stan_diag_t = stan::mcmc::adapt_diag_e_nuts<ana::StanFitter, boost::ecuyer1988>;
@@ -150,13 +153,26 @@ namespace ana
       std::cerr << "Which do you want?" << std::endl;
       abort();
     }
+    if (fStanConfig.chain > 1 && fMCMCWarmup.NumSamples() > 0)
+    {
+      std::cerr << "You supplied a previous collection of MCMC samples for warmup and also requested "
+                << fStanConfig.chain << " chains in your StanConfig." << std::endl;
+      std::cerr << "Each chain does its own warmup, so this isn't supported." << std::endl;
+      abort();
+    }
 
+    ResetValueWriter();
+
+    return IFitter::Fit(seed, bestSysts, seedPts, systSeedPts, verb);
+  }
+
+  //----------------------------------------------------------------------
+  void StanFitter::ResetValueWriter() const
+  {
     // const-casts here because we need to initialize the writer interface, which requires a non-const pointer,
     // but this method is const.  prefer not to make the members mutable for this one instance
     fValueWriter = std::make_unique<MemoryTupleWriter>(fStanConfig.num_samples > 0 ? const_cast<MCMCSamples*>(&fMCMCSamples) : nullptr,
                                                        fStanConfig.num_warmup > 0 ? const_cast<MCMCSamples*>(&fMCMCWarmup) : nullptr);
-
-    return IFitter::Fit(seed, bestSysts, seedPts, systSeedPts, verb);
   }
 
 
@@ -165,6 +181,46 @@ namespace ana
   StanFitter::FitHelperSeeded(osc::IOscCalcAdjustable *seed,
                               SystShifts &systSeed,
                               Verbosity verb) const
+  {
+    // id: only needed when running multiple chains to combine.
+    // if the grid var $PROCESS is defined, use that
+    unsigned int procId = 0;
+    const char* process = getenv("PROCESS");
+    if(process)
+      procId = std::stoul(process);
+
+    int return_code;
+    if (fStanConfig.chain > 1)
+      return_code = RunChains(seed, systSeed, procId);
+    else
+      return_code = RunChain(seed, systSeed, procId, true);
+
+    // todo: something smarter here?  or just more output?
+    // also todo: need to check the Stan diagnostics for divergences, autocorrelation, etc.
+    if (return_code != stan::services::error_codes::OK)
+      std::cerr << "warning: Stan fit did not converge..." << std::endl;
+
+    auto bestSampleIdx = fMCMCSamples.BestFitSampleIdx();
+
+    // Store results back to the "seed" variable
+    for (auto & var : fVars)
+      var->SetValue(seed, fMCMCSamples.SampleValue(var, bestSampleIdx));
+
+    // Store systematic results back into "systSeed".
+    // cast to stan-var so that we don't lose the value here
+    for (const auto & syst : fSysts)
+      systSeed.SetShift(syst, stan::math::var(fMCMCSamples.SampleValue(syst, bestSampleIdx)));
+
+    fMCMCSamples.RunDiagnostics(fStanConfig);
+
+    return std::make_unique<StanFitSummary>(fMCMCSamples.SampleLL(bestSampleIdx));
+  } // StanFitter::FitHelperSeeded()
+
+  //----------------------------------------------------------------------
+  int StanFitter::RunChain(osc::IOscCalcAdjustable *seed,
+                           const SystShifts &systSeed,
+                           unsigned int procId,
+                           bool showProgress) const
   {
     CreateCalculator(seed);
 
@@ -172,8 +228,8 @@ namespace ana
 
     // status and other stuff that get passed back & forth between us and Stan
     stan::callbacks::writer init_writer;
-    samplecounter_callback interrupt(std::size_t(fStanConfig.num_warmup),
-                                     std::size_t(fStanConfig.num_samples));  // creates a nice CAFAna-style Progress bar
+    samplecounter_callback interrupt(showProgress ? std::size_t(fStanConfig.num_warmup) : 0,
+                                     showProgress ? std::size_t(fStanConfig.num_samples) : 0);  // creates a nice CAFAna-style Progress bar
 
     std::ostream nullStream(nullptr);
     std::ostream & diagStream = (fStanConfig.verbosity < StanConfig::Verbosity::kQuiet) ? std::cout : nullStream;
@@ -223,13 +279,6 @@ namespace ana
       init_context = std::make_unique<stan::io::array_var_context>(BuildInitContext(calc.get(), *shifts));
     }
 
-    // id: only needed when running multiple chains to combine.
-    // if the grid var $PROCESS is defined, use that
-    unsigned int procId = 0;
-    const char* process = getenv("PROCESS");
-    if(process)
-      procId = std::stoul(process);
-
     // n.b. there are _lots_ more options for ways to call Stan but let's start here.
     //      this is an exploration using the "no-u-turn sampler" (NUTS)
     //      within the Hamiltonian MC algorithm with a simple Euclidian metric
@@ -269,27 +318,123 @@ namespace ana
 //                                                                     *fValueWriter,
 //                                                                     diagnostic_writer);
 
+    return return_code;
+  } // StanFitter::RunChain()
 
-    // todo: something smarter here?  or just more output?
-    // also todo: need to check the Stan diagnostics for divergences, autocorrelation, etc.
-    if (return_code != stan::services::error_codes::OK)
-      std::cerr << "warning: Stan fit did not converge..." << std::endl;
+  //----------------------------------------------------------------------
+  int StanFitter::RunChains(osc::IOscCalcAdjustable *seed,
+                            const SystShifts &systSeed,
+                            unsigned int procId) const
+  {
+    const unsigned int nChains = fStanConfig.chain;
 
-    auto bestSampleIdx = fMCMCSamples.BestFitSampleIdx();
+    // Nothing created by the chains belongs in a directory, and the guards
+    // in Spectrum etc are racey when run in parallel
+    DontAddDirectory guard;
 
-    // Store results back to the "seed" variable
-    for (auto & var : fVars)
-      var->SetValue(seed, fMCMCSamples.SampleValue(var, bestSampleIdx));
+    // log_prob() works through fCalc, fShifts etc, so each chain needs a
+    // whole fitter of its own. Copy the seeds up front too, since reading
+    // them isn't necessarily thread-safe
+    struct Chain
+    {
+      std::unique_ptr<StanFitter> fitter;
+      std::unique_ptr<osc::IOscCalcAdjustable> seed;
+      std::unique_ptr<SystShifts> shift;
+      int returnCode;
+    };
+    std::vector<Chain> chains(nChains);
+    for (Chain & chain : chains)
+    {
+      chain.fitter = std::make_unique<StanFitter>(fExpt, fVars, fSysts);
+      chain.fitter->fStanConfig = fStanConfig;
+      chain.fitter->fStanConfig.chain = 1;
+      if (fOscCalcCache)
+        chain.fitter->fOscCalcCache.reset(fOscCalcCache->Copy());
+      chain.fitter->ResetValueWriter();
 
-    // Store systematic results back into "systSeed".
-    // cast to stan-var so that we don't lose the value here
-    for (const auto & syst : fSysts)
-      systSeed.SetShift(syst, stan::math::var(fMCMCSamples.SampleValue(syst, bestSampleIdx)));
+      chain.seed.reset(seed ? seed->Copy() : nullptr);
+      chain.shift = systSeed.Copy();
+    }
 
-    fMCMCSamples.RunDiagnostics(fStanConfig);
+    // Stan's create_rng() gives each chain id its own stream.
+    // Keep them distinct between grid jobs too
+    auto runChain = [&](unsigned int i)
+    {
+      chains[i].returnCode = chains[i].fitter->RunChain(chains[i].seed.get(), *chains[i].shift,
+                                                        procId * nChains + i, i == 0);
+    };
+
+#ifdef STAN_THREADS
+    // Each chain fills ROOT trees of its own. Turning on ROOT's thread safety
+    // affects the whole process, so is left to the caller
+    const bool parallel = (gGlobalMutex != nullptr);
+    if (!parallel)
+      std::cerr << "StanFitter: ROOT::EnableThreadSafety() hasn't been called, so running the "
+                << nChains << " chains one after another" << std::endl;
+#else
+    // The autodiff stack is shared without STAN_THREADS
+    const bool parallel = false;
+    std::cerr << "StanFitter: Stan was built without STAN_THREADS, so running the "
+              << nChains << " chains one after another" << std::endl;
+#endif
 
-    return std::make_unique<StanFitSummary>(fMCMCSamples.SampleLL(bestSampleIdx));
-  } // StanFitter::FitHelperSeeded()
+    if (parallel)
+    {
+      // One evaluation first, on this thread, so that anything the experiment
+      // builds lazily on first use is already there when the chains start
+      CreateCalculator(seed);
+      fShifts = systSeed.Copy();
+      fExpt->LogLikelihood(fCalc.get(), *fShifts);
+      fCalc->InvalidateCache();
+      stan::math::recover_memory();
+
+      ThreadPool pool(nChains);
+      for (unsigned int i = 0; i < nChains; i++)
+      {
+        pool.AddTask([&runChain, i]()
+                     {
+#ifdef STAN_THREADS
+                       // Each thread needs its own autodiff stack
+                       stan::math::ChainableStack autodiffStack;
+#endif
+                       runChain(i);
+                     });
+      }
+      pool.Finish();
+    }
+    else
+    {
+      for (unsigned int i = 0; i < nChains; i++)
+        runChain(i);
+    }
+
+    // Chain by chain, so that MCMCSamples::RunDiagnostics() can tell them apart
+    auto & samples = const_cast<MCMCSamples&>(fMCMCSamples);
+    auto & warmup = const_cast<MCMCSamples&>(fMCMCWarmup);
+    int return_code = stan::services::error_codes::OK;
+    for (Chain & chain : chains)
+    {
+      if (chain.fitter->fMCMCSamples.NumSamples() > 0)
+      {
+        if (samples.NumSamples() == 0)
+          samples = std::move(chain.fitter->fMCMCSamples);
+        else
+          samples.AdoptSamples(std::move(chain.fitter->fMCMCSamples));
+      }
+      if (chain.fitter->fMCMCWarmup.NumSamples() > 0)
+      {
+        if (warmup.NumSamples() == 0)
+          warmup = std::move(chain.fitter->fMCMCWarmup);
+        else
+          warmup.AdoptSamples(std::move(chain.fitter->fMCMCWarmup));
+      }
+
+      if (return_code == stan::services::error_codes::OK)
+        return_code = chain.returnCode;
+    }
+
+    return return_code;
+  } // StanFitter::RunChains()
 
   //----------------------------------------------------------------------
   void StanFitter::get_param_names(std::vector<std::string>& names) const
@@ -739,8 +884,7 @@ namespace ana
     auto init_context = BuildInitContext(seed, systSeed);
 
     // this would normally get initialized in Fit(), but we're not fitting
-    fValueWriter = std::make_unique<MemoryTupleWriter>(fStanConfig.num_samples > 0 ? const_cast<MCMCSamples*>(&fMCMCSamples) : nullptr,
-                                                       fStanConfig.num_warmup > 0 ? const_cast<MCMCSamples*>(&fMCMCWarmup) : nullptr);
+    ResetValueWriter();
 
 
     // diagnostic mode, where the model's gradients calculated via Stan's autodiff
@@ -297,6 +297,27 @@ namespace ana
       BuildInitContext(osc::IOscCalcAdjustable *seed,
                        const SystShifts &systSeed) const;
 
+      /// Run one chain from \a seed and \a systSeed, adding to fMCMCSamples and fMCMCWarmup
+      ///
+      /// \param procId        Chain id, which picks the random number stream
+      /// \param showProgress  Draw progress bars?
+      /// \return              Stan return code
+      int RunChain(osc::IOscCalcAdjustable *seed,
+                   const SystShifts &systSeed,
+                   unsigned int procId,
+                   bool showProgress) const;
+
+      /// \brief Run StanConfig::chain chains, each with its own fitter, and merge their samples
+      ///
+      /// Concurrently when Stan has STAN_THREADS and the caller has called
+      /// ROOT::EnableThreadSafety(), otherwise one after another
+      int RunChains(osc::IOscCalcAdjustable *seed,
+                    const SystShifts &systSeed,
+                    unsigned int procId) const;
+
+      /// Point fValueWriter at fMCMCSamples and fMCMCWarmup, as requested by the config
+      void ResetValueWriter() const;
+
       /// Convert a 'normal' calculator into the Stan-aware variant used internally
       void CreateCalculator(osc::IOscCalcAdjustable * seed) const;
 
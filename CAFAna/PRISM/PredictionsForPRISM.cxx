@@ -66,7 +66,7 @@ namespace ana {
                                                        Current::Current_t curr,
                                                        Sign::Sign_t sign) const {
 
-    Spectrum ret = fExtrap->NCComponent(); // Get binning
+    Spectrum ret = fExtrap->NCComponentRef(); // Get binning
     ret.Clear();
 
     if (!(curr & Current::kCC)) {
@@ -74,32 +74,32 @@ namespace ana {
     }
 
     if ((flav & Flavors::kNuMuToNuMu) && (sign & Sign::kNu)) {
-      ret += fExtrap->NumuSurvComponent().Oscillated(calc, +14, +14);
+      ret += fExtrap->CCComponentRef(+14, +14).Oscillated(calc, +14, +14);
     }
     if ((flav & Flavors::kNuMuToNuMu) && (sign & Sign::kAntiNu)) {
-      ret += fExtrap->AntiNumuSurvComponent().Oscillated(calc, -14, -14);
+      ret += fExtrap->CCComponentRef(-14, -14).Oscillated(calc, -14, -14);
     }
 
     if ((flav & Flavors::kNuMuToNuE) && (sign & Sign::kNu)) {
-      ret += fExtrap->NumuSurvComponent().Oscillated(calc, +14, +12);
+      ret += fExtrap->CCComponentRef(+14, +14).Oscillated(calc, +14, +12);
     }
     if ((flav & Flavors::kNuMuToNuE) && (sign & Sign::kAntiNu)) {
-      ret += fExtrap->AntiNumuSurvComponent().Oscillated(calc, -14, -12);
+      ret += fExtrap->CCComponentRef(-14, -14).Oscillated(calc, -14, -12);
     }
 
     // Include intrinsic nue in flux matching
     if ((flav & Flavors::kNuEToNuE) && (sign & Sign::kNu)) {
-      ret += fExtrap->NueSurvComponent().Oscillated(calc, +12, +12);
+      ret += fExtrap->CCComponentRef(+12, +12).Oscillated(calc, +12, +12);
     }
     if ((flav & Flavors::kNuEToNuE) && (sign & Sign::kAntiNu)) {
-      ret += fExtrap->AntiNueSurvComponent().Oscillated(calc, -12, -12);
+      ret += fExtrap->CCComponentRef(-12, -12).Oscillated(calc, -12, -12);
     }
 
     if ((flav & Flavors::kNuMuToNuTau) && (sign & Sign::kNu)) {
-      ret += fExtrap->NumuSurvComponent().Oscillated(calc, +14, +16);
+      ret += fExtrap->CCComponentRef(+14, +14).Oscillated(calc, +14, +16);
     }
     if ((flav & Flavors::kNuMuToNuTau) && (sign & Sign::kAntiNu)) {
-      ret += fExtrap->AntiNumuSurvComponent().Oscillated(calc, -14, -16);
+      ret += fExtrap->CCComponentRef(-14, -14).Oscillated(calc, -14, -16);
     }
     return ret;
   }
@@ -175,39 +175,39 @@ namespace ana {
                                            Flavors::Flavors_t flav,
                                            Current::Current_t curr,
                                            Sign::Sign_t sign) const {
-    Spectrum ret = fExtrap->NCComponent(); // Get binning
+    Spectrum ret = fExtrap->NCComponentRef(); // Get binning
     ret.Clear();
 
     if(curr & Current::kCC){
-      if(flav & Flavors::kNuEToNuE && sign & Sign::kNu) ret += fExtrap->NueSurvComponent()
+      if(flav & Flavors::kNuEToNuE && sign & Sign::kNu) ret += fExtrap->CCComponentRef(+12, +12)
                                                                .Oscillated(calc, +12, +12);
-      if(flav & Flavors::kNuEToNuE && sign & Sign::kAntiNu) ret += fExtrap->AntiNueSurvComponent()
+      if(flav & Flavors::kNuEToNuE && sign & Sign::kAntiNu) ret += fExtrap->CCComponentRef(-12, -12)
                                                                    .Oscillated(calc, -12, -12);
-      if(flav & Flavors::kNuEToNuMu && sign & Sign::kNu) ret += fExtrap->NumuAppComponent()
+      if(flav & Flavors::kNuEToNuMu && sign & Sign::kNu) ret += fExtrap->CCComponentRef(+12, +14)
                                                                 .Oscillated(calc, +12, +14);
-      if(flav & Flavors::kNuEToNuMu && sign & Sign::kAntiNu) ret += fExtrap->AntiNumuAppComponent()
+      if(flav & Flavors::kNuEToNuMu && sign & Sign::kAntiNu) ret += fExtrap->CCComponentRef(-12, -14)
                                                                     .Oscillated(calc, -12, -14);
-      if(flav & Flavors::kNuEToNuTau && sign & Sign::kNu) ret += fExtrap->TauFromEComponent()
+      if(flav & Flavors::kNuEToNuTau && sign & Sign::kNu) ret += fExtrap->CCComponentRef(+12, +16)
                                                                  .Oscillated(calc, +12, +16);
-      if(flav & Flavors::kNuEToNuTau && sign & Sign::kAntiNu) ret += fExtrap->AntiTauFromEComponent()
+      if(flav & Flavors::kNuEToNuTau && sign & Sign::kAntiNu) ret += fExtrap->CCComponentRef(-12, -16)
                                                                      .Oscillated(calc, -12, -16);
-      if(flav & Flavors::kNuMuToNuE && sign & Sign::kNu) ret += fExtrap->NueAppComponent()
+      if(flav & Flavors::kNuMuToNuE && sign & Sign::kNu) ret += fExtrap->CCComponentRef(+14, +12)
                                                                 .Oscillated(calc, +14, +12);
-      if(flav & Flavors::kNuMuToNuE && sign & Sign::kAntiNu) ret += fExtrap->AntiNueAppComponent()
+      if(flav & Flavors::kNuMuToNuE && sign & Sign::kAntiNu) ret += fExtrap->CCComponentRef(-14, -12)
                                                                     .Oscillated(calc, -14, -12);
-      if(flav & Flavors::kNuMuToNuMu && sign & Sign::kNu) ret += fExtrap->NumuSurvComponent()
+      if(flav & Flavors::kNuMuToNuMu && sign & Sign::kNu) ret += fExtrap->CCComponentRef(+14, +14)
                                                                  .Oscillated(calc, +14, +14);
-      if(flav & Flavors::kNuMuToNuMu && sign & Sign::kAntiNu) ret += fExtrap->AntiNumuSurvComponent()
+      if(flav & Flavors::kNuMuToNuMu && sign & Sign::kAntiNu) ret += fExtrap->CCComponentRef(-14, -14)
                                                                      .Oscillated(calc, -14, -14);
-      if(flav & Flavors::kNuMuToNuTau && sign & Sign::kNu) ret += fExtrap->TauFromMuComponent()
+      if(flav & Flavors::kNuMuToNuTau && sign & Sign::kNu) ret += fExtrap->CCComponentRef(+14, +16)
                                                                   .Oscillated(calc, +14, +16);
-      if(flav & Flavors::kNuMuToNuTau && sign & Sign::kAntiNu) ret += fExtrap->AntiTauFromMuComponent()
+      if(flav & Flavors::kNuMuToNuTau && sign & Sign::kAntiNu) ret += fExtrap->CCComponentRef(-14, -16)
                                                                       .Oscillated(calc, -14, -16);
     }
     if (curr & Current::kNC) {
       assert(flav == Flavors::kAll);
       assert(sign == Sign::kBoth); // Don't split NC 'data' by sign, not interpolating.
-      ret += fExtrap->NCTotalComponent();
+      ret += fExtrap->NCTotalComponentRef();
     }
 
     return ret;
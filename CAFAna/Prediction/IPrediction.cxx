@@ -37,6 +37,19 @@ namespace ana
     return Predict(&noosc);
   }
 
+  //----------------------------------------------------------------------
+  bool IPrediction::PredictSystWithGradient(osc::IOscCalc* calc,
+                                            const SystShifts& syst,
+                                            const std::vector<const ISyst*>& systs,
+                                            double pot,
+                                            Eigen::ArrayXd& pred,
+                                            std::vector<Eigen::ArrayXd>& grad) const
+  {
+    // Only predictions that know how their systematics are implemented can
+    // say anything about the derivatives
+    return false;
+  }
+
   //----------------------------------------------------------------------
   // placeholder method that should be overridden by Stan-aware concrete Prediction classes
   Spectrum IPrediction::Predict(osc::IOscCalcStan *calc) const
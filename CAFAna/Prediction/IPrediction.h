@@ -90,6 +90,7 @@ namespace ana {
     };
   }
 
+  class ISyst;
   class SystShifts;
 
   /// Standard interface to all prediction techniques
@@ -105,6 +106,20 @@ namespace ana {
     virtual Spectrum PredictSyst(osc::IOscCalc* calc, const SystShifts& syst) const;
     virtual Spectrum PredictSyst(osc::IOscCalcStan* calc, const SystShifts& syst) const;
 
+    /// \brief \ref PredictSyst and its derivatives with respect to \a systs
+    ///
+    /// \a pred is the prediction as an array scaled to \a pot, and \a grad[i]
+    /// its derivative with respect to \a systs[i] (zero if the prediction
+    /// doesn't depend on it, or it's null). Returns false, leaving the
+    /// outputs alone, if they can't be calculated analytically. The default
+    /// implementation always does.
+    virtual bool PredictSystWithGradient(osc::IOscCalc* calc,
+                                         const SystShifts& syst,
+                                         const std::vector<const ISyst*>& systs,
+                                         double pot,
+                                         Eigen::ArrayXd& pred,
+                                         std::vector<Eigen::ArrayXd>& grad) const;
+
     virtual Spectrum PredictComponent(osc::IOscCalc* calc,
                                       Flavors::Flavors_t flav,
                                       Current::Current_t curr,
@@ -50,34 +50,34 @@ namespace ana
                                                Current::Current_t curr,
                                                Sign::Sign_t sign) const
   {
-    Spectrum ret = fExtrap->NCComponent(); // Get binning
+    Spectrum ret = fExtrap->NCComponentRef(); // Get binning
     ret.Clear();
 
     if(curr & Current::kCC){
-      if(flav & Flavors::kNuEToNuE    && sign & Sign::kNu)     ret += fExtrap->NueSurvComponent().    Oscillated(calc, +12, +12);
-      if(flav & Flavors::kNuEToNuE    && sign & Sign::kAntiNu) ret += fExtrap->AntiNueSurvComponent().Oscillated(calc, -12, -12);
+      if(flav & Flavors::kNuEToNuE    && sign & Sign::kNu)     ret += fExtrap->CCComponentRef(+12, +12).Oscillated(calc, +12, +12);
+      if(flav & Flavors::kNuEToNuE    && sign & Sign::kAntiNu) ret += fExtrap->CCComponentRef(-12, -12).Oscillated(calc, -12, -12);
 
-      if(flav & Flavors::kNuEToNuMu   && sign & Sign::kNu)     ret += fExtrap->NumuAppComponent().    Oscillated(calc, +12, +14);
-      if(flav & Flavors::kNuEToNuMu   && sign & Sign::kAntiNu) ret += fExtrap->AntiNumuAppComponent().Oscillated(calc, -12, -14);
+      if(flav & Flavors::kNuEToNuMu   && sign & Sign::kNu)     ret += fExtrap->CCComponentRef(+12, +14).Oscillated(calc, +12, +14);
+      if(flav & Flavors::kNuEToNuMu   && sign & Sign::kAntiNu) ret += fExtrap->CCComponentRef(-12, -14).Oscillated(calc, -12, -14);
 
-      if(flav & Flavors::kNuEToNuTau  && sign & Sign::kNu)     ret += fExtrap->TauFromEComponent().    Oscillated(calc, +12, +16);
-      if(flav & Flavors::kNuEToNuTau  && sign & Sign::kAntiNu) ret += fExtrap->AntiTauFromEComponent().Oscillated(calc, -12, -16);
+      if(flav & Flavors::kNuEToNuTau  && sign & Sign::kNu)     ret += fExtrap->CCComponentRef(+12, +16).Oscillated(calc, +12, +16);
+      if(flav & Flavors::kNuEToNuTau  && sign & Sign::kAntiNu) ret += fExtrap->CCComponentRef(-12, -16).Oscillated(calc, -12, -16);
 
-      if(flav & Flavors::kNuMuToNuE   && sign & Sign::kNu)     ret += fExtrap->NueAppComponent().    Oscillated(calc, +14, +12);
-      if(flav & Flavors::kNuMuToNuE   && sign & Sign::kAntiNu) ret += fExtrap->AntiNueAppComponent().Oscillated(calc, -14, -12);
+      if(flav & Flavors::kNuMuToNuE   && sign & Sign::kNu)     ret += fExtrap->CCComponentRef(+14, +12).Oscillated(calc, +14, +12);
+      if(flav & Flavors::kNuMuToNuE   && sign & Sign::kAntiNu) ret += fExtrap->CCComponentRef(-14, -12).Oscillated(calc, -14, -12);
 
-      if(flav & Flavors::kNuMuToNuMu  && sign & Sign::kNu)     ret += fExtrap->NumuSurvComponent().    Oscillated(calc, +14, +14);
-      if(flav & Flavors::kNuMuToNuMu  && sign & Sign::kAntiNu) ret += fExtrap->AntiNumuSurvComponent().Oscillated(calc, -14, -14);
+      if(flav & Flavors::kNuMuToNuMu  && sign & Sign::kNu)     ret += fExtrap->CCComponentRef(+14, +14).Oscillated(calc, +14, +14);
+      if(flav & Flavors::kNuMuToNuMu  && sign & Sign::kAntiNu) ret += fExtrap->CCComponentRef(-14, -14).Oscillated(calc, -14, -14);
 
-      if(flav & Flavors::kNuMuToNuTau && sign & Sign::kNu)     ret += fExtrap->TauFromMuComponent().    Oscillated(calc, +14, +16);
-      if(flav & Flavors::kNuMuToNuTau && sign & Sign::kAntiNu) ret += fExtrap->AntiTauFromMuComponent().Oscillated(calc, -14, -16);
+      if(flav & Flavors::kNuMuToNuTau && sign & Sign::kNu)     ret += fExtrap->CCComponentRef(+14, +16).Oscillated(calc, +14, +16);
+      if(flav & Flavors::kNuMuToNuTau && sign & Sign::kAntiNu) ret += fExtrap->CCComponentRef(-14, -16).Oscillated(calc, -14, -16);
     }
 
     if(curr & Current::kNC){
       assert(flav == Flavors::kAll); // Don't know how to calculate anything else
 
-      if(sign & Sign::kNu)     ret += fExtrap->NCComponent();
-      if(sign & Sign::kAntiNu) ret += fExtrap->NCAntiComponent();
+      if(sign & Sign::kNu)     ret += fExtrap->NCComponentRef();
+      if(sign & Sign::kAntiNu) ret += fExtrap->NCAntiComponentRef();
     }
 
     return ret;
@@ -106,41 +106,22 @@ namespace ana
   //----------------------------------------------------------------------
   OscillatableSpectrum PredictionExtrap::ComponentCC(int from, int to) const
   {
-    if(from == +12 && to == +12) return fExtrap->NueSurvComponent();
-    if(from == -12 && to == -12) return fExtrap->AntiNueSurvComponent();
-
-    if(from == +12 && to == +14) return fExtrap->NumuAppComponent();
-    if(from == -12 && to == -14) return fExtrap->AntiNumuAppComponent();
-
-    if(from == +12 && to == +16) return fExtrap->TauFromEComponent();
-    if(from == -12 && to == -16) return fExtrap->AntiTauFromEComponent();
-
-    if(from == +14 && to == +12) return fExtrap->NueAppComponent();
-    if(from == -14 && to == -12) return fExtrap->AntiNueAppComponent();
-
-    if(from == +14 && to == +14) return fExtrap->NumuSurvComponent();
-    if(from == -14 && to == -14) return fExtrap->AntiNumuSurvComponent();
-
-    if(from == +14 && to == +16) return fExtrap->TauFromMuComponent();
-    if(from == -14 && to == -16) return fExtrap->AntiTauFromMuComponent();
-
-    assert(0 && "Not reached");
-    throw;//shuts up compiler error.
+    return fExtrap->CCComponentRef(from, to);
   }
 
   //----------------------------------------------------------------------
   // NC components:
   Spectrum PredictionExtrap::ComponentNCTotal() const 
   {
-    return fExtrap->NCTotalComponent();
+    return fExtrap->NCTotalComponentRef();
   }
   Spectrum PredictionExtrap::ComponentNC() const
   {
-    return fExtrap->NCComponent();
+    return fExtrap->NCComponentRef();
   }
   Spectrum PredictionExtrap::ComponentNCAnti() const
   {
-    return fExtrap->NCAntiComponent();
+    return fExtrap->NCAntiComponentRef();
   }
   // End NC components.
   //----------------------------------------------------------------------
@@ -7,13 +7,14 @@
 #include "CAFAna/Core/Ratio.h"
 #include "CAFAna/Core/Registry.h"
 #include "CAFAna/Core/Stan.h"
+#include "CAFAna/Core/ThreadPool.h"
 #include "CAFAna/Core/Utilities.h"
 
 #include "TDirectory.h"
 #include "TH2.h"
-#include "TMatrixD.h"
 #include "TObjString.h"
 #include "TVectorD.h"
+#include "TVirtualMutex.h"
 
 // For debug plots
 #include "TGraph.h"
@@ -22,9 +23,15 @@
 #include "OscLib/IOscCalc.h"
 #include "CAFAna/Core/StanUtils.h"
 
+#include <Eigen/Dense>
+
 #include "CAFAna/Core/Loaders.h"
 
 #include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <mutex>
+#include <thread>
 
 #include <malloc.h>
 
@@ -36,6 +43,39 @@ namespace ana
 {
   REGISTER_LOADFROM("PredictionInterp", IPrediction, PredictionInterp);
 
+  namespace
+  {
+    /// \brief Layout of the coefficients \ref PredictionInterp::SaveCoeffs
+    /// writes
+    ///
+    /// 1: [type][shift bin][histogram bin][a, b, c, d], and untagged
+    /// 2: [type][shift bin][a, b, c, d][histogram bin]
+    const int kCoeffsLayout = 2;
+
+    /// MD5 of the saved "osc_origin" in \a dir, to tie coefficients to it
+    TString OscOriginMD5(TDirectory* dir)
+    {
+      TDirectory* oscDir = dir->GetDirectory("osc_origin");
+      if(!oscDir) return "";
+
+      TMD5 md5;
+
+      TObjString* tag = (TObjString*)oscDir->Get("type");
+      if(tag) md5.Update((const UChar_t*)tag->GetString().Data(), tag->GetString().Length());
+
+      TVectorD* params = (TVectorD*)oscDir->Get("params");
+      if(params) md5.Update((const UChar_t*)params->GetMatrixArray(), params->GetNrows()*sizeof(double));
+
+      md5.Final();
+
+      delete tag;
+      delete params;
+      delete oscDir;
+
+      return md5.AsString();
+    }
+  }
+
   //----------------------------------------------------------------------
   PredictionInterp::PredictionInterp(std::vector<const ISyst*> systs,
                                      osc::IOscCalc* osc,
@@ -89,9 +129,10 @@ namespace ana
   }
 
   //----------------------------------------------------------------------
-  std::vector<std::vector<PredictionInterp::Coeffs>> PredictionInterp::
-  FitRatios(const std::vector<double>& shifts,
-            const std::vector<Eigen::ArrayXd>& ratios) const
+  void PredictionInterp::FitRatios(const std::vector<double>& shifts,
+                                   const std::vector<Eigen::ArrayXd>& ratios,
+                                   PredIntKern::SoACoeffs& block,
+                                   size_t firstSlot) const
   {
     if(ratios.size() < 2){
       std::cout << "PredictionInterp::FitRatios(): ratios.size() = " << ratios.size() << " - how did that happen?" << std::endl;
@@ -101,75 +142,6 @@ namespace ana
 
     assert(shifts.size() == ratios.size());
 
-    std::vector<std::vector<Coeffs>> ret;
-
-    const int binMax = ratios[0].size();
-
-    for(int binIdx = 0; binIdx < binMax; ++binIdx){
-      ret.push_back({});
-
-      // This is cubic interpolation. For each adjacent set of four points we
-      // determine coefficients for a cubic which will be the curve between the
-      // center two. We constrain the function to match the two center points
-      // and to have the right mean gradient at them. This causes this patch to
-      // match smoothly with the next one along. The resulting function is
-      // continuous and first and second differentiable. At the ends of the
-      // range we fit a quadratic instead with only one constraint on the
-      // slope. The coordinate conventions are that point y1 sits at x=0 and y2
-      // at x=1. The matrices are simply the inverses of writing out the
-      // constraints expressed above.
-
-      // Special-case for linear interpolation
-      if(ratios.size() == 2){
-        const double y0 = ratios[0][binIdx];
-        const double y1 = ratios[1][binIdx];
-
-        ret.back().emplace_back(0, 0, y1-y0, y0);
-        continue;
-      }
-
-      {
-        const double y1 = ratios[0][binIdx];
-        const double y2 = ratios[1][binIdx];
-        const double y3 = ratios[2][binIdx];
-        const double v[3] = {y1, y2, (y3-y1)/2};
-        const double m[9] = { 1, -1,  1,
-                             -2,  2, -1,
-                              1,  0,  0};
-        const TVectorD res = TMatrixD(3, 3, m) * TVectorD(3, v);
-        ret.back().emplace_back(0, res(0), res(1), res(2));
-      }
-
-      // We're assuming here that the shifts are separated by exactly 1 sigma.
-      for(unsigned int shiftIdx = 1; shiftIdx < ratios.size()-2; ++shiftIdx){
-        const double y0 = ratios[shiftIdx-1][binIdx];
-        const double y1 = ratios[shiftIdx  ][binIdx];
-        const double y2 = ratios[shiftIdx+1][binIdx];
-        const double y3 = ratios[shiftIdx+2][binIdx];
-
-        const double v[4] = {y1, y2, (y2-y0)/2, (y3-y1)/2};
-        const double m[16] = { 2, -2,  1,  1,
-                              -3,  3, -2, -1,
-                               0,  0,  1,  0,
-                               1,  0,  0,  0};
-        const TVectorD res = TMatrixD(4, 4, m) * TVectorD(4, v);
-        ret.back().emplace_back(res(0), res(1), res(2), res(3));
-      } // end for shiftIdx
-
-      {
-        const int N = ratios.size()-3;
-        const double y0 = ratios[N  ][binIdx];
-        const double y1 = ratios[N+1][binIdx];
-        const double y2 = ratios[N+2][binIdx];
-        const double v[3] = {y1, y2, (y2-y0)/2};
-        const double m[9] = {-1,  1, -1,
-                              0,  0,  1,
-                              1,  0,  0};
-        const TVectorD res = TMatrixD(3, 3, m) * TVectorD(3, v);
-        ret.back().emplace_back(0, res(0), res(1), res(2));
-      }
-    } // end for binIdx
-
     double stride = -1;
     for(unsigned int i = 0; i < shifts.size()-1; ++i){
       const double newStride = shifts[i+1]-shifts[i];
@@ -179,23 +151,86 @@ namespace ana
     }
 
     // If the stride is actually not 1, need to rescale all the coefficients
-    for(std::vector<Coeffs>& cs: ret)
-      for(Coeffs& c: cs){
-        c = Coeffs(c.a/util::cube(stride),
-                   c.b/util::sqr(stride),
-                   c.c/stride,
-                   c.d);}
-    return ret;
+    const Eigen::Vector4d scale(util::cube(stride), util::sqr(stride), stride, 1);
+
+    // This is cubic interpolation. For each adjacent set of four points we
+    // determine coefficients for a cubic which will be the curve between the
+    // center two. We constrain the function to match the two center points
+    // and to have the right mean gradient at them. This causes this patch to
+    // match smoothly with the next one along. The resulting function is
+    // continuous and first and second differentiable. At the ends of the
+    // range we fit a quadratic instead with only one constraint on the
+    // slope. The coordinate conventions are that point y1 sits at x=0 and y2
+    // at x=1. The matrices are simply the inverses of writing out the
+    // constraints expressed above.
+    static const Eigen::Matrix3d kFirst = (Eigen::Matrix3d() <<  1, -1,  1,
+                                                                -2,  2, -1,
+                                                                 1,  0,  0).finished();
+    static const Eigen::Matrix4d kInner = (Eigen::Matrix4d() <<  2, -2,  1,  1,
+                                                                -3,  3, -2, -1,
+                                                                 0,  0,  1,  0,
+                                                                 1,  0,  0,  0).finished();
+    static const Eigen::Matrix3d kLast  = (Eigen::Matrix3d() << -1,  1, -1,
+                                                                 0,  0,  1,
+                                                                 1,  0,  0).finished();
+
+    const unsigned int nBins = ratios[0].size();
+    assert(nBins == block.NBins());
+    const unsigned int rowStride = block.Stride();
+
+    // One cubic between each pair of adjacent shifts
+    const int nCoeffs = ratios.size()-1;
+
+    for(int shiftBin = 0; shiftBin < nCoeffs; ++shiftBin){
+      double* a = block.Slot(firstSlot + shiftBin);
+      double* b = a + rowStride;
+      double* c = b + rowStride;
+      double* d = c + rowStride;
+
+      // We're assuming here that the shifts are separated by exactly 1 sigma.
+      // The neighbours outside this pair, where they exist
+      const Eigen::ArrayXd& r1 = ratios[shiftBin];
+      const Eigen::ArrayXd& r2 = ratios[shiftBin+1];
+      const Eigen::ArrayXd& r0 = ratios[shiftBin > 0 ? shiftBin-1 : shiftBin];
+      const Eigen::ArrayXd& r3 = ratios[shiftBin+2 < int(ratios.size()) ? shiftBin+2 : shiftBin+1];
+
+      for(unsigned int bin = 0; bin < nBins; ++bin){
+        const double y0 = r0[bin], y1 = r1[bin], y2 = r2[bin], y3 = r3[bin];
+
+        Eigen::Vector4d res;
+        if(nCoeffs == 1){
+          // Special-case for linear interpolation
+          res << 0, 0, y2-y1, y1;
+        }
+        else if(shiftBin == 0){
+          res << 0, kFirst * Eigen::Vector3d(y1, y2, (y3-y1)/2);
+        }
+        else if(shiftBin == nCoeffs-1){
+          res << 0, kLast * Eigen::Vector3d(y1, y2, (y2-y0)/2);
+        }
+        else{
+          res = kInner * Eigen::Vector4d(y1, y2, (y2-y0)/2, (y3-y1)/2);
+        }
+
+        res = res.cwiseQuotient(scale);
+
+        a[bin] = res[0];
+        b[bin] = res[1];
+        c[bin] = res[2];
+        d[bin] = res[3];
+      } // end for bin
+    } // end for shiftBin
   }
 
   //----------------------------------------------------------------------
-  std::vector<std::vector<PredictionInterp::Coeffs>> PredictionInterp::
-  FitComponent(const std::vector<double>& shifts,
-               const std::vector<std::unique_ptr<IPrediction>>& preds,
-               Flavors::Flavors_t flav,
-               Current::Current_t curr,
-               Sign::Sign_t sign,
-               const std::string& systName) const
+  void PredictionInterp::FitComponent(const std::vector<double>& shifts,
+                                      const std::vector<std::unique_ptr<IPrediction>>& preds,
+                                      osc::IOscCalc* calc,
+                                      Flavors::Flavors_t flav,
+                                      Current::Current_t curr,
+                                      Sign::Sign_t sign,
+                                      PredIntKern::SoACoeffs& block,
+                                      size_t firstSlot) const
   {
     IPrediction const *pNom = nullptr;
     for(unsigned int i = 0; i < shifts.size(); ++i){
@@ -206,14 +241,12 @@ namespace ana
     // Do it this way rather than via fPredNom so that systematics evaluated
     // relative to some alternate nominal (eg Birks C where the appropriate
     // nominal is no-rock) can work.
-    const Spectrum nom = pNom->PredictComponent(fOscOrigin.get(),
-                                                flav, curr, sign);
+    const Spectrum nom = pNom->PredictComponent(calc, flav, curr, sign);
 
     std::vector<Eigen::ArrayXd> ratios;
     ratios.reserve(preds.size());
     for(auto& p: preds){
-      ratios.emplace_back(Ratio(p->PredictComponent(fOscOrigin.get(),
-                                                    flav, curr, sign),
+      ratios.emplace_back(Ratio(p->PredictComponent(calc, flav, curr, sign),
                                 nom).GetEigen());
 
       // Check none of the ratio values is crazy
@@ -229,89 +262,320 @@ namespace ana
       }
     }
 
-    return FitRatios(shifts, ratios);
+    FitRatios(shifts, ratios, block, firstSlot);
   }
 
   //----------------------------------------------------------------------
-  void PredictionInterp::InitFitsHelper(ShiftedPreds& sp,
-                                        std::vector<std::vector<std::vector<Coeffs>>>& fits,
-                                        Sign::Sign_t sign) const
+  void PredictionInterp::InitFitsHelper(const ShiftedPreds& sp,
+                                        osc::IOscCalc* calc,
+                                        bool nubar) const
   {
-    fits.resize(kNCoeffTypes);
+    const Sign::Sign_t sign = fSplitBySign ? (nubar ? Sign::kAntiNu : Sign::kNu) : Sign::kBoth;
+
+    auto fit = [&](CoeffsType type, Flavors::Flavors_t flav, Current::Current_t curr)
+    {
+      FitComponent(sp.shifts, sp.preds, calc, flav, curr, sign,
+                   fCoeffs[nubar][type], sp.firstSlot);
+    };
 
-    fits[kNueApp]   = FitComponent(sp.shifts, sp.preds, Flavors::kNuMuToNuE,  Current::kCC, sign, sp.systName);
-    fits[kNueSurv]  = FitComponent(sp.shifts, sp.preds, Flavors::kNuEToNuE,   Current::kCC, sign, sp.systName);
-    fits[kNumuSurv] = FitComponent(sp.shifts, sp.preds, Flavors::kNuMuToNuMu, Current::kCC, sign, sp.systName);
+    fit(kNueApp,   Flavors::kNuMuToNuE,  Current::kCC);
+    fit(kNueSurv,  Flavors::kNuEToNuE,   Current::kCC);
+    fit(kNumuSurv, Flavors::kNuMuToNuMu, Current::kCC);
 
-    fits[kNC]       = FitComponent(sp.shifts, sp.preds, Flavors::kAll, Current::kNC, sign, sp.systName);
+    fit(kNC,       Flavors::kAll, Current::kNC);
 
-    fits[kOther] = FitComponent(sp.shifts, sp.preds, Flavors::kNuEToNuMu | Flavors::kAllNuTau, Current::kCC, sign, sp.systName);
+    fit(kOther,    Flavors::kNuEToNuMu | Flavors::kAllNuTau, Current::kCC);
   }
 
   //----------------------------------------------------------------------
-  void PredictionInterp::InitFits() const
+  void PredictionInterp::CopySavedCoeffs(ShiftedPreds& sp) const
   {
-    // No systs
-    if(fPreds.empty()){
-      if(fBinning.POT() > 0 || fBinning.Livetime() > 0) return;
+    const unsigned int nBins = fCoeffs[0][0].NBins();
+    const size_t nPerSign = size_t(kNCoeffTypes)*sp.nCoeffs*4*nBins;
+
+    if(sp.savedCoeffs.size() != (fSplitBySign ? 2 : 1)*nPerSign){
+      std::cout << "PredictionInterp: saved coefficients of " << sp.systName
+                << " don't match the binning of the nominal prediction" << std::endl;
+      abort();
     }
+
+    const double* in = sp.savedCoeffs.data();
+    for(int nubar = 0; nubar < (fSplitBySign ? 2 : 1); ++nubar){
+      for(int type = 0; type < kNCoeffTypes; ++type){
+        PredIntKern::SoACoeffs& block = fCoeffs[nubar][type];
+        for(int shiftBin = 0; shiftBin < sp.nCoeffs; ++shiftBin){
+          double* slot = block.Slot(sp.firstSlot + shiftBin);
+          // Rows a, b, c, d
+          for(int row = 0; row < 4; ++row){
+            std::copy(in, in+nBins, slot + row*block.Stride());
+            in += nBins;
+          }
+        }
+      }
+    }
+
+    sp.savedCoeffs.clear();
+    sp.savedCoeffs.shrink_to_fit();
+  }
+
+  //----------------------------------------------------------------------
+  void PredictionInterp::FindActiveBins(ShiftedPreds& sp) const
+  {
+    for(int nubar = 0; nubar < 2; ++nubar){
+      for(int type = 0; type < kNCoeffTypes; ++type){
+        const PredIntKern::SoACoeffs& block = fCoeffs[nubar][type];
+        // The nubar blocks are empty unless split by sign
+        const unsigned int nBins = block.NSlots() ? block.NBins() : 0;
+        const unsigned int stride = block.Stride();
+
+        unsigned int first = nBins, last = 0;
+        for(int shiftBin = 0; shiftBin < sp.nCoeffs && nBins > 0; ++shiftBin){
+          const double* a = block.Slot(sp.firstSlot + shiftBin);
+          const double* b = a + stride;
+          const double* c = b + stride;
+          const double* d = c + stride;
+
+          // A syst that doesn't change this component has ratios of exactly
+          // 1, which FitRatios() turns into exactly 0, 0, 0, 1. NaNs count as
+          // active.
+          for(unsigned int n = 0; n < nBins; ++n){
+            if(a[n] != 0 || b[n] != 0 || c[n] != 0 || d[n] != 1){
+              first = std::min(first, n);
+              last = std::max(last, n+1);
+            }
+          }
+        } // end for shiftBin
+
+        if(first >= last){
+          first = last = 0;
+        }
+        else{
+          // The kernels need aligned starts
+          first -= first % PredIntKern::kKernelChunk;
+        }
+
+        sp.active.first[nubar][type] = first;
+        sp.active.last[nubar][type] = last;
+      } // end for type
+    } // end for nubar
+  }
+
+  //----------------------------------------------------------------------
+  void PredictionInterp::InitFits() const
+  {
     // Already initialized
-    else if(!fPreds.empty() && !fPreds.begin()->second.fits.empty()) return;
+    if(fFitsInitialized.load(std::memory_order_acquire)) return;
+
+    std::lock_guard<std::mutex> lock(fInitMutex);
+    // Someone else got here first
+    if(fFitsInitialized.load(std::memory_order_relaxed)) return;
+
+    // Predict something, anything, so that we can know what binning to use
+    fBinning = fPredNom->Predict(fOscOrigin.get());
+    const unsigned int nBins = fBinning.GetEigen(fBinning.POT()).size();
+    fBinning.Clear();
 
+    // Lay out the slots, and allocate all the fits in their final places
+    size_t nSlots = 0;
+    std::vector<ShiftedPreds*> toFit;
     for(auto& it: fPreds){
       ShiftedPreds& sp = it.second;
-
-      if(fSplitBySign){
-        InitFitsHelper(sp, sp.fits, Sign::kNu);
-        InitFitsHelper(sp, sp.fitsNubar, Sign::kAntiNu);
+      if(sp.shifts.size() < 2){
+        std::cout << "PredictionInterp: " << sp.systName << " has "
+                  << sp.shifts.size() << " shifts, can't interpolate it" << std::endl;
+        abort();
       }
-      else{
-        InitFitsHelper(sp, sp.fits, Sign::kBoth);
+      // FitRatios() gives one set fewer than there are shifts
+      sp.nCoeffs = sp.shifts.size()-1;
+      sp.firstSlot = nSlots;
+      nSlots += sp.nCoeffs;
+
+      // Everything, until FindActiveBins() knows better
+      for(int nubar = 0; nubar < 2; ++nubar){
+        for(int type = 0; type < kNCoeffTypes; ++type){
+          sp.active.first[nubar][type] = 0;
+          sp.active.last[nubar][type] = nBins;
+        }
       }
-      sp.nCoeffs = sp.fits[0][0].size();
 
-      // Copy the outputs into the remapped indexing order. TODO this is very
-      // ugly. Best would be to generate things in this order natively.
+      sp.fitted->store(false, std::memory_order_relaxed);
 
-      sp.fitsRemap.resize(sp.fits.size());
-      for(auto& it: sp.fitsRemap){
-        it.resize(sp.fits[0][0].size());
-        for(auto& it2: it) it2.resize(sp.fits[0].size(), Coeffs(0, 0, 0, 0));
-      }
+      if(sp.savedCoeffs.empty()){
+        // On first use, see FitLazily()
+        if(fLazy) continue;
 
-      for(unsigned int i = 0; i < sp.fitsRemap.size(); ++i){
-        for(unsigned int j = 0; j < sp.fitsRemap[i].size(); ++j){
-          for(unsigned int k = 0; k < sp.fitsRemap[i][j].size(); ++k){
-            sp.fitsRemap[i][j][k] = sp.fits[i][k][j];
+        for(const std::unique_ptr<IPrediction>& pred: sp.preds){
+          if(!pred){
+            std::cout << "PredictionInterp: can't fit " << sp.systName
+                      << " without its shifted predictions (after MinimizeMemory()"
+                      << " or a coefficients-only load)" << std::endl;
+            abort();
           }
         }
+        toFit.push_back(&sp);
       }
+    }
 
-      sp.fitsNubarRemap.resize(sp.fitsNubar.size());
-      for(auto& it: sp.fitsNubarRemap){
-        it.resize(sp.fitsNubar[0][0].size());
-        for(auto& it2: it) it2.resize(sp.fitsNubar[0].size(), Coeffs(0, 0, 0, 0));
+    for(int nubar = 0; nubar < 2; ++nubar){
+      for(int type = 0; type < kNCoeffTypes; ++type){
+        if(nubar && !fSplitBySign)
+          fCoeffs[nubar][type].Reset(0, 0);
+        else
+          fCoeffs[nubar][type].Reset(nBins, nSlots);
       }
+    }
 
-      for(unsigned int i = 0; i < sp.fitsNubarRemap.size(); ++i){
-        for(unsigned int j = 0; j < sp.fitsNubarRemap[i].size(); ++j){
-          for(unsigned int k = 0; k < sp.fitsNubarRemap[i][j].size(); ++k){
-            sp.fitsNubarRemap[i][j][k] = sp.fitsNubar[i][k][j];
-          }
-        }
+    for(auto& it: fPreds){
+      if(it.second.savedCoeffs.empty()) continue;
+      CopySavedCoeffs(it.second);
+      FindActiveBins(it.second);
+      it.second.fitted->store(true, std::memory_order_relaxed);
+    }
+
+    unsigned int nThreads = std::max(1u, std::thread::hardware_concurrency());
+    if(getenv("CAFANA_PREDINTERP_NTHREADS"))
+      nThreads = std::max(1, atoi(getenv("CAFANA_PREDINTERP_NTHREADS")));
+    nThreads = std::min<size_t>(nThreads, toFit.size());
+
+    // The shifted predictions may make histograms along the way (PRISM
+    // does). Turning on ROOT's thread safety affects the whole process, so is
+    // left to the caller, and without it the fits are done one by one
+    if(nThreads > 1 && !gGlobalMutex){
+      static std::once_flag warned;
+      std::call_once(warned, [](){
+        std::cerr << "PredictionInterp: ROOT::EnableThreadSafety() hasn't been called, "
+                  << "so fitting the systematics one at a time" << std::endl;
+      });
+      nThreads = 1;
+    }
+
+    // Each syst only touches its own predictions and its own slots. The
+    // calculator is copied because calculators cache internally.
+    auto fitSyst = [this](ShiftedPreds* sp)
+    {
+      std::unique_ptr<osc::IOscCalc> calc(fOscOrigin->Copy());
+      InitFitsHelper(*sp, calc.get(), false);
+      if(fSplitBySign) InitFitsHelper(*sp, calc.get(), true);
+      FindActiveBins(*sp);
+      sp->fitted->store(true, std::memory_order_relaxed);
+    };
+
+    if(nThreads > 1){
+      DontAddDirectory guard;
+
+      ThreadPool pool(nThreads);
+      for(ShiftedPreds* sp: toFit) pool.AddTask([&fitSyst, sp](){fitSyst(sp);});
+      pool.Finish();
+    }
+    else{
+      for(ShiftedPreds* sp: toFit) fitSyst(sp);
+    }
+
+    // Invalidates everything in fShiftCache, once the new coefficients are
+    // in place
+    fCoeffsGen.fetch_add(1, std::memory_order_release);
+
+    fFitsInitialized.store(true, std::memory_order_release);
+  }
+
+  //----------------------------------------------------------------------
+  void PredictionInterp::FitLazily(PredMappedType& it) const
+  {
+    ShiftedPreds& sp = it.second;
+
+    if(sp.fitted->load(std::memory_order_acquire)) return;
+
+    std::lock_guard<std::mutex> lock(fInitMutex);
+    // Someone else got here first
+    if(sp.fitted->load(std::memory_order_relaxed)) return;
+
+    assert(fLazy);
+
+    TDirectory::TContext ctx;
+
+    if(fLazy->coeffs){
+      TDirectory* coeffsDir = LazyDir()->GetDirectory("coeffs");
+      int nBins = fCoeffs[0][0].NBins();
+      if(coeffsDir) LoadCoeffs(coeffsDir, sp, fSplitBySign, nBins);
+      delete coeffsDir;
+    }
+
+    if(!sp.savedCoeffs.empty()){
+      CopySavedCoeffs(sp);
+    }
+    else{
+      LoadLazyPreds(it);
+
+      std::unique_ptr<osc::IOscCalc> calc(fOscOrigin->Copy());
+      InitFitsHelper(sp, calc.get(), false);
+      if(fSplitBySign) InitFitsHelper(sp, calc.get(), true);
+    }
+
+    FindActiveBins(sp);
+    sp.fitted->store(true, std::memory_order_release);
+  }
+
+  //----------------------------------------------------------------------
+  void PredictionInterp::LoadLazyPreds(PredMappedType& it) const
+  {
+    ShiftedPreds& sp = it.second;
+
+    // Still in memory, and now the most recently used
+    if(!sp.preds.empty() && sp.preds[0]){
+      fResident.remove(it.first);
+      fResident.push_front(it.first);
+      return;
+    }
+
+    assert(fLazy);
+
+    TDirectory::TContext ctx;
+    TDirectory* dir = LazyDir();
+
+    sp.preds.clear();
+    for(double shift: sp.shifts){
+      const std::string subname = TString::Format("pred_%s_%+d", sp.systName.c_str(), int(shift)).Data();
+      sp.preds.emplace_back(ana::LoadFrom<IPrediction>(dir, subname));
+    }
+
+    // Never evict the syst just loaded, it's about to be used
+    fResident.push_front(it.first);
+    while(fResident.size() > std::max(1u, fLazy->maxResident)){
+      auto evict = find_pred(fResident.back());
+      if(evict != fPreds.end()) evict->second.preds.clear();
+      fResident.pop_back();
+    }
+  }
+
+  //----------------------------------------------------------------------
+  TDirectory* PredictionInterp::LazyDir() const
+  {
+    if(!fLazy->file){
+      fLazy->file.reset(TFile::Open(fLazy->fileName.c_str(), "READ"));
+      if(!fLazy->file || fLazy->file->IsZombie()){
+        std::cout << "PredictionInterp: can't reopen " << fLazy->fileName
+                  << " to load systs from" << std::endl;
+        abort();
       }
 
+      fLazy->dir = fLazy->dirName.empty() ? fLazy->file.get() : fLazy->file->GetDirectory(fLazy->dirName.c_str());
+      if(!fLazy->dir){
+        std::cout << "PredictionInterp: " << fLazy->dirName << " not found in "
+                  << fLazy->fileName << std::endl;
+        abort();
+      }
     }
 
-    // Predict something, anything, so that we can know what binning to use
-    fBinning = fPredNom->Predict(fOscOrigin.get());
-    fBinning.Clear();
+    return fLazy->dir;
   }
 
   //----------------------------------------------------------------------
   void PredictionInterp::SetOscSeed(osc::IOscCalc* oscSeed){
     fOscOrigin.reset(oscSeed->Copy());
-    for(auto& it: fPreds) it.second.fits.clear();
+    // Any saved coefficients were fitted at the old seed, so lazy systs have
+    // to be fitted afresh from their shifted predictions
+    if(fLazy) fLazy->coeffs = false;
+    fFitsInitialized = false;
     InitFits();
   }
 
@@ -396,6 +660,196 @@ namespace ana
     }
   }
 
+  //----------------------------------------------------------------------
+  void PredictionInterp::MultiplyCubics(const std::vector<PredIntKern::ActiveShift>& active,
+                                        unsigned int N,
+                                        unsigned int stride,
+                                        double* prod) const
+  {
+    // Work is split into a grid of (group of systs) x (chunk of bins). Each
+    // group multiplies into its own row of part, and the rows are then
+    // multiplied together bin by bin. With only one group (always the case
+    // without OpenMP) this is exactly the serial calculation.
+    const PredIntKern::ActiveShift* act = active.data();
+    const unsigned int nActive = active.size();
+    const unsigned int nChunks = (N+PredIntKern::kKernelChunk-1)/PredIntKern::kKernelChunk;
+    unsigned int nGroups = 1;
+    bool parallel = false;
+
+#ifdef USE_PREDINTERP_OMP
+    const unsigned int nThreads = omp_get_max_threads();
+    parallel = (nThreads > 1 && size_t(nActive)*N >= kMinParallelWork);
+    // Only split the systs once there are more threads than chunks of bins
+    if(parallel) nGroups = std::max(1u, std::min(nActive, nThreads/nChunks));
+#endif
+
+    thread_local std::vector<double> partBuf;
+    partBuf.assign(size_t(nGroups)*N, 1);
+    // Not partBuf itself inside the parallel region, that's per-thread
+    double* part = partBuf.data();
+
+#ifdef USE_PREDINTERP_OMP
+    #pragma omp parallel for collapse(2) schedule(static) if(parallel)
+#endif
+    for(unsigned int g = 0; g < nGroups; ++g){
+      for(unsigned int c = 0; c < nChunks; ++c){
+        const unsigned int s0 = size_t(nActive)*g/nGroups;
+        const unsigned int s1 = size_t(nActive)*(g+1)/nGroups;
+        const unsigned int first = c*PredIntKern::kKernelChunk;
+        const unsigned int last = std::min(N, first+PredIntKern::kKernelChunk);
+
+        PredIntKern::ShiftSpectrumKernel(act+s0, s1-s0, first, last,
+                                         stride, part+size_t(g)*N);
+      } // end for c
+    } // end for g
+
+    for (unsigned int n = 0; n < N; ++n) {
+      double p = part[n];
+      for(unsigned int g = 1; g < nGroups; ++g) p *= part[size_t(g)*N+n];
+      prod[n] = p;
+    }
+  }
+
+  //----------------------------------------------------------------------
+  static bool IncrementalShiftsEnabled()
+  {
+    const char* env = getenv("CAFANA_PREDINTERP_INCREMENTAL");
+    return !env || std::string(env) != "0";
+  }
+
+  //----------------------------------------------------------------------
+  void PredictionInterp::CorrectionFactors(unsigned int N,
+                                           double* corr,
+                                           CoeffsType type,
+                                           bool nubar,
+                                           const SystShifts& shift) const
+  {
+    if(nubar) assert(fSplitBySign);
+
+    const PredIntKern::SoACoeffs& block = fCoeffs[nubar][type];
+    assert(fPreds.empty() || block.NBins() == N);
+
+    const size_t NPreds = fPreds.size();
+
+    // The product from the last call (on this thread), and the dials it was
+    // evaluated at
+    ShiftCache& cache = fShiftCache->entries[nubar][type];
+
+    // Systs that never change this component might as well be at zero. So
+    // might those not fitted yet, which CheckSysts() would have fitted if
+    // they were shifted. Their slots and ranges may be being written by a
+    // FitLazily() on another thread, so are only read after that finishes.
+    auto affects = [nubar, type](const ShiftedPreds& sp)
+      {
+        return (sp.fitted->load(std::memory_order_acquire) &&
+                sp.active.first[nubar][type] < sp.active.last[nubar][type]);
+      };
+
+    thread_local std::vector<double> xs;
+    xs.resize(NPreds);
+    size_t nActive = 0;
+    for (size_t p_it = 0; p_it < NPreds; ++p_it) {
+      const ShiftedPreds& sp = fPreds[p_it].second;
+      xs[p_it] = affects(sp) ? shift.GetShiftByIndex(fPreds[p_it].first->DenseIndex()) : 0;
+      if(xs[p_it] != 0) ++nActive;
+    }
+
+    static const bool allowIncremental = IncrementalShiftsEnabled();
+
+    // Pairs with the increment after any change to the coefficients
+    const unsigned long gen = fCoeffsGen.load(std::memory_order_acquire);
+
+    bool incremental = (allowIncremental &&
+                        cache.gen == gen &&
+                        cache.xs.size() == NPreds &&
+                        cache.prod.size() == N &&
+                        cache.nUpdates < kMaxIncrementalUpdates);
+
+    if(incremental){
+      // Dividing a dial out costs as much as multiplying it in, so only worth
+      // it when few have changed (typically one, for a Minuit gradient)
+      size_t nEvals = 0;
+      for (size_t p_it = 0; p_it < NPreds; ++p_it) {
+        if(xs[p_it] == cache.xs[p_it]) continue;
+        nEvals += (xs[p_it] != 0) + (cache.xs[p_it] != 0);
+      }
+      if(2*nEvals > nActive) incremental = false;
+    }
+
+    auto makeActive = [&block, nubar, type](const ShiftedPreds& sp, double x)
+      {
+        int shiftBin = (x - sp.shifts[0])/sp.Stride();
+        shiftBin = std::max(0, shiftBin);
+        shiftBin = std::min(shiftBin, sp.nCoeffs - 1);
+
+        x -= sp.shifts[shiftBin];
+
+        return PredIntKern::ActiveShift{block.Slot(sp.firstSlot + shiftBin),
+                                        x, util::sqr(x), util::cube(x),
+                                        sp.active.first[nubar][type],
+                                        sp.active.last[nubar][type]};
+      };
+
+    thread_local std::vector<PredIntKern::ActiveShift> added, removed;
+    added.clear();
+    removed.clear();
+
+    if(incremental){
+      for (size_t p_it = 0; p_it < NPreds; ++p_it) {
+        const double x = xs[p_it], oldx = cache.xs[p_it];
+        if(x == oldx) continue;
+
+        const ShiftedPreds &sp = fPreds[p_it].second;
+        // Zero dials are skipped entirely, as in the full calculation
+        if(x != 0) added.push_back(makeActive(sp, x));
+        if(oldx != 0) removed.push_back(makeActive(sp, oldx));
+      } // end for syst
+
+      if(!added.empty() || !removed.empty()){
+        thread_local std::vector<double> newBuf, oldBuf;
+        newBuf.resize(N);
+        oldBuf.resize(N);
+        MultiplyCubics(added, N, block.Stride(), newBuf.data());
+        MultiplyCubics(removed, N, block.Stride(), oldBuf.data());
+
+        // Can't divide out a (near) zero, or recover from a NaN
+        for (unsigned int n = 0; n < N; ++n) {
+          if(!(std::abs(oldBuf[n]) >= kMinIncrementalDivisor) ||
+             !std::isfinite(cache.prod[n])){
+            incremental = false;
+            break;
+          }
+        }
+
+        if(incremental){
+          for (unsigned int n = 0; n < N; ++n)
+            cache.prod[n] *= newBuf[n]/oldBuf[n];
+          ++cache.nUpdates;
+        }
+      }
+    }
+
+    if(!incremental){
+      added.clear();
+      for (size_t p_it = 0; p_it < NPreds; ++p_it) {
+        if(xs[p_it] == 0) continue;
+        added.push_back(makeActive(fPreds[p_it].second, xs[p_it]));
+      } // end for syst
+
+      cache.prod.resize(N);
+      MultiplyCubics(added, N, block.Stride(), cache.prod.data());
+      cache.nUpdates = 0;
+      cache.gen = gen;
+    }
+
+    cache.xs.assign(xs.begin(), xs.end());
+
+    for (unsigned int n = 0; n < N; ++n) {
+      const double c = cache.prod[n];
+      corr[n] = (c > 0.) ? c : 0.;
+    }
+  }
+
   //----------------------------------------------------------------------
   template <typename T>
   void PredictionInterp::ShiftBins(unsigned int N,
@@ -415,69 +869,59 @@ namespace ana
       abort();
     }
 
-#ifdef USE_PREDINTERP_OMP
-    T corr[4][N];
-    for (unsigned int i = 0; i < 4; ++i) {
-      for (unsigned int j = 0; j < N; ++j) {
-        corr[i][j] = 1;
-      };
+    if constexpr(std::is_same_v<T, double>){
+      double corr[N];
+      CorrectionFactors(N, corr, type, nubar, shift);
+
+      for (unsigned int n = 0; n < N; ++n) {
+        if (arr[n] > fMinMCStats) arr[n] *= corr[n];
+      }
     }
-#else
-    T corr[N];
-    for(unsigned int i = 0; i < N; ++i) corr[i] = 1;
-#endif
+    else{
+      // Stan's autodiff stack belongs to the calling thread, so vars can't be
+      // operated on from OpenMP workers. Always serial.
+      const PredIntKern::SoACoeffs& block = fCoeffs[nubar][type];
+      assert(fPreds.empty() || block.NBins() == N);
 
-    size_t NPreds = fPreds.size();
+      size_t NPreds = fPreds.size();
 
-#ifdef USE_PREDINTERP_OMP
-    #pragma omp parallel for
-#endif
-    for (size_t p_it = 0; p_it < NPreds; ++p_it) {
-      const ISyst *syst = fPreds[p_it].first;
-      const ShiftedPreds &sp = fPreds[p_it].second;
+      T corr[N];
+      for(unsigned int i = 0; i < N; ++i) corr[i] = 1;
 
-      T x = shift.GetShift<T>(syst);
+      for (size_t p_it = 0; p_it < NPreds; ++p_it) {
+        const ISyst *syst = fPreds[p_it].first;
+        const ShiftedPreds &sp = fPreds[p_it].second;
 
-      // need to actually do the calculation for the autodiff version
-      // to make sure the gradient is computed correctly
-      if(x == 0 && (!std::is_same_v<T, stan::math::var> || !shift.HasStan(syst))) continue;
+        // Outside this range the cubic is exactly 1, a constant, so skipping
+        // it changes neither the value nor the gradient
+        const unsigned int first = sp.active.first[nubar][type];
+        const unsigned int last = std::min(N, sp.active.last[nubar][type]);
+        if(first >= last) continue;
 
-      int shiftBin = (util::GetValAs<double>(x) - sp.shifts[0])/sp.Stride();
-      shiftBin = std::max(0, shiftBin);
-      shiftBin = std::min(shiftBin, sp.nCoeffs - 1);
+        T x = shift.GetShift<T>(syst);
 
-      const Coeffs *fits = nubar ? &sp.fitsNubarRemap[type][shiftBin].front()
-                                 : &sp.fitsRemap[type][shiftBin].front();
+        // need to actually do the calculation for the autodiff version
+        // to make sure the gradient is computed correctly
+        if(x == 0 && !shift.HasStan(syst)) continue;
 
-      x -= sp.shifts[shiftBin];
+        int shiftBin = (util::GetValAs<double>(x) - sp.shifts[0])/sp.Stride();
+        shiftBin = std::max(0, shiftBin);
+        shiftBin = std::min(shiftBin, sp.nCoeffs - 1);
 
-      const T x_cube = util::cube(x);
-      const T x_sqr = util::sqr(x);
+        const double *fits = block.Slot(sp.firstSlot + shiftBin);
 
-#ifdef USE_PREDINTERP_OMP
-      ShiftSpectrumKernel(fits, N, x, x_sqr, x_cube,
-                          corr[omp_get_thread_num()]);
-#else
-      ShiftSpectrumKernel(fits, N, x, x_sqr, x_cube, corr);
-#endif
-    } // end for syst
+        x -= sp.shifts[shiftBin];
 
-#ifdef USE_PREDINTERP_OMP
-    for (unsigned int i = 1; i < 4; ++i) {
-      for (unsigned int j = 0; j < N; ++j) {
-        corr[0][j] *= corr[i][j];
-      };
-    }
-#endif
+        const T x_cube = util::cube(x);
+        const T x_sqr = util::sqr(x);
 
-    for (unsigned int n = 0; n < N; ++n) {
-      if (arr[n] > fMinMCStats) {
-#ifdef USE_PREDINTERP_OMP
+        PredIntKern::ShiftSpectrumKernel(fits+first, last-first, block.Stride(),
+                                         x, x_sqr, x_cube, corr+first);
+      } // end for syst
+
+      for (unsigned int n = 0; n < N; ++n) {
         // std::max() doesn't work with stan::math::var
-        arr[n] *= (corr[0][n] > 0.) ? corr[0][n] : 0.;
-#else
-        arr[n] *= (corr[n] > 0.) ? corr[n] : 0.;
-#endif
+        if (arr[n] > fMinMCStats) arr[n] *= (corr[n] > 0.) ? corr[n] : 0.;
       }
     }
   }
@@ -524,6 +968,23 @@ namespace ana
               ShiftedComponent(calc, hash, shift, flav, curr, Sign::kNu,     type));
     }
 
+    // Should the interpolation use the nubar fits?
+    const bool nubar = (fSplitBySign && sign == Sign::kAntiNu);
+
+    std::unique_ptr<Spectrum> storage;
+    return ShiftSpectrum(NomComponent(calc, hash, flav, curr, sign, storage),
+                         type, nubar, shift);
+  }
+
+  //----------------------------------------------------------------------
+  template<typename T>
+  const Spectrum& PredictionInterp::NomComponent(osc::_IOscCalc<T>* calc,
+                                                 const TMD5* hash,
+                                                 Flavors::Flavors_t flav,
+                                                 Current::Current_t curr,
+                                                 Sign::Sign_t sign,
+                                                 std::unique_ptr<Spectrum>& storage) const
+  {
     // Must be the base case of the recursion to use the cache. Otherwise we
     // can cache systematically shifted versions of our children, which is
     // wrong. Also, some calculators won't hash themselves.
@@ -534,28 +995,341 @@ namespace ana
     const Key_t key = {flav, curr, sign};
     auto it = fNomCache->find(key);
 
-    // Should the interpolation use the nubar fits?
-    const bool nubar = (fSplitBySign && sign == Sign::kAntiNu);
-
     // We have the nominal for this exact combination of flav, curr, sign, calc
-    // stored.  Shift it and return.
+    // stored.
     if(canCache && it != fNomCache->end() && it->second.hash == *hash){
-      return ShiftSpectrum(it->second.nom, type, nubar, shift);
+      return it->second.nom;
     }
 
     // We need to compute the nominal again for whatever reason
-    const Spectrum nom = fPredNom->PredictComponent(calc, flav, curr, sign);
+    Spectrum nom = fPredNom->PredictComponent(calc, flav, curr, sign);
+
+    if(!canCache){
+      storage = std::make_unique<Spectrum>(std::move(nom));
+      return *storage;
+    }
+
+    // Insert into the cache if not already there, or update if there but
+    // with old oscillation parameters.
+    if(it == fNomCache->end())
+      it = fNomCache->emplace(key, Val_t({*hash, std::move(nom)})).first;
+    else
+      it->second = {*hash, std::move(nom)};
+
+    return it->second.nom;
+  }
+
+  //----------------------------------------------------------------------
+  unsigned int PredictionInterp::NomTerms(osc::IOscCalc* calc,
+                                          const TMD5* hash,
+                                          Flavors::Flavors_t flav,
+                                          Current::Current_t curr,
+                                          Sign::Sign_t sign,
+                                          NomTerm* terms,
+                                          std::unique_ptr<Spectrum>* storage) const
+  {
+    struct Comp{
+      Flavors::Flavors_t flav;
+      Current::Current_t curr;
+      CoeffsType type;
+    };
+
+    // Same components, in the same order, as the unfused version
+    Comp comps[7];
+    unsigned int nComps = 0;
+    if(curr & Current::kCC){
+      if(flav & Flavors::kNuEToNuE)    comps[nComps++] = {Flavors::kNuEToNuE,    Current::kCC, kNueSurv };
+      if(flav & Flavors::kNuEToNuMu)   comps[nComps++] = {Flavors::kNuEToNuMu,   Current::kCC, kOther   };
+      if(flav & Flavors::kNuEToNuTau)  comps[nComps++] = {Flavors::kNuEToNuTau,  Current::kCC, kOther   };
+
+      if(flav & Flavors::kNuMuToNuE)   comps[nComps++] = {Flavors::kNuMuToNuE,   Current::kCC, kNueApp  };
+      if(flav & Flavors::kNuMuToNuMu)  comps[nComps++] = {Flavors::kNuMuToNuMu,  Current::kCC, kNumuSurv};
+      if(flav & Flavors::kNuMuToNuTau) comps[nComps++] = {Flavors::kNuMuToNuTau, Current::kCC, kOther   };
+    }
+    if(curr & Current::kNC){
+      assert(flav == Flavors::kAll); // Don't know how to calculate anything else
+
+      comps[nComps++] = {Flavors::kAll, Current::kNC, kNC};
+    }
+
+    Sign::Sign_t signs[2] = {sign, sign};
+    unsigned int nSigns = 1;
+    if(fSplitBySign && sign == Sign::kBoth){
+      signs[0] = Sign::kAntiNu;
+      signs[1] = Sign::kNu;
+      nSigns = 2;
+    }
+
+    // The cached nominals are only referenced, not copied
+    unsigned int nTerms = 0;
+    for(unsigned int c = 0; c < nComps; ++c){
+      for(unsigned int s = 0; s < nSigns; ++s){
+        const Spectrum& nom = NomComponent(calc, hash, comps[c].flav, comps[c].curr,
+                                           signs[s], storage[nTerms]);
+        // Don't try to reproduce Spectrum's handling of these cases
+        if(nom.HasStan() || nom.POT() <= 0) return 0;
+
+        terms[nTerms++] = {&nom, comps[c].type,
+                           fSplitBySign && signs[s] == Sign::kAntiNu};
+      }
+    }
+
+    return nTerms;
+  }
+
+  //----------------------------------------------------------------------
+  void PredictionInterp::CheckSysts(const SystShifts& shift) const
+  {
+    for(const ISyst* syst: shift.ActiveSysts()){
+      auto it = find_pred(syst);
+      if(it == fPreds.end()){
+        std::cerr << "This PredictionInterp is not set up to handle the requested systematic: " << syst->ShortName() << std::endl;
+        std::cout << "Handles: " << std::endl;
+        for(auto & p : fPreds){
+          std::cout << p.first->ShortName() << std::endl;
+        }
+        abort();
+      }
+
+      FitLazily(*it);
+    } // end for syst
+  }
+
+  //----------------------------------------------------------------------
+  bool PredictionInterp::FusedComponentSyst(osc::IOscCalc* calc,
+                                            const TMD5* hash,
+                                            const SystShifts& shift,
+                                            Flavors::Flavors_t flav,
+                                            Current::Current_t curr,
+                                            Sign::Sign_t sign,
+                                            Spectrum& ret) const
+  {
+    // Fetch all the nominals first, so that we can bail out before doing any
+    // work
+    NomTerm terms[kMaxNomTerms];
+    std::unique_ptr<Spectrum> storage[kMaxNomTerms];
+    const unsigned int nTerms = NomTerms(calc, hash, flav, curr, sign, terms, storage);
+    if(nTerms == 0) return false;
+
+    const double pot = ret.POT();
+    Eigen::ArrayXd tot;
+
+    // Each correction vector is needed once per (type, sign) however many
+    // components share it
+    thread_local std::vector<double> corrBuf;
+    bool haveCorr[2][kNCoeffTypes] = {};
+
+    for(unsigned int t = 0; t < nTerms; ++t){
+      const Spectrum& nom = *terms[t].nom;
+      // Still a copy, Spectrum doesn't expose its storage
+      const Eigen::ArrayXd a = nom.GetEigen(nom.POT());
+      const unsigned int N = a.size();
+
+      if(tot.size() == 0){
+        tot = Eigen::ArrayXd::Zero(N);
+        corrBuf.resize(size_t(2)*kNCoeffTypes*N);
+      }
+      assert(tot.size() == N);
+
+      const bool nubar = terms[t].nubar;
+      const CoeffsType type = terms[t].type;
+
+      double* corr = corrBuf.data() + (size_t(nubar)*kNCoeffTypes + type)*N;
+      if(!haveCorr[nubar][type]){
+        CorrectionFactors(N, corr, type, nubar, shift);
+        haveCorr[nubar][type] = true;
+      }
+
+      // Shift, rescale to our POT, and add, as ShiftSpectrum() and
+      // Spectrum::operator+=() would
+      const double scale = pot/nom.POT();
+      for(unsigned int n = 0; n < N; ++n){
+        const double x = (a[n] > fMinMCStats) ? a[n]*corr[n] : a[n];
+        tot[n] += x*scale;
+      }
+    } // end for t
+
+    ret = Spectrum(std::move(tot),
+                   HistAxis(fBinning.GetLabels(), fBinning.GetBinnings()),
+                   pot, ret.Livetime());
+    return true;
+  }
+
+  //----------------------------------------------------------------------
+  void PredictionInterp::CorrectionGradient(unsigned int N,
+                                            const std::vector<int>& predIdx,
+                                            double* dcorr,
+                                            CoeffsType type,
+                                            bool nubar,
+                                            const SystShifts& shift) const
+  {
+    if(nubar) assert(fSplitBySign);
+
+    const PredIntKern::SoACoeffs& block = fCoeffs[nubar][type];
+    assert(fPreds.empty() || block.NBins() == N);
+    const unsigned int stride = block.Stride();
+
+    const size_t NPreds = fPreds.size();
+
+    // Which row of dcorr, if any, each syst's derivative goes in
+    thread_local std::vector<int> row;
+    row.assign(NPreds, -1);
+    for(unsigned int i = 0; i < predIdx.size(); ++i)
+      if(predIdx[i] >= 0) row[predIdx[i]] = i;
+
+    // Every dial that's set, and every one we want the derivative of. The
+    // cubic (f) and its derivative (df) for each of them
+    thread_local std::vector<size_t> involved;
+    thread_local std::vector<double> f, df;
+    involved.clear();
+    for(size_t p_it = 0; p_it < NPreds; ++p_it){
+      const ShiftedPreds& sp = fPreds[p_it].second;
+      // A cubic of exactly 1 everywhere, with no derivative. Or not fitted,
+      // and so neither shifted nor asked about, see CorrectionFactors()
+      if(!sp.fitted->load(std::memory_order_acquire) ||
+         sp.active.first[nubar][type] >= sp.active.last[nubar][type]){
+        if(row[p_it] >= 0){
+          double* dr = dcorr + size_t(row[p_it])*N;
+          std::fill(dr, dr+N, 0.);
+        }
+        continue;
+      }
+      if(row[p_it] >= 0 || shift.GetShiftByIndex(fPreds[p_it].first->DenseIndex()) != 0)
+        involved.push_back(p_it);
+    }
+    const size_t K = involved.size();
+    if(K == 0) return;
+    f.resize(K*N);
+    df.resize(K*N);
+
+    for(size_t k = 0; k < K; ++k){
+      const ShiftedPreds& sp = fPreds[involved[k]].second;
+      double x = shift.GetShiftByIndex(fPreds[involved[k]].first->DenseIndex());
+      const bool active = (x != 0);
+
+      int shiftBin = (x - sp.shifts[0])/sp.Stride();
+      shiftBin = std::max(0, shiftBin);
+      shiftBin = std::min(shiftBin, sp.nCoeffs - 1);
+
+      x -= sp.shifts[shiftBin];
+
+      const double* a = block.Slot(sp.firstSlot + shiftBin);
+      const double* b = a + stride;
+      const double* c = b + stride;
+      const double* d = c + stride;
+
+      double* fk = f.data() + k*N;
+      double* dfk = df.data() + k*N;
+      for(unsigned int n = 0; n < N; ++n){
+        // Zero dials are skipped entirely in the correction itself
+        fk[n] = active ? a[n]*util::cube(x) + b[n]*util::sqr(x) + c[n]*x + d[n] : 1;
+        dfk[n] = 3*a[n]*util::sqr(x) + 2*b[n]*x + c[n];
+      }
+    } // end for k
+
+    // The product of all the cubics before each one
+    thread_local std::vector<double> before, after;
+    before.resize(K*N);
+    for(unsigned int n = 0; n < N; ++n) before[n] = 1;
+    for(size_t k = 1; k < K; ++k){
+      for(unsigned int n = 0; n < N; ++n)
+        before[k*N+n] = before[(k-1)*N+n] * f[(k-1)*N+n];
+    }
+
+    // And, going backwards, of all those after it
+    after.assign(N, 1);
+    for(size_t k = K; k-- > 0;){
+      const int r = row[involved[k]];
+      if(r >= 0){
+        double* dr = dcorr + size_t(r)*N;
+        for(unsigned int n = 0; n < N; ++n)
+          dr[n] = df[k*N+n] * before[k*N+n] * after[n];
+      }
+      for(unsigned int n = 0; n < N; ++n) after[n] *= f[k*N+n];
+    } // end for k
+  }
+
+  //----------------------------------------------------------------------
+  bool PredictionInterp::PredictSystWithGradient(osc::IOscCalc* calc,
+                                                 const SystShifts& shift,
+                                                 const std::vector<const ISyst*>& systs,
+                                                 double pot,
+                                                 Eigen::ArrayXd& pred,
+                                                 std::vector<Eigen::ArrayXd>& grad) const
+  {
+    if(shift.HasAnyStan()) return false;
+
+    InitFits();
+    CheckSysts(shift);
 
-    if(canCache){
-      // Insert into the cache if not already there, or update if there but
-      // with old oscillation parameters.
-      if(it == fNomCache->end())
-        fNomCache->emplace(key, Val_t({*hash, nom}));
-      else
-        it->second = {*hash, nom};
+    const TMD5* hash = calc ? calc->GetParamsHash() : 0;
+    NomTerm terms[kMaxNomTerms];
+    std::unique_ptr<Spectrum> storage[kMaxNomTerms];
+    const unsigned int nTerms = NomTerms(calc, hash, Flavors::kAll, Current::kBoth,
+                                         Sign::kBoth, terms, storage);
+    delete hash;
+    if(nTerms == 0) return false;
+
+    Eigen::ArrayXd noms[kMaxNomTerms];
+    for(unsigned int t = 0; t < nTerms; ++t)
+      noms[t] = terms[t].nom->GetEigen(terms[t].nom->POT());
+    const unsigned int N = noms[0].size();
+
+    // Where in fPreds each of systs is, if anywhere
+    thread_local std::vector<int> predIdx;
+    predIdx.assign(systs.size(), -1);
+    for(unsigned int i = 0; i < systs.size(); ++i){
+      if(!systs[i]) continue;
+      auto it = find_pred(systs[i]);
+      if(it == fPreds.end()) continue;
+      predIdx[i] = it - fPreds.begin();
+      // Needed for the derivative even if not shifted
+      FitLazily(*it);
     }
 
-    return ShiftSpectrum(nom, type, nubar, shift);
+    pred = Eigen::ArrayXd::Zero(N);
+    grad.resize(systs.size());
+    for(Eigen::ArrayXd& g: grad) g = Eigen::ArrayXd::Zero(N);
+
+    thread_local std::vector<double> corr, dcorr;
+    corr.resize(N);
+    dcorr.resize(systs.size()*N);
+
+    // One (type, sign) at a time, so that only one set of derivatives needs
+    // storing
+    for(int nubar = 0; nubar < 2; ++nubar){
+      for(int type = 0; type < kNCoeffTypes; ++type){
+        bool used = false;
+        for(unsigned int t = 0; t < nTerms; ++t)
+          used = used || (terms[t].nubar == nubar && terms[t].type == type);
+        if(!used) continue;
+
+        CorrectionFactors(N, corr.data(), CoeffsType(type), nubar, shift);
+        CorrectionGradient(N, predIdx, dcorr.data(), CoeffsType(type), nubar, shift);
+
+        for(unsigned int t = 0; t < nTerms; ++t){
+          if(terms[t].nubar != nubar || terms[t].type != type) continue;
+
+          const Eigen::ArrayXd& a = noms[t];
+          const double scale = pot/terms[t].nom->POT();
+
+          for(unsigned int n = 0; n < N; ++n)
+            pred[n] += ((a[n] > fMinMCStats) ? a[n]*corr[n] : a[n]) * scale;
+
+          for(unsigned int i = 0; i < systs.size(); ++i){
+            if(predIdx[i] < 0) continue;
+            const double* di = dcorr.data() + size_t(i)*N;
+            for(unsigned int n = 0; n < N; ++n){
+              // Nothing moves below the MC stats threshold, or where the
+              // correction is clamped at zero
+              if(a[n] > fMinMCStats && corr[n] > 0) grad[i][n] += a[n]*di[n]*scale;
+            }
+          } // end for i
+        } // end for t
+      } // end for type
+    } // end for nubar
+
+    return true;
   }
 
   void PredictionInterp::DiscardSysts(std::vector<ISyst const *> const &systs) {
@@ -566,7 +1340,14 @@ namespace ana
       if(it != fPreds.end()){
         fPreds.erase(it);
       }
+      if(fLazy){
+        std::lock_guard<std::mutex> lock(fInitMutex);
+        fResident.remove(s);
+      }
     }
+
+    // The indices in fShiftCache are no longer right
+    fCoeffsGen.fetch_add(1, std::memory_order_release);
   }
 
   std::vector<ISyst const *> PredictionInterp::GetAllSysts() const {
@@ -593,20 +1374,19 @@ namespace ana
     assert (ret.POT() > 0 && "Can't PredictComponentSyst() for 0 POT");
 
     // Check that we're able to handle all the systs we were passed
-    for(const ISyst* syst: shift.ActiveSysts()){
-      if(find_pred(syst) == fPreds.end()){
-        std::cerr << "This PredictionInterp is not set up to handle the requested systematic: " << syst->ShortName() << std::endl;
-        std::cout << "Handles: " << std::endl;
-        for(auto & p : fPreds){
-          std::cout << p.first->ShortName() << std::endl;
-        }
-        abort();
-      }
-    } // end for syst
+    CheckSysts(shift);
 
 
     const TMD5* hash = calc ? calc->GetParamsHash() : 0;
 
+    if constexpr(std::is_same_v<T, double>){
+      if(!shift.HasAnyStan() &&
+         FusedComponentSyst(calc, hash, shift, flav, curr, sign, ret)){
+        delete hash;
+        return ret;
+      }
+    }
+
     if(curr & Current::kCC){
       if(flav & Flavors::kNuEToNuE)    ret += ShiftedComponent(calc, hash, shift, Flavors::kNuEToNuE,    Current::kCC, sign, kNueSurv);
       if(flav & Flavors::kNuEToNuMu)   ret += ShiftedComponent(calc, hash, shift, Flavors::kNuEToNuMu,   Current::kCC, sign, kOther  );
@@ -665,9 +1445,19 @@ namespace ana
     for(auto& it: fPreds){
       const ShiftedPreds& sp = it.second;
 
+      // Held until they're written, so that no other thread evicts them
+      std::unique_lock<std::mutex> lazyLock(fInitMutex, std::defer_lock);
+      if(fLazy){
+        // The coefficients are saved too
+        FitLazily(it);
+
+        lazyLock.lock();
+        LoadLazyPreds(it);
+      }
+
       for(unsigned int i = 0; i < sp.shifts.size(); ++i){
         if(!sp.preds[i]){
-          std::cout << "Can't save a PredictionInterp after MinimizeMemory()" << std::endl;
+          std::cout << "Can't save a PredictionInterp after MinimizeMemory() or a coefficients-only load" << std::endl;
           abort();
         }
 
@@ -679,6 +1469,8 @@ namespace ana
 
     ana::SaveTo(*fOscOrigin, dir, "osc_origin");
 
+    SaveCoeffs(dir);
+
     if(!fPreds.empty()){
       TH1F hSystNames("syst_names", ";Syst names", fPreds.size(), 0, fPreds.size());
       int binIdx = 1;
@@ -701,6 +1493,13 @@ namespace ana
 
   //----------------------------------------------------------------------
   std::unique_ptr<PredictionInterp> PredictionInterp::LoadFrom(TDirectory* dir, const std::string& name)
+  {
+    return LoadFrom(dir, name, LoadOpts());
+  }
+
+  //----------------------------------------------------------------------
+  std::unique_ptr<PredictionInterp> PredictionInterp::LoadFrom(TDirectory* dir, const std::string& name,
+                                                               const LoadOpts& opts)
   {
     dir = dir->GetDirectory(name.c_str()); // switch to subdir
     assert(dir);
@@ -711,23 +1510,76 @@ namespace ana
 
     std::unique_ptr<PredictionInterp> ret(new PredictionInterp);
 
-    LoadFromBody(dir, ret.get());
-
-    TObjString* split_sign = (TObjString*)dir->Get("split_sign");
-    // Can be missing from old files
-    ret->fSplitBySign = (split_sign && split_sign->String() == "yes");
+    LoadFromBody(dir, ret.get(), {}, opts);
 
     delete dir;
 
+    // Everything is in place now, and it's better to take the time here than
+    // in the middle of someone's first (maybe parallel) prediction
+    ret->InitFits();
+
     return ret;
   }
 
   //----------------------------------------------------------------------
   void PredictionInterp::LoadFromBody(TDirectory* dir, PredictionInterp* ret,
-                                      std::vector<const ISyst*> veto)
+                                      std::vector<const ISyst*> veto,
+                                      const LoadOpts& opts)
   {
     ret->fPredNom = ana::LoadFrom<IPrediction>(dir, "pred_nom");
 
+    TObjString* split_sign = (TObjString*)dir->Get("split_sign");
+    // Can be missing from old files
+    ret->fSplitBySign = (split_sign && split_sign->String() == "yes");
+    delete split_sign;
+
+    bool coeffsOnly = opts.coeffsOnly;
+    if(getenv("CAFANA_PREDINTERP_COEFFS_ONLY"))
+      coeffsOnly = bool(atoi(getenv("CAFANA_PREDINTERP_COEFFS_ONLY")));
+
+    TDirectory* coeffsDir = 0;
+    if(coeffsOnly){
+      coeffsDir = dir->GetDirectory("coeffs");
+      if(!coeffsDir){
+        std::cout << "PredictionInterp: no coefficients saved in " << dir->GetName()
+                  << ", loading all the shifted predictions" << std::endl;
+      }
+      else{
+        TObjString* md5 = (TObjString*)coeffsDir->Get("osc_origin_md5");
+        if(!md5 || md5->GetString() != OscOriginMD5(dir)){
+          std::cout << "PredictionInterp: coefficients in " << dir->GetName()
+                    << " are for a different osc_origin, loading all the shifted predictions" << std::endl;
+          delete coeffsDir;
+          coeffsDir = 0;
+        }
+        delete md5;
+      }
+    }
+    int nBins = -1;
+
+    bool lazy = opts.lazy;
+    if(getenv("CAFANA_PREDINTERP_LAZY"))
+      lazy = bool(atoi(getenv("CAFANA_PREDINTERP_LAZY")));
+
+    if(lazy){
+      if(!dir->GetFile()){
+        std::cout << "PredictionInterp: " << dir->GetName()
+                  << " isn't in a file, can't load it lazily" << std::endl;
+      }
+      else{
+        ret->fLazy = std::make_unique<LazySource>();
+        ret->fLazy->fileName = dir->GetFile()->GetName();
+        // GetPath() is "file:/dir/subdir"
+        const std::string path = dir->GetPath();
+        const size_t colon = path.find(":/");
+        ret->fLazy->dirName = (colon == std::string::npos) ? "" : path.substr(colon+2);
+        ret->fLazy->coeffs = (coeffsDir != 0);
+
+        const char* env = getenv("CAFANA_PREDINTERP_LAZY_MAX");
+        ret->fLazy->maxResident = env ? std::max(0, atoi(env)) : opts.lazyMax;
+      }
+    }
+
     TH1* hSystNames = (TH1*)dir->Get("syst_names");
     if(hSystNames){
       for(int systIdx = 0; systIdx < hSystNames->GetNbinsX(); ++systIdx){
@@ -768,16 +1620,144 @@ namespace ana
           delete preddir;
 
           sp.shifts.push_back(shift);
-          sp.preds.emplace_back(ana::LoadFrom<IPrediction>(dir, subname));
         } // end for shift
 
+        if(ret->fLazy){
+          // Read when first needed, by FitLazily()
+        }
+        else if(coeffsDir && LoadCoeffs(coeffsDir, sp, ret->fSplitBySign, nBins)){
+          // As after MinimizeMemory()
+          sp.preds.resize(sp.shifts.size());
+        }
+        else{
+          for(double shift: sp.shifts){
+            const std::string subname = TString::Format("pred_%s_%+d", sp.systName.c_str(), int(shift)).Data();
+            sp.preds.emplace_back(ana::LoadFrom<IPrediction>(dir, subname));
+          }
+        }
+
         ret->fPreds.emplace_back(syst, std::move(sp));
       } // end for systIdx
     } // end if hSystNames
 
+    delete coeffsDir;
+
     ret->fOscOrigin = ana::LoadFrom<osc::IOscCalc>(dir, "osc_origin");
   }
 
+  //----------------------------------------------------------------------
+  void PredictionInterp::SaveCoeffs(TDirectory* dir) const
+  {
+    TDirectory* tmp = gDirectory;
+
+    const TString md5 = OscOriginMD5(dir);
+
+    dir = dir->mkdir("coeffs"); // switch to subdir
+    dir->cd();
+
+    TObjString(md5).Write("osc_origin_md5");
+    TObjString(TString::Format("%d", kCoeffsLayout)).Write("layout");
+
+    for(auto& it: fPreds){
+      const ShiftedPreds& sp = it.second;
+
+      TVectorD shifts(sp.shifts.size());
+      for(unsigned int i = 0; i < sp.shifts.size(); ++i) shifts[i] = sp.shifts[i];
+      shifts.Write((sp.systName+"_shifts").c_str());
+
+      for(int nubar = 0; nubar < (fSplitBySign ? 2 : 1); ++nubar){
+        const unsigned int nBins = fCoeffs[nubar][0].NBins();
+
+        // Stored as [type][shift bin][a, b, c, d][histogram bin], which is
+        // fCoeffs without the padding
+        TVectorD v(kNCoeffTypes*sp.nCoeffs*4*nBins);
+        double* out = v.GetMatrixArray();
+        for(int type = 0; type < kNCoeffTypes; ++type){
+          const PredIntKern::SoACoeffs& block = fCoeffs[nubar][type];
+          for(int shiftBin = 0; shiftBin < sp.nCoeffs; ++shiftBin){
+            const double* slot = block.Slot(sp.firstSlot + shiftBin);
+            for(int row = 0; row < 4; ++row){
+              out = std::copy(slot + row*block.Stride(), slot + row*block.Stride() + nBins, out);
+            }
+          }
+        }
+        v.Write((sp.systName+(nubar ? "_fits_nubar" : "_fits")).c_str());
+      } // end for nubar
+    } // end for it
+
+    dir->Write();
+    delete dir;
+
+    tmp->cd();
+  }
+
+  //----------------------------------------------------------------------
+  bool PredictionInterp::LoadCoeffs(TDirectory* coeffsDir, ShiftedPreds& sp,
+                                    bool splitBySign, int& nBins)
+  {
+    // Untagged files are from before there were any other layouts
+    TObjString* layoutTag = (TObjString*)coeffsDir->Get("layout");
+    const int layout = layoutTag ? layoutTag->GetString().Atoi() : 1;
+    delete layoutTag;
+
+    if(layout != 1 && layout != kCoeffsLayout){
+      std::cout << "PredictionInterp: saved coefficients of " << sp.systName
+                << " have unknown layout " << layout
+                << ", loading its shifted predictions" << std::endl;
+      return false;
+    }
+
+    TVectorD* shifts = (TVectorD*)coeffsDir->Get((sp.systName+"_shifts").c_str());
+    bool ok = shifts && shifts->GetNrows() == int(sp.shifts.size()) && sp.shifts.size() >= 2;
+    for(unsigned int i = 0; ok && i < sp.shifts.size(); ++i)
+      ok = ((*shifts)[i] == sp.shifts[i]);
+    delete shifts;
+
+    if(!ok){
+      std::cout << "PredictionInterp: saved coefficients of " << sp.systName
+                << " don't match its shifts, loading its shifted predictions" << std::endl;
+      return false;
+    }
+
+    // FitRatios() gives one set fewer than there are shifts
+    const int nCoeffs = sp.shifts.size()-1;
+    const int nPerBin = kNCoeffTypes*nCoeffs*4;
+
+    std::vector<double> saved;
+    for(int nubar = 0; nubar < (splitBySign ? 2 : 1); ++nubar){
+      TVectorD* v = (TVectorD*)coeffsDir->Get((sp.systName+(nubar ? "_fits_nubar" : "_fits")).c_str());
+      if(!v || v->GetNrows() % nPerBin != 0 ||
+         (nBins >= 0 && v->GetNrows() != nBins*nPerBin)){
+        std::cout << "PredictionInterp: saved coefficients of " << sp.systName
+                  << " are incomplete, loading its shifted predictions" << std::endl;
+        delete v;
+        return false;
+      }
+      nBins = v->GetNrows()/nPerBin;
+
+      const double* in = v->GetMatrixArray();
+      if(layout == 1){
+        // Transpose each shift bin's [histogram bin][a, b, c, d] to
+        // [a, b, c, d][histogram bin]
+        for(int block = 0; block < kNCoeffTypes*nCoeffs; ++block){
+          for(int row = 0; row < 4; ++row){
+            for(int bin = 0; bin < nBins; ++bin){
+              saved.push_back(in[(block*nBins + bin)*4 + row]);
+            }
+          }
+        }
+      }
+      else{
+        saved.insert(saved.end(), in, in + v->GetNrows());
+      }
+      delete v;
+    } // end for nubar
+
+    sp.savedCoeffs = std::move(saved);
+
+    return true;
+  }
+
   //----------------------------------------------------------------------
   void PredictionInterp::MinimizeMemory()
   {
@@ -789,6 +1769,12 @@ namespace ana
       }
     }
 
+    // Lazily-loaded systs can still be read again if needed
+    if(fLazy){
+      std::lock_guard<std::mutex> lock(fInitMutex);
+      fResident.clear();
+    }
+
     // We probably just freed up a lot of memory, but malloc by default hangs
     // on to all of it as cache.
     malloc_trim(0);
@@ -834,6 +1820,14 @@ namespace ana
       } // end for bin
     } // end for i (x)
 
+    // Held while the shifted predictions are used, so that no other thread
+    // evicts them
+    std::unique_lock<std::mutex> lazyLock(fInitMutex, std::defer_lock);
+    if(fLazy){
+      lazyLock.lock();
+      LoadLazyPreds(*it);
+    }
+
     // As elswhere, to allow BirksC etc that need a different nominal to plot
     // right.
     IPrediction const* pNom = 0;
@@ -854,6 +1848,8 @@ namespace ana
       }
     } // end for shiftIdx
 
+    if(lazyLock.owns_lock()) lazyLock.unlock();
+
 
     int nx = int(sqrt(nbins));
     int ny = int(sqrt(nbins));
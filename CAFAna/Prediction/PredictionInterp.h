@@ -8,10 +8,14 @@
 #include "CAFAna/Core/SystShifts.h"
 #include "CAFAna/Core/ThreadLocal.h"
 
+#include <atomic>
 #include <iostream>
+#include <list>
 #include <map>
 #include <memory>
+#include <mutex>
 
+#include "TFile.h"
 #include "TMD5.h"
 
 class TH1;
@@ -59,6 +63,18 @@ namespace ana
     Spectrum PredictSyst(osc::IOscCalcStan* calc,
                          const SystShifts& shift) const override;
 
+    /// \brief Derivatives from the spline coefficients, for all systs in one
+    /// pass
+    ///
+    /// Costs about as much as a couple of \ref PredictSyst calls, however many
+    /// systs there are. False for Stan shifts or nominals.
+    bool PredictSystWithGradient(osc::IOscCalc* calc,
+                                 const SystShifts& shift,
+                                 const std::vector<const ISyst*>& systs,
+                                 double pot,
+                                 Eigen::ArrayXd& pred,
+                                 std::vector<Eigen::ArrayXd>& grad) const override;
+
     Spectrum PredictComponent(osc::IOscCalc* calc,
                               Flavors::Flavors_t flav,
                               Current::Current_t curr,
@@ -79,9 +95,46 @@ namespace ana
                                   Current::Current_t curr,
                                   Sign::Sign_t sign) const override;
 
+    /// Also writes the fitted coefficients, see \ref LoadFrom
     virtual void SaveTo(TDirectory* dir, const std::string& name) const override;
+
+    /// How \ref LoadFrom reads the shifted predictions
+    struct LoadOpts
+    {
+      LoadOpts(bool coeffs = false, bool lz = false, unsigned int lzMax = 8)
+        : coeffsOnly(coeffs), lazy(lz), lazyMax(lzMax) {}
+
+      /// \brief Only load the nominal and the fitted coefficients
+      ///
+      /// The result is as if \ref MinimizeMemory had already been called.
+      /// Systs whose coefficients are missing or don't match the file's
+      /// shifts and oscillation origin fall back to loading their shifted
+      /// predictions. $CAFANA_PREDINTERP_COEFFS_ONLY (0 or 1) overrides it
+      bool coeffsOnly;
+
+      /// \brief Only read the nominal now
+      ///
+      /// Each syst's shifted predictions (or coefficients) are read from the
+      /// file the first time that syst is shifted, and then fitted.
+      /// $CAFANA_PREDINTERP_LAZY (0 or 1) overrides it
+      bool lazy;
+
+      /// \brief With \ref lazy, how many systs keep their shifted
+      /// predictions in memory
+      ///
+      /// The least recently used are dropped first. At least 1.
+      /// $CAFANA_PREDINTERP_LAZY_MAX overrides it
+      unsigned int lazyMax;
+    };
+
+    /// \brief Load with the default \ref LoadOpts
+    ///
+    /// Any fitting is done before returning, unless loading lazily.
     static std::unique_ptr<PredictionInterp> LoadFrom(TDirectory* dir, const std::string& name);
 
+    static std::unique_ptr<PredictionInterp> LoadFrom(TDirectory* dir, const std::string& name,
+                                                      const LoadOpts& opts);
+
     /// After calling this DebugPlots won't work fully and SaveTo won't work at
     /// all.
     void MinimizeMemory();
@@ -130,23 +183,31 @@ namespace ana
     }
 
     static void LoadFromBody(TDirectory* dir, PredictionInterp* ret,
-                             std::vector<const ISyst*> veto = {});
+                             std::vector<const ISyst*> veto = {},
+                             const LoadOpts& opts = LoadOpts());
 
     typedef ana::PredIntKern::Coeffs Coeffs;
 
-    /// Find coefficients describing this set of shifts
-    std::vector<std::vector<Coeffs>>
-    FitRatios(const std::vector<double>& shifts,
-              const std::vector<Eigen::ArrayXd>& ratios) const;
-
-    /// Find coefficients describing the ratios from this component
-    std::vector<std::vector<Coeffs>>
-    FitComponent(const std::vector<double>& shifts,
-                 const std::vector<std::unique_ptr<IPrediction>>& preds,
-                 Flavors::Flavors_t flav,
-                 Current::Current_t curr,
-                 Sign::Sign_t sign,
-                 const std::string& systName) const;
+    /// \brief Find coefficients describing this set of shifts
+    ///
+    /// Written into \a block, one slot per pair of adjacent shifts, starting
+    /// at \a firstSlot
+    void FitRatios(const std::vector<double>& shifts,
+                   const std::vector<Eigen::ArrayXd>& ratios,
+                   PredIntKern::SoACoeffs& block,
+                   size_t firstSlot) const;
+
+    /// \brief Find coefficients describing the ratios from this component
+    ///
+    /// Evaluated at \a calc, written as by \ref FitRatios
+    void FitComponent(const std::vector<double>& shifts,
+                      const std::vector<std::unique_ptr<IPrediction>>& preds,
+                      osc::IOscCalc* calc,
+                      Flavors::Flavors_t flav,
+                      Current::Current_t curr,
+                      Sign::Sign_t sign,
+                      PredIntKern::SoACoeffs& block,
+                      size_t firstSlot) const;
 
     Spectrum ShiftSpectrum(const Spectrum& s,
                            CoeffsType type,
@@ -192,33 +253,51 @@ namespace ana
 
       int nCoeffs; // Faster than calling size()
 
-      /// Indices: [type][histogram bin][shift bin]
-      std::vector<std::vector<std::vector<Coeffs>>> fits;
-      /// Will be filled if signs are separated, otherwise not
-      std::vector<std::vector<std::vector<Coeffs>>> fitsNubar;
-
-      // Same info as above but with more-easily-iterable index order
-      // [type][shift bin][histogram bin]. TODO this is ugly
-      std::vector<std::vector<std::vector<Coeffs>>> fitsRemap;
-      std::vector<std::vector<std::vector<Coeffs>>> fitsNubarRemap;
-      ShiftedPreds() {}
+      /// \brief Coefficients read by \ref LoadCoeffs, until \ref InitFits
+      /// copies them into \ref fCoeffs
+      ///
+      /// Indices: [nubar][type][shift bin][a, b, c, d][histogram bin]
+      std::vector<double> savedCoeffs;
+
+      /// Slot of shift bin 0 in each of \ref fCoeffs. Shift bin i is at
+      /// firstSlot+i
+      size_t firstSlot;
+
+      /// \brief Bins [first, last) of each of \ref fCoeffs where some cubic of
+      /// this syst isn't identically 1
+      ///
+      /// Indices: [nubar][type]. \a first is rounded down to a whole
+      /// \ref PredIntKern::kKernelChunk, and first == last where the syst
+      /// doesn't affect that component at all. Set by \ref FindActiveBins.
+      struct ActiveBins{
+        unsigned int first[2][kNCoeffTypes], last[2][kNCoeffTypes];
+      } active;
+
+      /// \brief Have this syst's slots of \ref fCoeffs been filled?
+      ///
+      /// Only ever false after \ref InitFits for lazy loads. Behind a pointer
+      /// to keep this movable.
+      std::unique_ptr<std::atomic<bool>> fitted;
+
+      ShiftedPreds() : fitted(new std::atomic<bool>(false)) {}
       ShiftedPreds(ShiftedPreds &&other)
           : systName(std::move(other.systName)),
             shifts(std::move(other.shifts)), preds(std::move(other.preds)),
-            nCoeffs(other.nCoeffs), fits(std::move(other.fits)),
-            fitsNubar(std::move(other.fitsNubar)),
-            fitsRemap(std::move(other.fitsRemap)),
-            fitsNubarRemap(std::move(other.fitsNubarRemap)) {}
+            nCoeffs(other.nCoeffs),
+            savedCoeffs(std::move(other.savedCoeffs)),
+            firstSlot(other.firstSlot),
+            active(other.active),
+            fitted(std::move(other.fitted)) {}
 
       ShiftedPreds &operator=(ShiftedPreds &&other) {
         systName = std::move(other.systName);
         shifts = std::move(other.shifts);
         preds = std::move(other.preds);
         nCoeffs = other.nCoeffs;
-        fits = std::move(other.fits);
-        fitsNubar = std::move(other.fitsNubar);
-        fitsRemap = std::move(other.fitsRemap);
-        fitsNubarRemap = std::move(other.fitsNubarRemap);
+        savedCoeffs = std::move(other.savedCoeffs);
+        firstSlot = other.firstSlot;
+        active = other.active;
+        fitted = std::move(other.fitted);
         return *this;
       }
 
@@ -265,16 +344,114 @@ namespace ana
     };
     mutable ThreadLocal<std::map<Key_t, Val_t>> fNomCache;
 
+    /// \brief All the fits, in the layout \ref ShiftBins wants
+    ///
+    /// Indices: [nubar][type]. Within each block [syst][shift bin][coeff][bin]
+    mutable PredIntKern::SoACoeffs fCoeffs[2][kNCoeffTypes];
+
+    /// Set once \ref InitFits has filled \ref fCoeffs and \ref fBinning
+    mutable std::atomic<bool> fFitsInitialized{false};
+    /// Held while \ref InitFits or \ref FitLazily work
+    mutable std::mutex fInitMutex;
+
+    /// Where a lazily-loaded PredictionInterp reads its systs from
+    struct LazySource
+    {
+      std::string fileName;
+      std::string dirName; ///< Within the file, empty for the top level
+      bool coeffs; ///< Read coefficients rather than shifted predictions?
+      unsigned int maxResident; ///< Systs whose shifted preds are kept
+      std::unique_ptr<TFile> file; ///< Opened on first use
+      TDirectory* dir = 0; ///< \ref dirName, owned by \ref file
+    };
+    /// Null unless loaded lazily
+    std::unique_ptr<LazySource> fLazy;
+    /// Lazily-loaded systs with their shifted predictions in memory, most
+    /// recently used first
+    mutable std::list<const ISyst*> fResident;
+
+    /// \brief Product of the correction factors at some earlier SystShifts
+    ///
+    /// For \ref CorrectionFactors to update, when only a few dials moved
+    struct ShiftCache
+    {
+      std::vector<double> xs; ///< Value of each of \ref fPreds
+      std::vector<double> prod; ///< Per bin, before clamping at zero
+      unsigned int nUpdates = 0; ///< Since \ref prod was last fully computed
+      unsigned long gen = 0; ///< Of \ref fCoeffsGen
+    };
+    struct ShiftCaches
+    {
+      ShiftCache entries[2][kNCoeffTypes]; ///< [nubar][type]
+    };
+    mutable ThreadLocal<ShiftCaches> fShiftCache;
+    /// \brief Incremented whenever \ref fCoeffs or \ref fPreds change
+    ///
+    /// Read (with acquire) by every thread's \ref CorrectionFactors
+    mutable std::atomic<unsigned long> fCoeffsGen{0};
+
+    /// Recompute \ref ShiftCache::prod from scratch this often
+    static const unsigned int kMaxIncrementalUpdates = 100;
+    /// Below this, dividing a dial out of \ref ShiftCache::prod isn't safe
+    static constexpr double kMinIncrementalDivisor = 1e-3;
+
     bool fSplitBySign;
 
     // Don't apply systs to bins with fewer than this many MC stats
     double fMinMCStats;
 
+    /// \brief Fit all the systs, if not done already
+    ///
+    /// Safe to call from many threads at once, the others wait for the first.
+    /// The systs are fitted in parallel on $CAFANA_PREDINTERP_NTHREADS
+    /// threads, default one per core, so the shifted IPredictions must be safe
+    /// to call concurrently. That includes anything they do with ROOT, so the
+    /// caller has to call ROOT::EnableThreadSafety() first, otherwise the
+    /// systs are fitted one at a time.
     void InitFits() const;
 
-    void InitFitsHelper(ShiftedPreds& sp,
-                        std::vector<std::vector<std::vector<Coeffs>>>& fits,
-                        Sign::Sign_t sign) const;
+    /// \brief Write the fits of all the systs into subdirectory "coeffs"
+    ///
+    /// Alongside an MD5 of \a dir's "osc_origin", which must already be saved
+    void SaveCoeffs(TDirectory* dir) const;
+
+    /// \brief Read \a sp's fits from \a coeffsDir, as written by \ref SaveCoeffs
+    ///
+    /// Into ShiftedPreds::savedCoeffs. False, leaving that empty, if they
+    /// don't match \a sp.shifts, or have a different number of bins than \a
+    /// nBins. If \a nBins is negative it's set from these fits. Fits saved in
+    /// an older layout are rearranged into the current one.
+    static bool LoadCoeffs(TDirectory* coeffsDir, ShiftedPreds& sp,
+                           bool splitBySign, int& nBins);
+
+    /// Fit all the components of one sign of \a sp, at \a calc
+    void InitFitsHelper(const ShiftedPreds& sp,
+                        osc::IOscCalc* calc,
+                        bool nubar) const;
+
+    /// Move ShiftedPreds::savedCoeffs into \ref fCoeffs
+    void CopySavedCoeffs(ShiftedPreds& sp) const;
+
+    /// \brief Set ShiftedPreds::active from \a sp's slots of \ref fCoeffs
+    ///
+    /// Once they're filled in. A cubic is only skipped if it's exactly 1, so
+    /// the shifted spectra don't change.
+    void FindActiveBins(ShiftedPreds& sp) const;
+
+    /// \brief Fill in the coefficients of the syst \a it, if a lazy load
+    /// hasn't yet
+    void FitLazily(PredMappedType& it) const;
+
+    /// \brief Read the shifted predictions of the syst \a it from \ref fLazy,
+    /// if they aren't in memory
+    ///
+    /// Evicts the least recently used systs' predictions if there are now too
+    /// many.
+    /// Call with \ref fInitMutex held.
+    void LoadLazyPreds(PredMappedType& it) const;
+
+    /// The directory \ref fLazy refers to, opening the file if necessary
+    TDirectory* LazyDir() const;
 
     /// Templated helper for \ref ShiftedComponent
     template <typename T>
@@ -286,6 +463,59 @@ namespace ana
                                Sign::Sign_t sign,
                                CoeffsType type) const;
 
+    /// \brief The unshifted component, from \ref fNomCache if possible
+    ///
+    /// If it can't be cached the result is kept in \a storage instead
+    template <typename T>
+    const Spectrum& NomComponent(osc::_IOscCalc<T>* calc,
+                                 const TMD5* hash,
+                                 Flavors::Flavors_t flav,
+                                 Current::Current_t curr,
+                                 Sign::Sign_t sign,
+                                 std::unique_ptr<Spectrum>& storage) const;
+
+    /// One of the nominal pieces summed by \ref PredictComponentSyst
+    struct NomTerm
+    {
+      const Spectrum* nom;
+      CoeffsType type;
+      bool nubar; ///< Use the nubar fits?
+    };
+
+    /// Seven components, each of up to two signs
+    static const unsigned int kMaxNomTerms = 14;
+
+    /// \brief Fill \a terms with the pieces of this (flav, curr, sign)
+    ///
+    /// In the same order that \ref PredictComponentSyst adds them. Those not
+    /// from \ref fNomCache are owned by \a storage. Returns the number of
+    /// terms, or zero if any is Stan or has no POT.
+    unsigned int NomTerms(osc::IOscCalc* calc,
+                          const TMD5* hash,
+                          Flavors::Flavors_t flav,
+                          Current::Current_t curr,
+                          Sign::Sign_t sign,
+                          NomTerm* terms,
+                          std::unique_ptr<Spectrum>* storage) const;
+
+    /// \brief Abort if \a shift includes a syst we don't know about
+    ///
+    /// Lazily-loaded systs that \a shift uses are fitted now
+    void CheckSysts(const SystShifts& shift) const;
+
+    /// \brief Double-only \ref PredictComponentSyst, all components at once
+    ///
+    /// Each correction vector is computed once per (type, sign), and the
+    /// shifted components are summed straight into \a ret. Returns false,
+    /// leaving \a ret alone, if the ordinary path needs to be taken.
+    bool FusedComponentSyst(osc::IOscCalc* calc,
+                            const TMD5* hash,
+                            const SystShifts& shift,
+                            Flavors::Flavors_t flav,
+                            Current::Current_t curr,
+                            Sign::Sign_t sign,
+                            Spectrum& ret) const;
+
     /// Templated helper for \ref PredictComponentSyst
     template <typename T>
     Spectrum _PredictComponentSyst(osc::_IOscCalc<T>* calc,
@@ -294,7 +524,23 @@ namespace ana
                                    Current::Current_t curr,
                                    Sign::Sign_t sign) const;
 
-    /// Helper for \ref ShiftSpectrum
+    /// \brief Below this many (active syst x bin) evaluations \ref ShiftBins
+    /// doesn't bother with OpenMP
+    static const size_t kMinParallelWork = 4096;
+
+    /// \brief Product of the cubics of all of \a active, into \a prod
+    ///
+    /// With USE_PREDINTERP_OMP, split over bins, and over systs too once there
+    /// are more threads than cache lines of bins. Any OMP_NUM_THREADS works.
+    void MultiplyCubics(const std::vector<PredIntKern::ActiveShift>& active,
+                        unsigned int N,
+                        unsigned int stride,
+                        double* prod) const;
+
+    /// \brief Helper for \ref ShiftSpectrum
+    ///
+    /// The double version is \ref CorrectionFactors. Stan vars are always
+    /// done serially, from scratch.
     template <typename T>
     void ShiftBins(unsigned int N,
                    T* arr,
@@ -302,6 +548,32 @@ namespace ana
                    bool nubar,
                    const SystShifts& shift) const;
 
+    /// \brief The product of all the syst cubics for each bin, clamped at zero
+    ///
+    /// The double part of \ref ShiftBins, without applying it. If only a few
+    /// dials have changed since the last call on this thread, the cached
+    /// product is updated by dividing out their old values and multiplying in
+    /// the new ones. $CAFANA_PREDINTERP_INCREMENTAL=0 always does the full
+    /// calculation.
+    void CorrectionFactors(unsigned int N,
+                           double* corr,
+                           CoeffsType type,
+                           bool nubar,
+                           const SystShifts& shift) const;
+
+    /// \brief Derivatives of the (unclamped) \ref CorrectionFactors product
+    ///
+    /// With respect to each fPreds[\a predIdx[i]], into row i of \a dcorr
+    /// (\a N per row). Rows with negative \a predIdx are left alone. Each
+    /// derivative is the syst's cubic's derivative times the product of the
+    /// others' cubics, from running products forwards and backwards.
+    void CorrectionGradient(unsigned int N,
+                            const std::vector<int>& predIdx,
+                            double* dcorr,
+                            CoeffsType type,
+                            bool nubar,
+                            const SystShifts& shift) const;
+
   };
 
 }
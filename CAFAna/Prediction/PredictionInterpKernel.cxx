@@ -1,40 +1,236 @@
 #include "CAFAna/Prediction/PredictionInterpKernel.h"
 
-// This trivial function has been split out into a separate file to make it
-// easier to confirm it's being vectorized. Do something like
+// These trivial functions have been split out into a separate file to make
+// it easier to confirm they're being vectorized. Do something like
 //
-// g++ -S -fverbose-asm PredictionInterpKernel.cxx -Ofast -march=native -I../..
+// g++ -S -fverbose-asm PredictionInterpKernel.cxx -O2 -I../..
 //
-// and look at PredictionInterpKernel.s for xmm, ymm or zmm registers
+// and look at PredictionInterpKernel.s for ymm (AVX2) and zmm (AVX-512)
+// registers. Those versions are compiled in regardless of -march, and picked
+// at runtime.
 
 #include "CAFAna/Core/Stan.h"
 
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <string>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define PREDINTKERN_X86_SIMD
+#include <immintrin.h>
+#endif
+
+// The AVX-512 target implies FMA, and the compiler would otherwise be free to
+// fuse the multiplies and adds there but not in the scalar version
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#define PREDINTKERN_NO_CONTRACT
+#elif defined(__GNUC__)
+#define PREDINTKERN_NO_CONTRACT __attribute__((optimize("fp-contract=off")))
+#else
+#define PREDINTKERN_NO_CONTRACT
+#endif
+
 namespace ana
 {
   namespace PredIntKern
   {
-    void ShiftSpectrumKernel(const Coeffs* fits,
-                             unsigned int N,
-                             double x, double x2, double x3,
+    //----------------------------------------------------------------------
+    void SoACoeffs::Reset(unsigned int nBins, size_t nSlots)
+    {
+      fNBins = nBins;
+      fStride = (nBins+kKernelChunk-1)/kKernelChunk*kKernelChunk;
+      fNSlots = nSlots;
+
+      const size_t bytes = nSlots*4*fStride*sizeof(double);
+      fData.reset(bytes ? (double*)std::aligned_alloc(64, bytes) : 0);
+      if(bytes && !fData) throw std::bad_alloc();
+
+      // Padding included, so the vector loops may safely read it
+      if(bytes) std::memset(fData.get(), 0, bytes);
+    }
+
+    //----------------------------------------------------------------------
+    PREDINTKERN_NO_CONTRACT
+    void ShiftSpectrumKernelScalar(const ActiveShift* shifts,
+                                   unsigned int nShifts,
+                                   unsigned int first,
+                                   unsigned int last,
+                                   unsigned int stride,
+                                   double* corr)
+    {
+      for(unsigned int s = 0; s < nShifts; ++s){
+        const unsigned int lo = std::max(first, shifts[s].first);
+        const unsigned int hi = std::min(last, shifts[s].last);
+        if(lo >= hi) continue;
+
+        const double* a = shifts[s].coeffs;
+        const double* b = a + stride;
+        const double* c = b + stride;
+        const double* d = c + stride;
+        const double x = shifts[s].x, x2 = shifts[s].x2, x3 = shifts[s].x3;
+
+        for(unsigned int n = lo; n < hi; ++n)
+          corr[n] *= a[n]*x3 + b[n]*x2 + c[n]*x + d[n];
+      } // end for s
+    }
+
+#ifdef PREDINTKERN_X86_SIMD
+    //----------------------------------------------------------------------
+    // Explicit multiply then add (no FMA), in the same order as the scalar
+    // version, so that all three give identical answers. The rows are padded
+    // (with zeros), so the last partial vector can be loaded whole, only corr
+    // needs masking.
+    PREDINTKERN_NO_CONTRACT __attribute__((target("avx2")))
+    void ShiftSpectrumKernelAVX2(const ActiveShift* shifts,
+                                 unsigned int nShifts,
+                                 unsigned int first,
+                                 unsigned int last,
+                                 unsigned int stride,
+                                 double* corr)
+    {
+      for(unsigned int s = 0; s < nShifts; ++s){
+        const unsigned int lo = std::max(first, shifts[s].first);
+        const unsigned int hi = std::min(last, shifts[s].last);
+        if(lo >= hi) continue;
+
+        const double* a = shifts[s].coeffs;
+        const double* b = a + stride;
+        const double* c = b + stride;
+        const double* d = c + stride;
+
+        const __m256d x  = _mm256_set1_pd(shifts[s].x);
+        const __m256d x2 = _mm256_set1_pd(shifts[s].x2);
+        const __m256d x3 = _mm256_set1_pd(shifts[s].x3);
+
+        for(unsigned int n = lo; n < hi; n += 4){
+          __m256d p = _mm256_mul_pd(_mm256_load_pd(a+n), x3);
+          p = _mm256_add_pd(p, _mm256_mul_pd(_mm256_load_pd(b+n), x2));
+          p = _mm256_add_pd(p, _mm256_mul_pd(_mm256_load_pd(c+n), x));
+          p = _mm256_add_pd(p, _mm256_load_pd(d+n));
+
+          if(n+4 <= hi){
+            _mm256_storeu_pd(corr+n, _mm256_mul_pd(_mm256_loadu_pd(corr+n), p));
+          }
+          else{
+            const int r = hi-n;
+            const __m256i mask = _mm256_set_epi64x(r > 3 ? -1 : 0, r > 2 ? -1 : 0,
+                                                   r > 1 ? -1 : 0, -1);
+            _mm256_maskstore_pd(corr+n, mask,
+                                _mm256_mul_pd(_mm256_maskload_pd(corr+n, mask), p));
+          }
+        }
+      } // end for s
+    }
+
+    //----------------------------------------------------------------------
+    PREDINTKERN_NO_CONTRACT __attribute__((target("avx512f")))
+    void ShiftSpectrumKernelAVX512(const ActiveShift* shifts,
+                                   unsigned int nShifts,
+                                   unsigned int first,
+                                   unsigned int last,
+                                   unsigned int stride,
+                                   double* corr)
+    {
+      for(unsigned int s = 0; s < nShifts; ++s){
+        const unsigned int lo = std::max(first, shifts[s].first);
+        const unsigned int hi = std::min(last, shifts[s].last);
+        if(lo >= hi) continue;
+
+        const double* a = shifts[s].coeffs;
+        const double* b = a + stride;
+        const double* c = b + stride;
+        const double* d = c + stride;
+
+        const __m512d x  = _mm512_set1_pd(shifts[s].x);
+        const __m512d x2 = _mm512_set1_pd(shifts[s].x2);
+        const __m512d x3 = _mm512_set1_pd(shifts[s].x3);
+
+        for(unsigned int n = lo; n < hi; n += 8){
+          __m512d p = _mm512_mul_pd(_mm512_load_pd(a+n), x3);
+          p = _mm512_add_pd(p, _mm512_mul_pd(_mm512_load_pd(b+n), x2));
+          p = _mm512_add_pd(p, _mm512_mul_pd(_mm512_load_pd(c+n), x));
+          p = _mm512_add_pd(p, _mm512_load_pd(d+n));
+
+          const __mmask8 mask = (n+8 <= hi) ? 0xff : (1u << (hi-n)) - 1;
+          _mm512_mask_storeu_pd(corr+n, mask,
+                                _mm512_mul_pd(_mm512_maskz_loadu_pd(mask, corr+n), p));
+        }
+      } // end for s
+    }
+#endif
+
+    typedef void (*KernelFunc)(const ActiveShift*, unsigned int, unsigned int,
+                               unsigned int, unsigned int, double*);
+
+    //----------------------------------------------------------------------
+    KernelFunc ChooseKernel(const std::string& cap)
+    {
+      if(cap != "scalar" && cap != "avx2" && cap != "avx512"){
+        std::cout << "PredIntKern: unknown SIMD level '" << cap
+                  << "', expected scalar, avx2 or avx512" << std::endl;
+        abort();
+      }
+
+#ifdef PREDINTKERN_X86_SIMD
+      __builtin_cpu_init();
+      if(cap == "avx512" && __builtin_cpu_supports("avx512f"))
+        return ShiftSpectrumKernelAVX512;
+      if(cap != "scalar" && __builtin_cpu_supports("avx2"))
+        return ShiftSpectrumKernelAVX2;
+#endif
+
+      return ShiftSpectrumKernelScalar;
+    }
+
+    //----------------------------------------------------------------------
+    void ShiftSpectrumKernel(const ActiveShift* shifts,
+                             unsigned int nShifts,
+                             unsigned int first,
+                             unsigned int last,
+                             unsigned int stride,
                              double* corr)
     {
-      for(unsigned int n = 0; n < N; ++n){
-        const Coeffs& f = fits[n];
-        corr[n] *= f.a*x3 + f.b*x2 + f.c*x + f.d;
-      } // end for n
+      assert(first % kKernelChunk == 0);
+
+      static const KernelFunc kernel = ChooseKernel(getenv("CAFANA_PREDINTERP_SIMD") ? getenv("CAFANA_PREDINTERP_SIMD") : "avx512");
+      kernel(shifts, nShifts, first, last, stride, corr);
     }
 
-    void ShiftSpectrumKernel(const Coeffs* fits,
+    //----------------------------------------------------------------------
+    void ShiftSpectrumKernelWith(const std::string& simd,
+                                 const ActiveShift* shifts,
+                                 unsigned int nShifts,
+                                 unsigned int first,
+                                 unsigned int last,
+                                 unsigned int stride,
+                                 double* corr)
+    {
+      assert(first % kKernelChunk == 0);
+
+      ChooseKernel(simd)(shifts, nShifts, first, last, stride, corr);
+    }
+
+    //----------------------------------------------------------------------
+    void ShiftSpectrumKernel(const double* coeffs,
                              unsigned int N,
+                             unsigned int stride,
                              const stan::math::var& x,
                              const stan::math::var& x2,
                              const stan::math::var& x3,
                              stan::math::var* corr)
     {
+      const double* a = coeffs;
+      const double* b = a + stride;
+      const double* c = b + stride;
+      const double* d = c + stride;
+
       for(unsigned int n = 0; n < N; ++n)
       {
-        const Coeffs& f = fits[n];
-        corr[n] *= f.a*x3 + f.b*x2 + f.c*x + f.d;
+        corr[n] *= a[n]*x3 + b[n]*x2 + c[n]*x + d[n];
       } // end for n
 
     }
@@ -2,6 +2,10 @@
 
 #include "CAFAna/Core/StanTypedefs.h"
 
+#include <cstdlib>
+#include <memory>
+#include <string>
+
 namespace ana
 {
   namespace PredIntKern
@@ -13,17 +17,79 @@ namespace ana
       double a, b, c, d;
     };
 
-    void ShiftSpectrumKernel(const Coeffs* fits,
-                             unsigned int N,
-                             double x, double x2, double x3,
+    /// Bins per cache line of coefficients. Work can be split at multiples
+    /// of this without losing alignment
+    const unsigned int kKernelChunk = 64/sizeof(double);
+
+    /// \brief Cubic coefficients of one CoeffsType (and sign) for all systs
+    ///
+    /// One 64-byte aligned, structure-of-arrays block. Each (syst, shift bin)
+    /// pair gets a slot, which is four rows (a, b, c, d) of \ref Stride
+    /// doubles, one per histogram bin. Stride is the number of bins padded up
+    /// to a whole number of cache lines, so every row is aligned too.
+    class SoACoeffs
+    {
+    public:
+      /// Allocate \a nSlots slots of \a nBins bins, all zero
+      void Reset(unsigned int nBins, size_t nSlots);
+
+      unsigned int NBins() const {return fNBins;}
+      unsigned int Stride() const {return fStride;}
+      size_t NSlots() const {return fNSlots;}
+
+      double* Slot(size_t slot) {return fData.get() + slot*4*fStride;}
+      const double* Slot(size_t slot) const {return fData.get() + slot*4*fStride;}
+
+    protected:
+      struct Free{void operator()(double* p) const {std::free(p);}};
+      std::unique_ptr<double[], Free> fData;
+
+      unsigned int fNBins = 0;
+      unsigned int fStride = 0;
+      size_t fNSlots = 0;
+    };
+
+    /// One syst contributing to \ref ShiftSpectrumKernel
+    struct ActiveShift{
+      const double* coeffs; ///< A \ref SoACoeffs slot
+      double x, x2, x3;
+      /// Outside bins [first, last) the cubic is 1 and is skipped. \a first
+      /// is a multiple of \ref kKernelChunk
+      unsigned int first, last;
+    };
+
+    /// \brief Multiply bins [\a first, \a last) of \a corr by the cubics of
+    /// all of \a shifts
+    ///
+    /// Each shift only within its own bin range. \a first must be a multiple
+    /// of \ref kKernelChunk. Uses AVX-512 or
+    /// AVX2 if the CPU has them, decided at the first call.
+    /// $CAFANA_PREDINTERP_SIMD=scalar, avx2 or avx512 caps the choice.
+    void ShiftSpectrumKernel(const ActiveShift* shifts,
+                             unsigned int nShifts,
+                             unsigned int first,
+                             unsigned int last,
+                             unsigned int stride,
                              double* corr);
 
-    /// Normally I'd make the <double> variant templated,
-    /// but this function is so short that it makes more sense
-    /// to leave the one with <double> arguments pass-by-value
-    /// and do pass-by-ref on the Stan ones here
-    void ShiftSpectrumKernel(const Coeffs* fits,
+    /// \brief \ref ShiftSpectrumKernel capped at \a simd ("scalar", "avx2" or
+    /// "avx512") instead of by the environment
+    ///
+    /// For checking the implementations against each other
+    void ShiftSpectrumKernelWith(const std::string& simd,
+                                 const ActiveShift* shifts,
+                                 unsigned int nShifts,
+                                 unsigned int first,
+                                 unsigned int last,
+                                 unsigned int stride,
+                                 double* corr);
+
+    /// \brief Stan version, one syst at a time
+    ///
+    /// Pass-by-ref on the Stan arguments, \a coeffs is a \ref SoACoeffs slot
+    void ShiftSpectrumKernel(const double* coeffs,
                              unsigned int N,
+                             unsigned int stride,
                              const stan::math::var& x, const stan::math::var& x2, const stan::math::var& x3,
                              stan::math::var* corr);
   }
@@ -34,12 +34,21 @@ if(Stan_FOUND)
 
   cmessage(STATUS "Stan-Math")
   cmessage(STATUS "     INC_DIR: ${Stan_Math_INC_DIR}")
+  cmessage(STATUS "     STAN_THREADS: ${USE_STAN_THREADS}")
 
   if(NOT TARGET Stan::Math)
     add_library(Stan::Math INTERFACE IMPORTED)
     set_target_properties(Stan::Math PROPERTIES
         INTERFACE_INCLUDE_DIRECTORIES "${Stan_Math_INC_DIR}"
     )
+    # Thread-local autodiff stacks, so StanFitter can run chains concurrently.
+    # Everything linking Stan has to agree on this, so it's opt-in. Without it
+    # the chains run one after another
+    if(USE_STAN_THREADS)
+      set_target_properties(Stan::Math PROPERTIES
+          INTERFACE_COMPILE_DEFINITIONS "STAN_THREADS"
+      )
+    endif()
   endif()
   LIST(APPEND STAN_DEPENDENCIES Stan::Math Sundials::All Eigen3::Eigen tbb::All)
 
@@ -0,0 +1,124 @@
+#pragma once
+
+// Shared by the test_*.C regression checks
+
+#include "CAFAna/Core/Spectrum.h"
+#include "CAFAna/Core/SystShifts.h"
+#include "CAFAna/Prediction/IPrediction.h"
+
+#include "OscLib/IOscCalc.h"
+
+#include <Eigen/Dense>
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace test
+{
+  /// The same fills, summed in a different order
+  const double kFillOrderTol = 1e-9;
+
+  /// The same prediction, from coefficients that should be identical
+  const double kSamePredictionTol = 1e-12;
+
+  /// \brief Do \a a and \a b agree, bin by bin, to within \a tol of the
+  /// larger of the two?
+  ///
+  /// Reports the first bin that doesn't
+  inline bool Compare(const Eigen::ArrayXd& a, const Eigen::ArrayXd& b,
+                      double tol, const std::string& what)
+  {
+    if(a.size() != b.size()){
+      std::cout << what << ": " << a.size() << " bins vs " << b.size() << std::endl;
+      return false;
+    }
+
+    for(int i = 0; i < a.size(); ++i){
+      if(std::abs(a[i]-b[i]) > tol*std::max(std::abs(a[i]), std::abs(b[i]))){
+        std::cout << what << ": bin " << i << " differs, "
+                  << a[i] << " vs " << b[i] << std::endl;
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /// Every one of \a as against the same one of \a bs
+  inline bool Compare(const std::vector<Eigen::ArrayXd>& as,
+                      const std::vector<Eigen::ArrayXd>& bs,
+                      double tol, const std::string& what)
+  {
+    if(as.size() != bs.size()){
+      std::cout << what << ": " << as.size() << " predictions vs " << bs.size() << std::endl;
+      return false;
+    }
+
+    for(unsigned int i = 0; i < as.size(); ++i)
+      if(!Compare(as[i], bs[i], tol, what+", shift "+std::to_string(i))) return false;
+    return true;
+  }
+
+  /// Exposures must be identical, contents within \a tol
+  inline bool Compare(const ana::Spectrum& a, const ana::Spectrum& b,
+                      double tol, const std::string& what)
+  {
+    if(a.POT() != b.POT()){
+      std::cout << what << ": POT differs, " << a.POT() << " vs " << b.POT() << std::endl;
+      return false;
+    }
+
+    return Compare(a.GetEigen(a.POT()), b.GetEigen(b.POT()), tol, what);
+  }
+
+  /// \brief Does the \a analytic derivative match the finite difference
+  /// \a numeric, to within \a tol of the larger of one and \a numeric?
+  inline bool CompareDerivative(double analytic, double numeric,
+                                double tol, const std::string& what)
+  {
+    if(std::abs(analytic-numeric) > tol*std::max(1., std::abs(numeric))){
+      std::cout << what << ": analytic " << analytic << ", numerical " << numeric << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  /// \brief \a pred at each of \a shifts, for 1e21 POT
+  ///
+  /// Shared out between \a nThreads threads, each with its own copy of
+  /// \a calc, since calculators cache internally
+  inline std::vector<Eigen::ArrayXd> Predict(const ana::IPrediction& pred,
+                                             const osc::IOscCalcAdjustable& calc,
+                                             const std::vector<ana::SystShifts>& shifts,
+                                             unsigned int nThreads = 1)
+  {
+    std::vector<Eigen::ArrayXd> ret(shifts.size());
+
+    auto work = [&](unsigned int first){
+      std::unique_ptr<osc::IOscCalcAdjustable> local(calc.Copy());
+      for(unsigned int i = first; i < shifts.size(); i += nThreads)
+        ret[i] = pred.PredictSyst(local.get(), shifts[i]).GetEigen(1e21);
+    };
+
+    std::vector<std::thread> threads;
+    for(unsigned int t = 0; t < nThreads; ++t) threads.emplace_back(work, t);
+    for(std::thread& t: threads) t.join();
+
+    return ret;
+  }
+
+  /// Print the verdict on test \a name, and abort if it failed
+  inline void Report(const std::string& name, bool ok)
+  {
+    if(!ok){
+      std::cout << name << ": FAIL" << std::endl;
+      abort();
+    }
+
+    std::cout << name << ": OK" << std::endl;
+  }
+}